@@ -0,0 +1,350 @@
+#if !defined(_WIN32) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE // clock_gettime
+#endif
+
+#include <stdalign.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define BENCH_TSC 1
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define BENCH_TSC 1
+#endif
+
+#include "../src/arena_allocator.h"
+#include "../src/dynamic_string.h"
+#include "../src/general.h"
+#include "../src/ifstream.h"
+#include "../src/output.h"
+#include "../src/pattern_set.h"
+#include "../src/regex.h"
+#include "../src/search.h"
+#include "../src/search_engine.h"
+#include "../src/view.h"
+
+// Throughput benchmark: synthetic corpora searched with every engine and
+// pattern length and printed in every view mode. One CSV row per case goes
+// to stdout, search and view output itself is discarded.
+
+#define BENCH_REPEATS (3) // Best of
+#define BENCH_SEED (0x5EED5EED5EED5EEDull)
+#define BENCH_MULTI_PATTERNS (16)
+#define BENCH_REGEX "[a-z]+[0-9]{3}"
+
+static const size_t default_sizes_mb[] = { 1, 16, 64 };
+static const size_t pattern_sizes[] = { 2, 4, 8, 16, 64 };
+static const engine_kind_t engines[] = { ENGINE_AUTO, ENGINE_PACKED, ENGINE_HORSPOOL, ENGINE_TWOWAY, ENGINE_RARE };
+static const output_mode_t view_modes[] = { OUTPUT_RAW, OUTPUT_HEX, OUTPUT_ASCII, OUTPUT_TEXTONLY };
+static const char* const view_names[] = { "raw", "hex", "ascii", "textonly" };
+
+typedef enum {
+    CORPUS_BINARY,     // Uniform random bytes
+    CORPUS_LOG,        // ASCII log lines
+    CORPUS_UTF8,       // Cyrillic, Greek and CJK words
+    CORPUS_REPETITIVE, // "aaa...ab" runs, worst case for naive shifts
+    CORPUS_COUNT,
+} corpus_kind_t;
+
+static const char* const corpus_names[] = { "binary", "log", "utf8", "repetitive" };
+
+typedef struct bench_env {
+    output_writer results; // stdout
+    output_writer sink;    // null device, takes search and view output
+    FILE* sink_file;
+    uint64_t rng;
+} bench_env;
+
+typedef struct bench_time {
+    double wall_sec;
+    uint64_t cycles; // 0 - no cycle counter on this target
+} bench_time;
+
+// xorshift64*, same sequence on every platform
+static uint64_t bench_random(bench_env* env) {
+    env->rng ^= env->rng >> 12;
+    env->rng ^= env->rng << 25;
+    env->rng ^= env->rng >> 27;
+    return env->rng * 0x2545F4914F6CDD1Dull;
+}
+
+static double bench_wall(void) {
+#ifdef _WIN32
+    LARGE_INTEGER counter, frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+#endif
+}
+
+static uint64_t bench_cycles(void) {
+#ifdef BENCH_TSC
+    return (uint64_t)__rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static void append_word(dstring* out, bench_env* env, const char* const* words, size_t word_count) {
+    dstring_append(out, words[bench_random(env) % word_count]);
+}
+
+static void generate_corpus(bench_env* env, corpus_kind_t kind, size_t size, dstring* out) {
+    static const char* const levels[] = { "INFO", "WARN", "DEBUG", "ERROR" };
+    static const char* const services[] = { "auth", "gateway", "billing", "search", "storage" };
+    static const char* const words[] = {
+        "привет", "мир", "данные", "поиск", "строка", "файл",
+        "γειά", "κόσμος", "δεδομένα", "αναζήτηση",
+        "你好", "世界", "数据", "搜索", "文件",
+        "hello", "world",
+    };
+
+    env->rng = BENCH_SEED + (uint64_t)kind;
+    dstring_clear(out);
+    char line[160];
+    while (dstring_length(out) < size) {
+        switch (kind) {
+            case CORPUS_BINARY: {
+                const uint64_t value = bench_random(env);
+                dstring_append_n(out, (const char*)&value, sizeof(value));
+                break;
+            }
+            case CORPUS_LOG: {
+                const uint64_t r = bench_random(env);
+                snprintf(line, sizeof(line), "2024-%02u-%02uT%02u:%02u:%02u %s %s[%u] request id=%08x latency=%ums\n",
+                         (unsigned)(r % 12 + 1), (unsigned)(r >> 8 & 0x1F) % 28 + 1, (unsigned)(r >> 16 & 0xFF) % 24,
+                         (unsigned)(r >> 24 & 0xFF) % 60, (unsigned)(r >> 32 & 0xFF) % 60,
+                         levels[(r >> 40) % 4], services[(r >> 42) % 5], (unsigned)(r >> 45 & 0xFF),
+                         (unsigned)(r >> 20), (unsigned)(r >> 54));
+                dstring_append(out, line);
+                break;
+            }
+            case CORPUS_UTF8: {
+                const size_t count = bench_random(env) % 12 + 3;
+                for (size_t i = 0; i < count; ++i) {
+                    append_word(out, env, words, sizeof(words) / sizeof(words[0]));
+                    dstring_append_char(out, ' ');
+                }
+                dstring_append_char(out, '\n');
+                break;
+            }
+            case CORPUS_REPETITIVE:
+            default: {
+                const size_t run = bench_random(env) % 200 + 1;
+                for (size_t i = 0; i < run; ++i) {
+                    dstring_append_char(out, 'a');
+                }
+                dstring_append_char(out, 'b');
+                break;
+            }
+        }
+    }
+}
+
+// Pattern taken from the middle of the corpus so it matches at least once,
+// the repetitive corpus gets the usual worst case of a long run with a mismatch at the end
+static void make_pattern(corpus_kind_t kind, const dstring* corpus, size_t size, size_t index, char* out) {
+    if (kind == CORPUS_REPETITIVE) {
+        memset(out, 'a', size);
+        out[size - 1] = 'b';
+        return;
+    }
+    const size_t length = dstring_length(corpus);
+    size_t offset = (length / 2 + index * 7919) % (length - size);
+    memcpy(out, dstring_cstr(corpus) + offset, size);
+}
+
+static FILE* write_corpus(const dstring* corpus) {
+    FILE* file = tmpfile();
+    if (file == NULL) {
+        PRINT_ERRNO("Failed to create corpus file");
+        exit(EXIT_FAILURE);
+    }
+    if (fwrite(dstring_cstr(corpus), 1, dstring_length(corpus), file) != dstring_length(corpus) || fflush(file) != 0) {
+        PRINT_ERRNO("Failed to write corpus file");
+        exit(EXIT_FAILURE);
+    }
+    return file;
+}
+
+static void report(bench_env* env, corpus_kind_t kind, size_t size, const char* bench_case, const char* engine,
+                   size_t pattern_size, bench_time best) {
+    const double mb_per_sec = (best.wall_sec > 0) ? (double)size / (1024.0 * 1024.0) / best.wall_sec : 0;
+    const double cycles_per_byte = (double)best.cycles / (double)size;
+    output_printf(&env->results, "%s,%zu,%s,%s,%zu,%.3f,%.1f,%.3f\n", corpus_names[kind], size, bench_case,
+                  engine, pattern_size, best.wall_sec * 1000.0, mb_per_sec, cycles_per_byte);
+}
+
+static void stream_open(ifstream* stream, FILE* file, ifstream_backend_t backend) {
+    rewind(file);
+    ifstream_init_backend(stream, file, backend);
+}
+
+// Best of BENCH_REPEATS runs, output goes to the sink
+static bench_time run_search(bench_env* env, FILE* file, ifstream_backend_t backend, const search_pattern* patterns,
+                             size_t pattern_count, engine_kind_t engine, const regex* re) {
+    bench_time best = { 0, 0 };
+    for (size_t repeat = 0; repeat < BENCH_REPEATS; ++repeat) {
+        arena_allocator arena = {0};
+        ifstream stream = {0};
+        stream_open(&stream, file, backend);
+        search_ctx ctx = {
+            .patterns = patterns,
+            .pattern_count = pattern_count,
+            .engine = engine,
+            .regex = re,
+            .filepath = "bench",
+            .stream = &stream,
+            .backend = backend,
+            .arena = &arena,
+            .line_buffer = dstring_new(&arena),
+            .max_line = SEARCH_MAX_LINE_DEFAULT,
+            .out = &env->sink,
+            .threads = 1,
+            .counting = true,
+        };
+
+        const double wall = bench_wall();
+        const uint64_t cycles = bench_cycles();
+        search_file(&ctx);
+        output_flush(&env->sink);
+        const bench_time time = { bench_wall() - wall, bench_cycles() - cycles };
+
+        ifstream_close(&stream);
+        arena_drop(&arena);
+        if (repeat == 0 || time.wall_sec < best.wall_sec) best = time;
+    }
+    return best;
+}
+
+static bench_time run_view(bench_env* env, FILE* file, output_mode_t mode) {
+    bench_time best = { 0, 0 };
+    for (size_t repeat = 0; repeat < BENCH_REPEATS; ++repeat) {
+        ifstream stream = {0};
+        stream_open(&stream, file, IFSTREAM_MMAP);
+        print_ctx ctx = { mode, 16, &env->sink };
+
+        const double wall = bench_wall();
+        const uint64_t cycles = bench_cycles();
+        print_file(&ctx, &stream);
+        const bench_time time = { bench_wall() - wall, bench_cycles() - cycles };
+
+        ifstream_close(&stream);
+        if (repeat == 0 || time.wall_sec < best.wall_sec) best = time;
+    }
+    return best;
+}
+
+static void bench_corpus(bench_env* env, corpus_kind_t kind, size_t size, dstring* corpus, arena_allocator* arena) {
+    generate_corpus(env, kind, size, corpus);
+    FILE* file = write_corpus(corpus);
+    const size_t length = dstring_length(corpus);
+
+    char pattern[SEARCH_PATTERN_MAX_SIZE];
+    for (size_t p = 0; p < sizeof(pattern_sizes) / sizeof(pattern_sizes[0]); ++p) {
+        const size_t pattern_size = pattern_sizes[p];
+        make_pattern(kind, corpus, pattern_size, 0, pattern);
+        search_pattern single = { .data = pattern, .size = pattern_size, .label = "bench" };
+
+        for (size_t e = 0; e < sizeof(engines) / sizeof(engines[0]); ++e) {
+            engine_kind_t engine = engines[e];
+            if (engine == ENGINE_PACKED && pattern_size > PACKED_ENGINE_MAX_SIZE) continue;
+            const engine_kind_t used = (engine == ENGINE_AUTO) ? search_engine_select(pattern, pattern_size) : engine;
+
+            bench_time time = run_search(env, file, IFSTREAM_MMAP, &single, 1, used, NULL);
+            report(env, kind, length, "search", engine_kind_name(engine), pattern_size, time);
+        }
+        bench_time time = run_search(env, file, IFSTREAM_BUFFERED, &single, 1,
+                                     search_engine_select(pattern, pattern_size), NULL);
+        report(env, kind, length, "search-buffered", "auto", pattern_size, time);
+
+        // Several patterns at once go through Aho-Corasick
+        search_pattern multi[BENCH_MULTI_PATTERNS];
+        for (size_t i = 0; i < BENCH_MULTI_PATTERNS; ++i) {
+            char* data = arena_allocate(arena, pattern_size, 1);
+            make_pattern(kind, corpus, pattern_size, i, data);
+            multi[i] = (search_pattern) { .data = data, .size = pattern_size, .label = "bench" };
+        }
+        time = run_search(env, file, IFSTREAM_MMAP, multi, BENCH_MULTI_PATTERNS, ENGINE_AUTO, NULL);
+        report(env, kind, length, "multi", "aho-corasick", pattern_size, time);
+    }
+
+    regex re;
+    const char* error = NULL;
+    size_t error_offset = 0;
+    if (regex_compile(&re, arena, BENCH_REGEX, &error, &error_offset)) {
+        bench_time time = run_search(env, file, IFSTREAM_MMAP, NULL, 0, ENGINE_AUTO, &re);
+        report(env, kind, length, "regex", "lazy-dfa", strlen(BENCH_REGEX), time);
+    } else {
+        fprintf(stderr, "Failed to compile benchmark regex: %s\n", error);
+    }
+
+    for (size_t v = 0; v < sizeof(view_modes) / sizeof(view_modes[0]); ++v) {
+        bench_time time = run_view(env, file, view_modes[v]);
+        report(env, kind, length, "view", view_names[v], 0, time);
+    }
+
+    fclose(file);
+}
+
+int main(int argc, char** argv) {
+    size_t sizes[64];
+    size_t size_count = 0;
+    for (int i = 1; i < argc && size_count < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        char* end = NULL;
+        unsigned long mb = strtoul(argv[i], &end, 10);
+        if (end == argv[i] || *end != '\0' || mb == 0) {
+            fprintf(stderr, "Usage: %s [size in MB]...\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+        sizes[size_count++] = (size_t)mb;
+    }
+    if (size_count == 0) {
+        size_count = sizeof(default_sizes_mb) / sizeof(default_sizes_mb[0]);
+        memcpy(sizes, default_sizes_mb, sizeof(default_sizes_mb));
+    }
+
+    bench_env env = {0};
+#ifdef _WIN32
+    env.sink_file = fopen("NUL", "wb");
+#else
+    env.sink_file = fopen("/dev/null", "wb");
+#endif
+    if (env.sink_file == NULL) {
+        PRINT_ERRNO("Failed to open null device");
+        return EXIT_FAILURE;
+    }
+    output_init(&env.results, stdout);
+    output_init(&env.sink, env.sink_file);
+
+    output_string(&env.results, "corpus,size_bytes,case,engine,pattern_size,wall_ms,mb_per_sec,cycles_per_byte\n");
+    arena_allocator arena = {0};
+    dstring corpus = dstring_new(&arena);
+    for (size_t s = 0; s < size_count; ++s) {
+        for (int kind = 0; kind < CORPUS_COUNT; ++kind) {
+            bench_corpus(&env, (corpus_kind_t)kind, sizes[s] * 1024 * 1024, &corpus, &arena);
+            output_flush(&env.results);
+        }
+    }
+
+    arena_drop(&arena);
+    output_close(&env.sink);
+    output_close(&env.results);
+    fclose(env.sink_file);
+    return EXIT_SUCCESS;
+}
@@ -8,7 +8,15 @@ set ERRORS=-Werror
 set OPTIMIZATION=-O3
 
 :: Source files (space-separated)
-set SOURCES=src/main.c src/arena_allocator.c src/ifstream.c src/utf8_util.c src/dynamic_string.c
+set SOURCES=src/main.c src/arena_allocator.c src/ifstream.c src/utf8_util.c src/dynamic_string.c src/prefilter.c src/search_engine.c src/search.c src/pattern_set.c src/aho_corasick.c src/thread.c src/dir_walk.c src/work_pool.c src/trigram_index.c src/regex.c src/lazy_dfa.c src/hex_dump.c src/output.c src/text_count.c src/block_pool.c src/view.c src/run_stats.c src/decompress.c src/follow.c
+
+:: "build.bat bench [size in MB]..." builds the benchmark in place of main.c and runs it
+set BENCH=0
+if "%1"=="bench" (
+  set BENCH=1
+  set OUTPUT=sometil_bench.exe
+  set SOURCES=bench/bench.c%SOURCES:src/main.c=%
+)
 
 :: ===== Building =====
 echo Building %OUTPUT% with %COMPILER% %STANDARD%...
@@ -21,6 +29,9 @@ if %errorlevel% equ 0 (
     set size=%%~zF
     echo Size: %size% bytes
   )
+  if %BENCH%==1 (
+    %OUTPUT% %2 %3 %4 %5 %6 %7 %8 %9
+  )
 ) else (
   echo Failed to build sometil
   exit /b 1
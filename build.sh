@@ -5,22 +5,66 @@ OUTPUT="sometil.exe"
 WARNINGS="-Wall -Wextra"
 ERRORS="-Werror"
 OPTIMIZATION="-O3"
+LIBS="-pthread"
 SOURCES=(
   "src/main.c"
   "src/arena_allocator.c"
   "src/ifstream.c"
   "src/utf8_util.c"
   "src/dynamic_string.c"
+  "src/prefilter.c"
+  "src/search_engine.c"
+  "src/search.c"
+  "src/pattern_set.c"
+  "src/aho_corasick.c"
+  "src/thread.c"
+  "src/dir_walk.c"
+  "src/work_pool.c"
+  "src/trigram_index.c"
+  "src/regex.c"
+  "src/lazy_dfa.c"
+  "src/hex_dump.c"
+  "src/output.c"
+  "src/text_count.c"
+  "src/block_pool.c"
+  "src/view.c"
+  "src/run_stats.c"
+  "src/decompress.c"
+  "src/follow.c"
 )
 
+# Decoders for .gz and .zst input, each one only if its header and library are there
+DEFINES=""
+if printf '#include <zlib.h>\nint main(void) { return zlibVersion() == 0; }\n' |
+   $COMPILER -x c - -lz -o /dev/null 2>/dev/null; then
+  DEFINES="$DEFINES -DSOMETIL_ZLIB"
+  LIBS="$LIBS -lz"
+fi
+if printf '#include <zstd.h>\nint main(void) { return ZSTD_versionNumber() == 0; }\n' |
+   $COMPILER -x c - -lzstd -o /dev/null 2>/dev/null; then
+  DEFINES="$DEFINES -DSOMETIL_ZSTD"
+  LIBS="$LIBS -lzstd"
+fi
+
+# "./build.sh bench [size in MB]..." builds the benchmark in place of main.c and runs it
+BENCH=0
+if [ "$1" == "bench" ]; then
+  BENCH=1
+  OUTPUT="sometil_bench.exe"
+  SOURCES=("bench/bench.c" "${SOURCES[@]:1}")
+fi
+
 echo "Build $OUTPUT with $COMPILER $STANDARD..."
 $COMPILER "${SOURCES[@]}" -o "$OUTPUT" \
   -std="$STANDARD" \
-  $WARNINGS $ERRORS $OPTIMIZATION
+  $WARNINGS $ERRORS $OPTIMIZATION $DEFINES $LIBS
 
 if [ $? -eq 0 ]; then
   echo "Succes: $OUTPUT"
   ls -lh "$OUTPUT" | awk '{print "Size:", $5}'
+  if [ $BENCH -eq 1 ]; then
+    ./"$OUTPUT" "${@:2}"
+  fi
 else
   echo "Failed to build sometil"
   exit 1
@@ -0,0 +1,190 @@
+#include <stdalign.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "aho_corasick.h"
+
+#define AC_NONE (UINT32_MAX)
+
+typedef struct ac_node {
+    uint32_t first_child;
+    uint32_t next_sibling;
+    uint32_t first_pattern;
+    uint8_t cls;
+} ac_node;
+
+static uint32_t ac_child(const ac_node* nodes, uint32_t node, uint8_t cls) {
+    for (uint32_t child = nodes[node].first_child; child != AC_NONE; child = nodes[child].next_sibling) {
+        if (nodes[child].cls == cls) return child;
+    }
+    return AC_NONE;
+}
+
+// Byte groups, every group is named by its smallest byte
+static uint8_t ac_group(const uint8_t* group, uint8_t b) {
+    while (group[b] != b) b = group[b];
+    return b;
+}
+
+static void ac_merge(uint8_t* group, uint8_t a, uint8_t b) {
+    a = ac_group(group, a);
+    b = ac_group(group, b);
+    if (a < b) group[b] = a;
+    if (b < a) group[a] = b;
+}
+
+bool ac_build(ac_automaton* ac, arena_allocator* arena, const search_pattern* patterns, size_t count) {
+    assert(ac != NULL);
+    assert(arena != NULL);
+    assert(patterns != NULL);
+    assert(count != 0);
+
+    // Byte classes. Bytes that differ in a fold bit of some pattern are merged
+    // into one group, so folded matches walk the same trie path.
+    uint8_t group[256];
+    for (size_t b = 0; b < 256; ++b) group[b] = (uint8_t)b;
+    bool used[256] = {0};
+    size_t total = 0;
+    ac->fold = false;
+    for (size_t i = 0; i < count; ++i) {
+        assert(patterns[i].size != 0);
+        for (size_t j = 0; j < patterns[i].size; ++j) {
+            unsigned char b = (unsigned char)patterns[i].data[j];
+            used[b] = true;
+            if (patterns[i].fold != NULL && patterns[i].fold[j] != 0) {
+                ac_merge(group, b, (unsigned char)(b & ~patterns[i].fold[j]));
+                ac->fold = true;
+            }
+        }
+        total += patterns[i].size;
+    }
+    for (size_t b = 0; b < 256; ++b) {
+        if (used[b]) used[ac_group(group, (uint8_t)b)] = true;
+    }
+    size_t class_count = 1;
+    for (size_t b = 0; b < 256; ++b) {
+        ac->classes[b] = (used[b] && ac_group(group, (uint8_t)b) == b) ? (uint8_t)class_count++ : 0;
+    }
+    for (size_t b = 0; b < 256; ++b) {
+        ac->classes[b] = ac->classes[ac_group(group, (uint8_t)b)];
+    }
+    if (class_count > 256) {
+        // All 256 bytes are used, nothing shares a class
+        for (size_t b = 0; b < 256; ++b) ac->classes[b] = (uint8_t)b;
+        class_count = 256;
+    }
+
+    // Trie
+    ac_node* nodes = malloc((total + 1) * sizeof(ac_node));
+    uint32_t* pattern_next = malloc(count * sizeof(uint32_t));
+    assert(nodes != NULL && pattern_next != NULL);
+
+    size_t node_count = 1;
+    nodes[0] = (ac_node){ AC_NONE, AC_NONE, AC_NONE, 0 };
+    for (size_t i = 0; i < count; ++i) {
+        uint32_t node = 0;
+        for (size_t j = 0; j < patterns[i].size; ++j) {
+            uint8_t cls = ac->classes[(unsigned char)patterns[i].data[j]];
+            uint32_t child = ac_child(nodes, node, cls);
+            if (child == AC_NONE) {
+                child = (uint32_t)node_count++;
+                nodes[child] = (ac_node){ AC_NONE, nodes[node].first_child, AC_NONE, cls };
+                nodes[node].first_child = child;
+            }
+            node = child;
+        }
+        pattern_next[i] = nodes[node].first_pattern;
+        nodes[node].first_pattern = (uint32_t)i;
+    }
+
+    if ((uint64_t)node_count * class_count >= AC_MATCH_BIT) {
+        free(pattern_next);
+        free(nodes);
+        return false;
+    }
+
+    // Breadth-first: failure links, dense transitions and output counts
+    uint32_t* transitions = arena_allocate(arena, node_count * class_count * sizeof(uint32_t), alignof(uint32_t));
+    uint32_t* output_start = arena_allocate(arena, (node_count + 1) * sizeof(uint32_t), alignof(uint32_t));
+    uint32_t* fail = malloc(node_count * sizeof(uint32_t));
+    uint32_t* queue = malloc(node_count * sizeof(uint32_t));
+    uint32_t* output_count = calloc(node_count, sizeof(uint32_t));
+    assert(fail != NULL && queue != NULL && output_count != NULL);
+
+    size_t head = 0;
+    size_t tail = 0;
+    fail[0] = 0;
+    queue[tail++] = 0;
+    while (head < tail) {
+        uint32_t node = queue[head++];
+        uint32_t* row = &transitions[node * class_count];
+
+        if (node == 0) {
+            memset(row, 0, class_count * sizeof(uint32_t));
+        } else {
+            memcpy(row, &transitions[fail[node] * class_count], class_count * sizeof(uint32_t));
+        }
+
+        for (uint32_t child = nodes[node].first_child; child != AC_NONE; child = nodes[child].next_sibling) {
+            fail[child] = (node == 0) ? 0 : (transitions[fail[node] * class_count + nodes[child].cls] & ~AC_MATCH_BIT) / class_count;
+
+            uint32_t own = 0;
+            for (uint32_t p = nodes[child].first_pattern; p != AC_NONE; p = pattern_next[p]) ++own;
+            output_count[child] = own + output_count[fail[child]];
+
+            row[nodes[child].cls] = (uint32_t)(child * class_count) | (output_count[child] ? AC_MATCH_BIT : 0);
+            queue[tail++] = child;
+        }
+    }
+
+    // Outputs: own patterns first, then everything reachable through failure links
+    output_start[0] = 0;
+    for (size_t i = 0; i < node_count; ++i) {
+        output_start[i + 1] = output_start[i] + output_count[i];
+    }
+    size_t output_total = output_start[node_count];
+    uint32_t* outputs = arena_allocate(arena, (output_total ? output_total : 1) * sizeof(uint32_t), alignof(uint32_t));
+    for (size_t i = 1; i < node_count; ++i) {
+        uint32_t node = queue[i];
+        uint32_t at = output_start[node];
+        for (uint32_t p = nodes[node].first_pattern; p != AC_NONE; p = pattern_next[p]) {
+            outputs[at++] = p;
+        }
+        uint32_t from = output_start[fail[node]];
+        memcpy(&outputs[at], &outputs[from], output_count[fail[node]] * sizeof(uint32_t));
+    }
+
+    free(output_count);
+    free(queue);
+    free(fail);
+    free(pattern_next);
+    free(nodes);
+
+    ac->transitions = transitions;
+    ac->output_start = output_start;
+    ac->outputs = outputs;
+    ac->state_count = node_count;
+    ac->class_count = class_count;
+    return true;
+}
+
+void ac_scan(const ac_automaton* ac, const char* begin, const char* end, ac_match_func on_match, void* user) {
+    assert(ac != NULL);
+    assert(on_match != NULL);
+
+    const uint32_t* transitions = ac->transitions;
+    const uint8_t* classes = ac->classes;
+    uint32_t state = 0;
+
+    for (const char* p = begin; p < end; ++p) {
+        state = transitions[state + classes[(unsigned char)*p]];
+        if (state & AC_MATCH_BIT) {
+            state &= ~AC_MATCH_BIT;
+            size_t node = state / ac->class_count;
+            for (uint32_t i = ac->output_start[node]; i < ac->output_start[node + 1]; ++i) {
+                on_match(user, p + 1, ac->outputs[i]);
+            }
+        }
+    }
+}
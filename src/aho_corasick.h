@@ -0,0 +1,35 @@
+#ifndef __AHO_CORASICK_H__
+#define __AHO_CORASICK_H__ 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena_allocator.h"
+#include "pattern_set.h"
+
+// Set on transitions into states that end at least one pattern
+#define AC_MATCH_BIT (0x80000000u)
+
+// Dense DFA over byte classes: bytes that occur in no pattern share class 0.
+// Transitions hold row offsets (state * class_count) so scanning needs no multiply.
+typedef struct ac_automaton {
+    const uint32_t* transitions;
+    const uint32_t* output_start; // per state, outputs[output_start[s] .. output_start[s + 1])
+    const uint32_t* outputs;      // pattern indices
+    size_t state_count;
+    size_t class_count;
+    uint8_t classes[256];
+    bool fold; // Bytes a fold bit tells apart share classes, callers verify every match
+} ac_automaton;
+
+// Called with one-past-the-end of the match
+typedef void (*ac_match_func)(void* user, const char* match_end, uint32_t pattern);
+
+// Any caseless pattern makes the automaton fold its bits for every pattern
+bool ac_build(ac_automaton* ac, arena_allocator* arena, const search_pattern* patterns, size_t count);
+
+// Reports every match lying completely inside [begin, end)
+void ac_scan(const ac_automaton* ac, const char* begin, const char* end, ac_match_func on_match, void* user);
+
+#endif // __AHO_CORASICK_H__
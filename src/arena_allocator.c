@@ -6,100 +6,218 @@
 #include <string.h>
 
 #include "arena_allocator.h"
+#include "block_pool.h"
 
 
 #define ALIGN_UP(ptr, align) (((size_t)(ptr) + ((align) - 1)) & ~((align) - 1))
 #define GENERAL_ALLOC(size) calloc(1, size)
 #define GENERAL_FREE(ptr) free(ptr)
 
+// Stands in for max_align_t, which C99 headers don't declare
+typedef union block_align {
+    long double d;
+    void* p;
+    long long l;
+} block_align;
+
+// Data starts right after the header, aligned for any type
+#define BLOCK_HEADER_SIZE ALIGN_UP(sizeof(arena_block), alignof(block_align))
+#define BLOCK_DATA(block) ((char*)(block) + BLOCK_HEADER_SIZE)
+
+static void arena_free_chain(arena_allocator* arr, arena_block* block) {
+    while (block != NULL) {
+        arena_block* next = block->next;
+        if (block->pooled) {
+            block_pool_put(arr->pool, block);
+        } else {
+            GENERAL_FREE(block);
+        }
+        block = next;
+    }
+}
+
+// New blocks come zeroed from calloc, reused ones shouldn't differ. Only the part of
+// [ptr, ptr + size) an earlier user may have written is cleared.
+static void arena_block_clear(arena_block* block, char* ptr, size_t size) {
+    const size_t begin = (size_t)(ptr - BLOCK_DATA(block));
+    const size_t end = begin + size;
+    if (begin < block->dirty) memset(ptr, 0, ((end < block->dirty) ? end : block->dirty) - begin);
+    if (end > block->dirty) block->dirty = end;
+}
+
+// Free block big enough for need, or a new one twice the size of the tail
+static arena_block* arena_take_block(arena_allocator* arr, size_t need) {
+    for (arena_block** link = &arr->free_blocks; *link != NULL; link = &(*link)->next) {
+        arena_block* block = *link;
+        if (block->capacity < need) continue;
+
+        *link = block->next;
+        return block;
+    }
+
+    if (arr->pool != NULL && need <= arr->pool->block_size - BLOCK_HEADER_SIZE) {
+        // Another arena may have used the block, its data is cleared as it is handed out
+        arena_block* block = block_pool_get(arr->pool);
+        memset(block, 0, sizeof(arena_block));
+        block->capacity = arr->pool->block_size - BLOCK_HEADER_SIZE;
+        block->dirty = block->capacity;
+        block->pooled = true;
+        arr->reserved += block->capacity;
+        ++arr->block_count;
+        return block;
+    }
+
+    size_t capacity = (arr->tail != NULL) ? arr->tail->capacity * 2 : ARENA_MIN_BLOCK_SIZE;
+    if (capacity < ARENA_MIN_BLOCK_SIZE) capacity = ARENA_MIN_BLOCK_SIZE;
+    if (capacity > ARENA_MAX_BLOCK_SIZE) capacity = ARENA_MAX_BLOCK_SIZE;
+    if (capacity < need) capacity = need;
+
+    arena_block* block = GENERAL_ALLOC(BLOCK_HEADER_SIZE + capacity);
+    assert(block != NULL && "Failed to allocate memory block");
+    block->capacity = capacity;
+    arr->reserved += capacity;
+    ++arr->block_count;
+    return block;
+}
+
 void* arena_allocate(arena_allocator* arr, size_t size, size_t align) {
     assert(arr != NULL);
     assert(size != 0);
     assert(align != 0 && (align & (align - 1)) == 0);
-    
-    if (arr->memory_block == NULL) {
-        size_t block_size = (size > 1024) ? size * 2 : 1024;
-        void* allocated = GENERAL_ALLOC(block_size);
-        assert(allocated != NULL && "Failed to allocate memory block");
-        
-        arr->memory_block = allocated;
-        arr->capacity = block_size;
-        arr->size = 0;
-        arr->next = NULL;
-    }
-
-    void* current_ptr = (char*)arr->memory_block + arr->size;
-    void* aligned_ptr = (void*)ALIGN_UP((size_t)current_ptr, align);
-    size_t actual_size = size + ((char*)aligned_ptr - (char*)current_ptr);
 
-    if (arr->size + actual_size <= arr->capacity) {
-        arr->size += actual_size;
-        return aligned_ptr;
+    arena_block* block = arr->tail;
+    if (block != NULL) {
+        char* current_ptr = BLOCK_DATA(block) + block->size;
+        char* aligned_ptr = (char*)ALIGN_UP(current_ptr, align);
+        size_t actual_size = size + (size_t)(aligned_ptr - current_ptr);
+        if (actual_size <= block->capacity - block->size) {
+            arena_block_clear(block, aligned_ptr, size);
+            block->size += actual_size;
+            arr->used += actual_size;
+            if (arr->used > arr->peak) arr->peak = arr->used;
+            arr->last = aligned_ptr;
+            return aligned_ptr;
+        }
     }
 
-    if (arr->next == NULL) {
-        arena_allocator* next_arena = (arena_allocator*)GENERAL_ALLOC(sizeof(arena_allocator));
-        assert(next_arena != NULL && "Failed to allocate new arena");
-        memset(next_arena, 0, sizeof(arena_allocator));
-        arr->next = next_arena;
+    // The rest of the tail stays unused, its blocks are never revisited
+    block = arena_take_block(arr, size + align - 1);
+    block->next = NULL;
+    block->size = 0;
+    if (arr->tail != NULL) {
+        arr->tail->next = block;
+    } else {
+        arr->head = block;
     }
+    arr->tail = block;
 
-    return arena_allocate(arr->next, size, align);
+    char* aligned_ptr = (char*)ALIGN_UP(BLOCK_DATA(block), align);
+    size_t actual_size = size + (size_t)(aligned_ptr - BLOCK_DATA(block));
+    arena_block_clear(block, aligned_ptr, size);
+    block->size = actual_size;
+    arr->used += actual_size;
+    if (arr->used > arr->peak) arr->peak = arr->used;
+    arr->last = aligned_ptr;
+    return aligned_ptr;
 }
 
 void arena_drop(arena_allocator* arr) {
     if (arr == NULL) return;
-    
-    arena_allocator* current = arr;
-    while (current != NULL) {
-        arena_allocator* next = current->next;
-        if (current->memory_block != NULL) {
-            GENERAL_FREE(current->memory_block);
-            current->memory_block = NULL;
-        }
-        if (current != arr) {
-            GENERAL_FREE(current);
-        }
-        current = next;
-    }
-    arr->next = NULL;
-    arr->size = 0;
-    arr->capacity = 0;
+
+    arena_free_chain(arr, arr->head);
+    arena_free_chain(arr, arr->free_blocks);
+    block_pool* pool = arr->pool;
+    memset(arr, 0, sizeof(arena_allocator));
+    arr->pool = pool;
 }
 
 arena_slice arena_push(arena_allocator* arr, size_t size, size_t align) {
     assert(arr != NULL);
-    
-    arena_allocator* last_arena = arr;
-    while (last_arena->next != NULL) {
-        last_arena = last_arena->next;
-    }
-    
+
     arena_slice slice = {
         .arena = arr,
-        .last_arena = last_arena,
-        .saved_size = last_arena->size,
-        .allocated = arena_allocate(arr, size, align),
+        .block = arr->tail,
+        .saved_size = (arr->tail != NULL) ? arr->tail->size : 0,
+        .saved_used = arr->used,
     };
-    
+    slice.allocated = arena_allocate(arr, size, align);
+
     return slice;
 }
 
 void arena_pop(arena_slice slice) {
     assert(slice.arena != NULL);
-    
-    slice.last_arena->size = slice.saved_size;
-    
-    arena_allocator* current = slice.last_arena->next;
-    while (current != NULL) {
-        arena_allocator* next = current->next;
-        if (current->memory_block != NULL) {
-            GENERAL_FREE(current->memory_block);
-        }
-        GENERAL_FREE(current);
-        current = next;
+    arena_allocator* arr = slice.arena;
+
+    // Blocks taken after the push go to the free list
+    arena_block* released = (slice.block != NULL) ? slice.block->next : arr->head;
+    if (released != NULL) {
+        arr->tail->next = arr->free_blocks;
+        arr->free_blocks = released;
+    }
+
+    if (slice.block != NULL) {
+        slice.block->size = slice.saved_size;
+        slice.block->next = NULL;
+    } else {
+        arr->head = NULL;
+    }
+    arr->tail = slice.block;
+    arr->used = slice.saved_used;
+
+    // Released chunks may lie in the memory given back
+    arr->last = NULL;
+    memset(arr->free_chunks, 0, sizeof(arr->free_chunks));
+}
+
+static size_t size_class_floor(size_t size) {
+    size_t k = 0;
+    while (k + 1 < ARENA_SIZE_CLASSES && ((size_t)2 << k) <= size) ++k;
+    return k;
+}
+
+static size_t size_class_ceil(size_t size) {
+    size_t k = size_class_floor(size);
+    return (((size_t)1 << k) < size) ? k + 1 : k;
+}
+
+// A free chunk keeps the link to the next one in its first bytes
+static void* chunk_next(void* chunk) {
+    void* next;
+    memcpy(&next, chunk, sizeof(next));
+    return next;
+}
+
+void arena_release(arena_allocator* arr, void* ptr, size_t size) {
+    assert(arr != NULL);
+    if (ptr == NULL || size == 0) return;
+
+    arena_block* tail = arr->tail;
+    if ((char*)ptr == arr->last && tail != NULL) {
+        // Top of the tail block, simply give it back
+        tail->size = (size_t)((char*)ptr - BLOCK_DATA(tail));
+        arr->last = NULL;
+    } else {
+        if (size < ARENA_MIN_FREE_SIZE) return;
+        const size_t k = size_class_floor(size);
+        memcpy(ptr, &arr->free_chunks[k], sizeof(void*));
+        arr->free_chunks[k] = ptr;
     }
-    slice.last_arena->next = NULL;
+    arr->used -= size;
+}
+
+// Chunk from the free lists that fits size, NULL if there's none
+static void* arena_reuse(arena_allocator* arr, size_t size, size_t align) {
+    const size_t k = size_class_ceil(size);
+    if (k >= ARENA_SIZE_CLASSES) return NULL;
+
+    void* chunk = arr->free_chunks[k];
+    if (chunk == NULL || ((size_t)chunk & (align - 1)) != 0) return NULL;
+
+    arr->free_chunks[k] = chunk_next(chunk);
+    arr->used += size;
+    if (arr->used > arr->peak) arr->peak = arr->used;
+    return chunk;
 }
 
 void* arena_realloc(arena_allocator* arr, void* ptr, size_t old_size, size_t new_size, size_t align) {
@@ -111,38 +229,43 @@ void* arena_realloc(arena_allocator* arr, void* ptr, size_t old_size, size_t new
         return arena_allocate(arr, new_size, align);
     }
     
-    // Act like arena_free(does not exist, soo. . .)
     if (new_size == 0) {
+        arena_release(arr, ptr, old_size);
         return NULL;
     }
     
-    arena_allocator* current = arr;
-    while (current != NULL) {
-        if (ptr >= current->memory_block && 
-            (char*)ptr < (char*)current->memory_block + current->capacity) {
-            break;
-        }
-        current = current->next;
-    }
-    if (current == NULL) {
-        assert(0 && "Pointer does not belong to any arena");
-        return NULL;
-    }
-
-    // Just shift
-    if ((char*)ptr + new_size <= (char*)current->memory_block + current->capacity) {
-        current->size += (new_size - old_size);
+    // The last allocation ends at the top of the tail block and can move it
+    arena_block* tail = arr->tail;
+    if ((char*)ptr == arr->last && tail != NULL &&
+        new_size <= (size_t)(BLOCK_DATA(tail) + tail->capacity - (char*)ptr)) {
+        tail->size = (size_t)((char*)ptr - BLOCK_DATA(tail)) + new_size;
+        // Grown bytes are not cleared, but they are written from now on
+        if (tail->size > tail->dirty) tail->dirty = tail->size;
+        arr->used += new_size - old_size;
+        if (arr->used > arr->peak) arr->peak = arr->used;
         return ptr;
     }
     
-    // Not enough capacity - allocate new
-    void* new_ptr = arena_allocate(arr, new_size, align);
+    void* new_ptr = arena_reuse(arr, new_size, align);
     if (new_ptr == NULL) {
-        return NULL;
+        new_ptr = arena_allocate(arr, new_size, align);
     }
     
     // Copy to new allocated block
     memcpy(new_ptr, ptr, old_size > new_size ? new_size : old_size);
+    arena_release(arr, ptr, old_size);
     
     return new_ptr;
-}
\ No newline at end of file
+}
+
+arena_stats arena_get_stats(const arena_allocator* arr) {
+    assert(arr != NULL);
+
+    arena_stats stats = {
+        .used = arr->used,
+        .reserved = arr->reserved,
+        .block_count = arr->block_count,
+        .peak = arr->peak,
+    };
+    return stats;
+}
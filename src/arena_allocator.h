@@ -1,25 +1,65 @@
 #ifndef __ARENA_ALLOCATOR_H__
 #define __ARENA_ALLOCATOR_H__ 1
 
+#include <stdbool.h>
 #include <stddef.h>
 
-typedef struct arena_allocator {
-    void* memory_block;
-    size_t capacity;
+#include "block_pool.h"
+
+// Blocks grow geometrically from ARENA_MIN_BLOCK_SIZE up to ARENA_MAX_BLOCK_SIZE,
+// bigger requests get a block of their own
+#define ARENA_MIN_BLOCK_SIZE (1024)
+#define ARENA_MAX_BLOCK_SIZE (64 * 1024 * 1024)
+// Released chunks are kept in power of two size classes, smaller ones are dropped
+#define ARENA_MIN_FREE_SIZE (16)
+#define ARENA_SIZE_CLASSES (48)
+
+typedef struct arena_block {
+    struct arena_block* next;
+    size_t capacity; // Bytes after the header
     size_t size;
-    struct arena_allocator* next;
+    size_t dirty;    // Bytes before this offset may hold old data, the rest is zero
+    bool pooled;     // Goes back to the arena's block pool on drop
+} arena_block;
+
+// Zero initialized arena is empty and ready to use. With a pool set, blocks
+// come from it and go back to it on arena_drop, so worker arenas share memory.
+typedef struct arena_allocator {
+    block_pool* pool;         // NULL - blocks come from malloc, kept across arena_drop
+    arena_block* head;
+    arena_block* tail;        // Allocations come from here, earlier blocks are full
+    arena_block* free_blocks; // Released by arena_pop, reused before asking malloc
+    char* last;               // Most recent allocation, the only one that can grow in place
+    void* free_chunks[ARENA_SIZE_CLASSES]; // Class k holds chunks of at least 2^k bytes
+    size_t used;        // Bytes handed out, alignment padding included
+    size_t reserved;    // Bytes in all blocks, free ones included
+    size_t block_count; // All blocks, free ones included
+    size_t peak;        // Highest used so far
 } arena_allocator;
 
 typedef struct arena_slice {
     arena_allocator* arena;
-    arena_allocator* last_arena;
+    arena_block* block; // Tail at push time, NULL - the arena was empty
     size_t saved_size;
+    size_t saved_used;
     void* allocated;
 } arena_slice;
 
+typedef struct arena_stats {
+    size_t used;
+    size_t reserved;
+    size_t block_count;
+    size_t peak;
+} arena_stats;
+
 void* arena_allocate(arena_allocator*, size_t size, size_t align);
 void arena_drop(arena_allocator*);
 arena_slice arena_push(arena_allocator*, size_t size, size_t align);
 void arena_pop(arena_slice);
+// The most recent allocation grows and shrinks in place. Anything else moves,
+// and its old storage goes to the size class free lists. Grown bytes are not zeroed.
 void* arena_realloc(arena_allocator*, void* ptr, size_t old_size, size_t new_size, size_t align);
-#endif // __ARENA_ALLOCATOR_H__
\ No newline at end of file
+// Gives back storage no longer in use, reused by later arena_realloc calls
+void arena_release(arena_allocator*, void* ptr, size_t size);
+arena_stats arena_get_stats(const arena_allocator*);
+#endif // __ARENA_ALLOCATOR_H__
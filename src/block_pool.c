@@ -0,0 +1,94 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE // MADV_HUGEPAGE
+#elif !defined(_WIN32) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
+
+#include <assert.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#include "block_pool.h"
+#include "thread.h"
+
+#define BLOCK_POOL_TAG_MASK ((uintptr_t)(BLOCK_POOL_ALIGN - 1))
+
+// Free blocks link through their first bytes
+typedef struct pool_node {
+    uintptr_t next;
+} pool_node;
+
+static void* block_alloc(const block_pool* pool) {
+    // Huge pages need the block aligned to their size
+    const size_t align = pool->huge_pages ? pool->block_size : BLOCK_POOL_ALIGN;
+#ifdef _WIN32
+    void* block = _aligned_malloc(pool->block_size, align);
+#else
+    void* block = NULL;
+    if (posix_memalign(&block, align, pool->block_size) != 0) block = NULL;
+#ifdef MADV_HUGEPAGE
+    // Best effort, transparent huge pages may be off
+    if (block != NULL && pool->huge_pages) madvise(block, pool->block_size, MADV_HUGEPAGE);
+#endif
+#endif
+    assert(block != NULL && "Failed to allocate pool block");
+    return block;
+}
+
+static void block_free(void* block) {
+#ifdef _WIN32
+    _aligned_free(block);
+#else
+    free(block);
+#endif
+}
+
+void block_pool_init(block_pool* pool, bool huge_pages) {
+    assert(pool != NULL);
+
+    pool->head = 0;
+    pool->huge_pages = huge_pages;
+    pool->block_size = huge_pages ? BLOCK_POOL_HUGE_BLOCK_SIZE : BLOCK_POOL_BLOCK_SIZE;
+}
+
+void block_pool_destroy(block_pool* pool) {
+    assert(pool != NULL);
+
+    void* block = NULL;
+    while ((block = (void*)(atomic_load_word(&pool->head) & ~BLOCK_POOL_TAG_MASK)) != NULL) {
+        block_free(block_pool_get(pool));
+    }
+    pool->head = 0;
+}
+
+void* block_pool_get(block_pool* pool) {
+    assert(pool != NULL);
+
+    for (;;) {
+        const uintptr_t head = atomic_load_word(&pool->head);
+        pool_node* node = (pool_node*)(head & ~BLOCK_POOL_TAG_MASK);
+        if (node == NULL) return block_alloc(pool);
+
+        // Blocks stay allocated while the pool lives, so a node another thread
+        // just took is still readable, its stale link fails the swap below
+        const uintptr_t next = node->next;
+        if (atomic_cas_word(&pool->head, head, next | ((head + 1) & BLOCK_POOL_TAG_MASK))) return node;
+    }
+}
+
+void block_pool_put(block_pool* pool, void* block) {
+    assert(pool != NULL);
+    assert(block != NULL && ((uintptr_t)block & BLOCK_POOL_TAG_MASK) == 0);
+
+    pool_node* node = block;
+    for (;;) {
+        const uintptr_t head = atomic_load_word(&pool->head);
+        node->next = head & ~BLOCK_POOL_TAG_MASK;
+        if (atomic_cas_word(&pool->head, head, (uintptr_t)node | ((head + 1) & BLOCK_POOL_TAG_MASK))) return;
+    }
+}
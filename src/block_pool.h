@@ -0,0 +1,33 @@
+#ifndef __BLOCK_POOL_H__
+#define __BLOCK_POOL_H__ 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Shared pool of fixed size, page aligned memory blocks. Threads take and give
+// back blocks without locks (Treiber stack), so worker arenas recycle memory
+// between files and chunks instead of going through malloc.
+
+#define BLOCK_POOL_BLOCK_SIZE (256 * 1024)
+#define BLOCK_POOL_HUGE_BLOCK_SIZE (2 * 1024 * 1024) // One huge page
+#define BLOCK_POOL_ALIGN (4096)
+
+typedef struct block_pool {
+    // Top block with a push/pop counter in the low bits the alignment leaves
+    // free, so a block taken and put back in between fails the swap (ABA)
+    volatile uintptr_t head;
+    size_t block_size;
+    bool huge_pages;
+} block_pool;
+
+// huge_pages asks the OS to back blocks with huge pages where it can
+void block_pool_init(block_pool* pool, bool huge_pages);
+// Every block must be back in the pool
+void block_pool_destroy(block_pool* pool);
+
+// Never NULL, allocates when the pool is empty. Contents are undefined.
+void* block_pool_get(block_pool* pool);
+void block_pool_put(block_pool* pool, void* block);
+
+#endif // __BLOCK_POOL_H__
@@ -0,0 +1,209 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#ifdef SOMETIL_ZLIB
+#include <zlib.h>
+#endif
+#ifdef SOMETIL_ZSTD
+#include <zstd.h>
+#endif
+
+#include "decompress.h"
+
+#define DECODER_INPUT_SIZE (256 * 1024)
+
+struct decoder {
+    compression_t kind;
+    FILE* file; // NULL - prefix is all the input
+    char* input;
+    size_t input_capacity;
+    size_t input_pos;
+    size_t input_size;
+    bool open;    // Inside a gzip member or zstd frame, running out of input here is an error
+    bool pending; // The last step filled the output, the codec may hold more without new input
+    bool ended;
+#ifdef SOMETIL_ZLIB
+    z_stream gz;
+#endif
+#ifdef SOMETIL_ZSTD
+    ZSTD_DCtx* zstd;
+#endif
+};
+
+compression_t compression_detect(const char* data, size_t size) {
+    assert(data != NULL || size == 0);
+
+    const unsigned char* bytes = (const unsigned char*)data;
+    if (size >= 2 && bytes[0] == 0x1F && bytes[1] == 0x8B) return COMPRESSION_GZIP;
+    if (size >= 4 && bytes[0] == 0x28 && bytes[1] == 0xB5 && bytes[2] == 0x2F && bytes[3] == 0xFD) {
+        return COMPRESSION_ZSTD;
+    }
+    return COMPRESSION_NONE;
+}
+
+const char* compression_name(compression_t kind) {
+    switch (kind) {
+    case COMPRESSION_GZIP: return "gzip";
+    case COMPRESSION_ZSTD: return "zstd";
+    default: return "plain";
+    }
+}
+
+static void decoder_fail(decoder* dec, const char* reason) {
+    fprintf(stderr, "Failed to decompress %s data: %s\n", compression_name(dec->kind), reason);
+    dec->ended = true;
+}
+
+decoder* decoder_new(compression_t kind, FILE* file, const char* prefix, size_t prefix_size) {
+    assert(kind != COMPRESSION_NONE);
+    assert(prefix != NULL || prefix_size == 0);
+
+#ifndef SOMETIL_ZLIB
+    if (kind == COMPRESSION_GZIP) {
+        fprintf(stderr, "gzip input needs a build with zlib, searching the raw bytes\n");
+        return NULL;
+    }
+#endif
+#ifndef SOMETIL_ZSTD
+    if (kind == COMPRESSION_ZSTD) {
+        fprintf(stderr, "zstd input needs a build with libzstd, searching the raw bytes\n");
+        return NULL;
+    }
+#endif
+
+    decoder* dec = calloc(1, sizeof(decoder));
+    assert(dec != NULL);
+    dec->kind = kind;
+    dec->file = file;
+    dec->input_capacity = (prefix_size > DECODER_INPUT_SIZE) ? prefix_size : DECODER_INPUT_SIZE;
+    dec->input = malloc(dec->input_capacity);
+    assert(dec->input != NULL && "Failed to allocate decoder input");
+    if (prefix_size != 0) memcpy(dec->input, prefix, prefix_size);
+    dec->input_size = prefix_size;
+    dec->open = true;
+
+#ifdef SOMETIL_ZLIB
+    // 16 + window bits: gzip header and trailer instead of zlib ones
+    if (kind == COMPRESSION_GZIP && inflateInit2(&dec->gz, 16 + MAX_WBITS) != Z_OK) {
+        decoder_fail(dec, "inflateInit2");
+    }
+#endif
+#ifdef SOMETIL_ZSTD
+    if (kind == COMPRESSION_ZSTD) {
+        dec->zstd = ZSTD_createDCtx();
+        if (dec->zstd == NULL) decoder_fail(dec, "ZSTD_createDCtx");
+    }
+#endif
+    return dec;
+}
+
+void decoder_free(decoder* dec) {
+    if (dec == NULL) return;
+
+#ifdef SOMETIL_ZLIB
+    if (dec->kind == COMPRESSION_GZIP) inflateEnd(&dec->gz);
+#endif
+#ifdef SOMETIL_ZSTD
+    ZSTD_freeDCtx(dec->zstd);
+#endif
+    free(dec->input);
+    free(dec);
+}
+
+static bool decoder_fill(decoder* dec) {
+    if (dec->file == NULL) return false;
+
+    dec->input_pos = 0;
+    dec->input_size = fread(dec->input, 1, dec->input_capacity, dec->file);
+    return dec->input_size != 0;
+}
+
+#ifdef SOMETIL_ZLIB
+static size_t gzip_step(decoder* dec, char* out, size_t size) {
+    if (!dec->open) {
+        // Concatenated members decode as one stream, like gzip -d does. Anything else after
+        // the last member is ignored.
+        dec->pending = false;
+        if (dec->input_pos == dec->input_size) return 0;
+        if ((unsigned char)dec->input[dec->input_pos] != 0x1F) {
+            dec->ended = true;
+            return 0;
+        }
+        inflateReset(&dec->gz);
+        dec->open = true;
+    }
+
+    const size_t in_size = dec->input_size - dec->input_pos;
+    const size_t out_size = size;
+    dec->gz.next_in = (Bytef*)(dec->input + dec->input_pos);
+    dec->gz.avail_in = (in_size > UINT_MAX) ? UINT_MAX : (uInt)in_size;
+    dec->gz.next_out = (Bytef*)out;
+    dec->gz.avail_out = (out_size > UINT_MAX) ? UINT_MAX : (uInt)out_size;
+    const uInt avail_in = dec->gz.avail_in;
+    const uInt avail_out = dec->gz.avail_out;
+
+    int ret = inflate(&dec->gz, Z_NO_FLUSH);
+    dec->input_pos += avail_in - dec->gz.avail_in;
+    const size_t written = avail_out - dec->gz.avail_out;
+    dec->pending = dec->gz.avail_out == 0;
+
+    if (ret == Z_STREAM_END) {
+        dec->open = false;
+    } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+        decoder_fail(dec, dec->gz.msg ? dec->gz.msg : "corrupt data");
+    }
+    return written;
+}
+#endif
+
+#ifdef SOMETIL_ZSTD
+static size_t zstd_step(decoder* dec, char* out, size_t size) {
+    ZSTD_inBuffer in = { dec->input + dec->input_pos, dec->input_size - dec->input_pos, 0 };
+    ZSTD_outBuffer to = { out, size, 0 };
+
+    const size_t ret = ZSTD_decompressStream(dec->zstd, &to, &in);
+    dec->input_pos += in.pos;
+    dec->pending = to.pos == to.size;
+    if (ZSTD_isError(ret)) {
+        decoder_fail(dec, ZSTD_getErrorName(ret));
+    } else {
+        // 0 means the frame is complete and flushed
+        dec->open = ret != 0;
+    }
+    return to.pos;
+}
+#endif
+
+static size_t decoder_step(decoder* dec, char* out, size_t size) {
+    switch (dec->kind) {
+#ifdef SOMETIL_ZLIB
+    case COMPRESSION_GZIP: return gzip_step(dec, out, size);
+#endif
+#ifdef SOMETIL_ZSTD
+    case COMPRESSION_ZSTD: return zstd_step(dec, out, size);
+#endif
+    default:
+        (void)out;
+        (void)size;
+        dec->ended = true;
+        return 0;
+    }
+}
+
+size_t decoder_read(decoder* dec, char* out, size_t size) {
+    assert(dec != NULL);
+    assert(out != NULL);
+
+    size_t produced = 0;
+    while (produced < size && !dec->ended) {
+        if (dec->input_pos == dec->input_size && !dec->pending && !decoder_fill(dec)) {
+            if (dec->open) decoder_fail(dec, "unexpected end of data");
+            dec->ended = true;
+            break;
+        }
+        produced += decoder_step(dec, out + produced, size - produced);
+    }
+    return produced;
+}
@@ -0,0 +1,33 @@
+#ifndef __DECOMPRESS_H__
+#define __DECOMPRESS_H__ 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// Streaming decoders for compressed input, recognized by their magic bytes.
+// gzip needs SOMETIL_ZLIB (link -lz), zstd needs SOMETIL_ZSTD (link -lzstd).
+
+typedef enum {
+    COMPRESSION_NONE,
+    COMPRESSION_GZIP,
+    COMPRESSION_ZSTD,
+} compression_t;
+
+#define COMPRESSION_MAGIC_SIZE (4) // Bytes compression_detect needs at most
+
+typedef struct decoder decoder;
+
+compression_t compression_detect(const char* data, size_t size);
+const char* compression_name(compression_t kind);
+
+// Decodes prefix followed by the rest of file, prefix is copied.
+// NULL when support for kind was not built in, the reason is printed.
+decoder* decoder_new(compression_t kind, FILE* file, const char* prefix, size_t prefix_size);
+void decoder_free(decoder* dec);
+
+// Fills out completely unless the data ends, 0 - end of data or an error.
+// Errors are printed once, the data decoded before them stays valid.
+size_t decoder_read(decoder* dec, char* out, size_t size);
+
+#endif // __DECOMPRESS_H__
@@ -0,0 +1,218 @@
+#if !defined(_WIN32) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
+
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+#include "dir_walk.h"
+
+#define WALK_PATH_MAX (4096)
+
+static const char* glob_class_end(const char* p) {
+    // p points after '['; a leading ']' is a literal
+    if (*p == '!') ++p;
+    if (*p == ']') ++p;
+    while (*p && *p != ']') ++p;
+    return *p ? p : NULL;
+}
+
+static bool glob_class_match(const char* p, const char* end, unsigned char c) {
+    bool negate = (*p == '!');
+    if (negate) ++p;
+
+    bool found = false;
+    for (const char* q = p; q < end; ++q) {
+        if (q + 2 < end && q[1] == '-') {
+            if ((unsigned char)q[0] <= c && c <= (unsigned char)q[2]) found = true;
+            q += 2;
+        } else if ((unsigned char)*q == c) {
+            found = true;
+        }
+    }
+    return found != negate;
+}
+
+bool glob_match(const char* pattern, const char* name) {
+    assert(pattern != NULL);
+    assert(name != NULL);
+
+    const char* p = pattern;
+    const char* n = name;
+    // Last '*' seen and the name position it currently absorbs up to
+    const char* star = NULL;
+    const char* star_name = NULL;
+
+    while (*n) {
+        if (*p == '*') {
+            star = ++p;
+            star_name = n;
+            continue;
+        }
+
+        bool step = false;
+        if (*p == '?') {
+            step = true;
+            ++p;
+        } else if (*p == '[' && glob_class_end(p + 1) != NULL) {
+            const char* end = glob_class_end(p + 1);
+            step = glob_class_match(p + 1, end, (unsigned char)*n);
+            p = end + 1;
+        } else {
+            if (*p == '\\' && p[1]) ++p;
+            step = (*p != '\0' && *p == *n);
+            if (step) ++p;
+        }
+
+        if (step) {
+            ++n;
+        } else if (star != NULL) {
+            p = star;
+            n = ++star_name;
+        } else {
+            return false;
+        }
+    }
+
+    while (*p == '*') ++p;
+    return *p == '\0';
+}
+
+static bool walk_ignored(const walk_options* options, const char* path, const char* name) {
+    for (size_t i = 0; i < options->ignore_count; ++i) {
+        const char* glob = options->ignore[i];
+        if (glob_match(glob, strchr(glob, '/') ? path : name)) return true;
+    }
+    return false;
+}
+
+static void walk_file(const walk_options* options, const char* path, uint64_t size, walk_func on_file, void* user) {
+    if (options->max_size != 0 && size > options->max_size) return;
+    on_file(user, path, size);
+}
+
+#ifdef _WIN32
+
+bool path_is_directory(const char* path) {
+    assert(path != NULL);
+
+    DWORD attributes = GetFileAttributesA(path);
+    return attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY);
+}
+
+// path holds length bytes and has room for WALK_PATH_MAX
+static void walk_directory(char* path, size_t length, const walk_options* options, walk_func on_file, void* user) {
+    if (length + 2 >= WALK_PATH_MAX) {
+        fprintf(stderr, "Path is too long: %s\n", path);
+        return;
+    }
+    memcpy(path + length, "/*", 3);
+
+    WIN32_FIND_DATAA entry;
+    HANDLE find = FindFirstFileA(path, &entry);
+    path[length] = '\0';
+    if (find == INVALID_HANDLE_VALUE) {
+        fprintf(stderr, "Failed to read directory: %s\n", path);
+        return;
+    }
+
+    do {
+        const char* name = entry.cFileName;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+        if (entry.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) continue;
+
+        size_t name_length = strlen(name);
+        if (length + 1 + name_length >= WALK_PATH_MAX) {
+            fprintf(stderr, "Path is too long: %s/%s\n", path, name);
+            continue;
+        }
+        path[length] = '/';
+        memcpy(path + length + 1, name, name_length + 1);
+
+        if (!walk_ignored(options, path, name)) {
+            if (entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+                walk_directory(path, length + 1 + name_length, options, on_file, user);
+            } else {
+                uint64_t size = ((uint64_t)entry.nFileSizeHigh << 32) | entry.nFileSizeLow;
+                walk_file(options, path, size, on_file, user);
+            }
+        }
+        path[length] = '\0';
+    } while (FindNextFileA(find, &entry));
+
+    FindClose(find);
+}
+
+#else
+
+bool path_is_directory(const char* path) {
+    assert(path != NULL);
+
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+// path holds length bytes and has room for WALK_PATH_MAX
+static void walk_directory(char* path, size_t length, const walk_options* options, walk_func on_file, void* user) {
+    DIR* dir = opendir(path);
+    if (dir == NULL) {
+        fprintf(stderr, "Failed to read directory %s: %s\n", path, strerror(errno));
+        return;
+    }
+
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        const char* name = entry->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+
+        size_t name_length = strlen(name);
+        if (length + 1 + name_length >= WALK_PATH_MAX) {
+            fprintf(stderr, "Path is too long: %s/%s\n", path, name);
+            continue;
+        }
+        path[length] = '/';
+        memcpy(path + length + 1, name, name_length + 1);
+
+        struct stat st;
+        if (!walk_ignored(options, path, name) && lstat(path, &st) == 0) {
+            if (S_ISDIR(st.st_mode)) {
+                walk_directory(path, length + 1 + name_length, options, on_file, user);
+            } else if (S_ISREG(st.st_mode)) {
+                walk_file(options, path, (uint64_t)st.st_size, on_file, user);
+            }
+        }
+        path[length] = '\0';
+    }
+
+    closedir(dir);
+}
+
+#endif
+
+void dir_walk(const char* root, const walk_options* options, walk_func on_file, void* user) {
+    assert(root != NULL);
+    assert(options != NULL);
+    assert(on_file != NULL);
+
+    char path[WALK_PATH_MAX];
+    size_t length = strlen(root);
+    if (length >= WALK_PATH_MAX) {
+        fprintf(stderr, "Path is too long: %s\n", root);
+        return;
+    }
+    memcpy(path, root, length + 1);
+    // "dir/" and "dir" walk the same tree
+    while (length > 1 && (path[length - 1] == '/' || path[length - 1] == '\\')) {
+        path[--length] = '\0';
+    }
+    walk_directory(path, length, options, on_file, user);
+}
@@ -0,0 +1,26 @@
+#ifndef __DIR_WALK_H__
+#define __DIR_WALK_H__ 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct walk_options {
+    const char* const* ignore; // Globs, matched against the entry name or, with '/', the path
+    size_t ignore_count;
+    uint64_t max_size;         // 0 - no limit
+} walk_options;
+
+// path is only valid during the call
+typedef void (*walk_func)(void* user, const char* path, uint64_t size);
+
+// Supports *, ?, [abc], [!a-z] and \ escapes
+bool glob_match(const char* pattern, const char* name);
+
+bool path_is_directory(const char* path);
+
+// Reports every regular file under root that passes the filters. Symlinks met
+// while recursing are skipped, unreadable directories are reported and skipped.
+void dir_walk(const char* root, const walk_options* options, walk_func on_file, void* user);
+
+#endif // __DIR_WALK_H__
@@ -14,11 +14,9 @@ static void dstring_ensure_capacity(dstring* ds, size_t required) {
         new_cap = new_cap ? new_cap * DS_GROWTH_FACTOR : DS_MIN_CAPACITY;
     }
     
-    char* new_data = arena_allocate(ds->arena, new_cap, 1);
-    if (ds->size > 0) {
-        memcpy(new_data, ds->data, ds->size);
-    }
-    ds->data = new_data;
+    // Grows in place while the string is the last allocation of its arena,
+    // otherwise the old buffer is released for reuse
+    ds->data = arena_realloc(ds->arena, ds->data, ds->capacity, new_cap, 1);
     ds->capacity = new_cap;
 }
 
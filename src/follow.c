@@ -0,0 +1,145 @@
+#if !defined(_WIN32) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#include <time.h>
+#endif
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <poll.h>
+#define FOLLOW_INOTIFY 1
+#define FOLLOW_EVENTS (IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_MOVE_SELF | IN_DELETE_SELF)
+#endif
+
+#include "general.h"
+#include "follow.h"
+
+static bool follower_size(FILE* file, uint64_t* size) {
+#ifdef _WIN32
+    struct _stat64 st;
+    if (_fstat64(_fileno(file), &st) != 0) return false;
+#else
+    struct stat st;
+    if (fstat(fileno(file), &st) != 0) return false;
+#endif
+    *size = (st.st_size > 0) ? (uint64_t)st.st_size : 0;
+    return true;
+}
+
+static void follower_watch(file_follower* follower) {
+#ifdef FOLLOW_INOTIFY
+    if (follower->notify_fd < 0) return;
+    if (follower->watch >= 0) inotify_rm_watch(follower->notify_fd, follower->watch);
+    follower->watch = inotify_add_watch(follower->notify_fd, follower->path, FOLLOW_EVENTS);
+#else
+    (void)follower;
+#endif
+}
+
+void follower_init(file_follower* follower, const char* path, FILE* file) {
+    assert(follower != NULL);
+    assert(path != NULL);
+    assert(file != NULL);
+
+    follower->path = path;
+    follower->file = file;
+    follower->start = 0;
+    follower->notify_fd = -1;
+    follower->watch = -1;
+#ifdef FOLLOW_INOTIFY
+    follower->notify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    follower_watch(follower);
+#endif
+}
+
+void follower_close(file_follower* follower) {
+    if (follower == NULL) return;
+
+#ifdef FOLLOW_INOTIFY
+    if (follower->notify_fd >= 0) close(follower->notify_fd);
+#endif
+    follower->notify_fd = -1;
+    if (follower->file != NULL) fclose(follower->file);
+    follower->file = NULL;
+}
+
+// The path names another file than the one open, which was read to its end.
+// Switches to the new file then.
+static bool follower_rotated(file_follower* follower) {
+#ifdef _WIN32
+    // No inode numbers, only truncation is noticed
+    (void)follower;
+    return false;
+#else
+    struct stat open_st;
+    struct stat path_st;
+    if (fstat(fileno(follower->file), &open_st) != 0) return false;
+    // Missing while the new file is being created, try again later
+    if (stat(follower->path, &path_st) != 0) return false;
+    if (open_st.st_ino == path_st.st_ino && open_st.st_dev == path_st.st_dev) return false;
+
+    FILE* file = NULL;
+    if (fopen_s(&file, follower->path, "rb") != 0) return false;
+    fclose(follower->file);
+    follower->file = file;
+    follower_watch(follower);
+    return true;
+#endif
+}
+
+static void follower_sleep(file_follower* follower) {
+#ifdef FOLLOW_INOTIFY
+    if (follower->notify_fd >= 0 && follower->watch >= 0) {
+        struct pollfd pfd = { .fd = follower->notify_fd, .events = POLLIN };
+        if (poll(&pfd, 1, FOLLOW_NOTIFY_TIMEOUT_MS) > 0) {
+            // Only the wakeup matters, the sizes are checked again anyway
+            char events[4096];
+            while (read(follower->notify_fd, events, sizeof(events)) > 0) {}
+        }
+        return;
+    }
+#endif
+#ifdef _WIN32
+    Sleep(FOLLOW_POLL_MS);
+#else
+    struct timespec delay = { 0, FOLLOW_POLL_MS * 1000000L };
+    while (nanosleep(&delay, &delay) != 0 && errno == EINTR) {}
+#endif
+}
+
+follow_event_t follower_wait(file_follower* follower, uint64_t consumed) {
+    assert(follower != NULL);
+    assert(follower->file != NULL);
+
+    const uint64_t end = follower->start + consumed;
+    for (;;) {
+        uint64_t size = 0;
+        if (follower_size(follower->file, &size)) {
+            if (size > end) return FOLLOW_GREW;
+            if (size < end) {
+                fprintf(stderr, "%s: file truncated, following from the start\n", follower->path);
+                rewind(follower->file);
+                follower->start = 0;
+                return FOLLOW_REPLACED;
+            }
+        }
+        if (follower_rotated(follower)) {
+            fprintf(stderr, "%s: file replaced, following the new file\n", follower->path);
+            follower->start = 0;
+            return FOLLOW_REPLACED;
+        }
+        follower_sleep(follower);
+    }
+}
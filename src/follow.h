@@ -0,0 +1,34 @@
+#ifndef __FOLLOW_H__
+#define __FOLLOW_H__ 1
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Follow mode (-F): waits until a file grows past what was read of it, like tail -F.
+// inotify wakes the wait on Linux, elsewhere the size is polled.
+
+#define FOLLOW_POLL_MS (250)
+#define FOLLOW_NOTIFY_TIMEOUT_MS (1000) // Rotation makes a new file inotify doesn't watch yet
+
+typedef enum {
+    FOLLOW_GREW,     // Bytes past the ones read so far
+    FOLLOW_REPLACED, // Truncated or rotated, file reads the new contents from the start
+} follow_event_t;
+
+typedef struct file_follower {
+    const char* path;
+    FILE* file;     // Owned from follower_init on, replaced on rotation
+    uint64_t start; // File offset the reading started at, 0 after a replacement
+    int notify_fd;  // -1 - polling
+    int watch;
+} file_follower;
+
+void follower_init(file_follower* follower, const char* path, FILE* file);
+// Closes the file too
+void follower_close(file_follower* follower);
+
+// Blocks until the file holds more than start + consumed bytes or was truncated or rotated
+follow_event_t follower_wait(file_follower* follower, uint64_t consumed);
+
+#endif // __FOLLOW_H__
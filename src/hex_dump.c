@@ -0,0 +1,205 @@
+#include <assert.h>
+#include <stdint.h>
+
+#include "hex_dump.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#define DUMP_X86 1
+#include <immintrin.h>
+#endif
+
+typedef size_t (*dump_kernel)(char* out, const char* data, size_t size);
+
+static const char hex_digits[] = "0123456789ABCDEF";
+
+size_t sprint_hex_byte(char* data, unsigned char byte) {
+    assert(data != NULL);
+
+    data[0] = hex_digits[(byte >> 4) & 0x0F];  // H
+    data[1] = hex_digits[byte & 0x0F];         // L
+
+    return 2;
+}
+
+// Same set as isascii && !isspace && !iscntrl: '!' to '~'
+static inline bool dump_printable(unsigned char c) {
+    return (unsigned char)(c - 0x21) < 0x5E;
+}
+
+static size_t dump_raw_scalar(char* out, const char* data, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        const unsigned char c = (unsigned char)data[i];
+        out[i * 2] = dump_printable(c) ? (char)c : '.';
+        out[i * 2 + 1] = ' ';
+    }
+    return size * DUMP_RAW_WIDTH;
+}
+
+static size_t dump_hex_scalar(char* out, const char* data, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        sprint_hex_byte(&out[i * 3], (unsigned char)data[i]);
+        out[i * 3 + 2] = ' ';
+    }
+    return size * DUMP_HEX_WIDTH;
+}
+
+static size_t dump_ascii_scalar(char* out, const char* data, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        const unsigned char c = (unsigned char)data[i];
+        sprint_hex_byte(&out[i * 4], c);
+        out[i * 4 + 2] = dump_printable(c) ? (char)c : '.';
+        out[i * 4 + 3] = ' ';
+    }
+    return size * DUMP_ASCII_WIDTH;
+}
+
+#ifdef DUMP_X86
+// '.' in place of bytes outside '!'..'~'. Shifting the range down to -128
+// turns it into one signed compare.
+static inline __m128i dump_printable_sse2(__m128i v) {
+    __m128i shifted = _mm_add_epi8(v, _mm_set1_epi8((char)(0x80 - 0x21)));
+    __m128i mask = _mm_cmplt_epi8(shifted, _mm_set1_epi8((char)(0x80 + 0x5E)));
+    return _mm_or_si128(_mm_and_si128(mask, v), _mm_andnot_si128(mask, _mm_set1_epi8('.')));
+}
+
+// Nibbles 0-15 to '0'-'9', 'A'-'F' without a shuffle: '0' + n, 7 more above 9
+static inline __m128i dump_hex_digits_sse2(__m128i nibbles) {
+    __m128i letters = _mm_and_si128(_mm_cmpgt_epi8(nibbles, _mm_set1_epi8(9)), _mm_set1_epi8(7));
+    return _mm_add_epi8(_mm_add_epi8(nibbles, _mm_set1_epi8('0')), letters);
+}
+
+static size_t dump_raw_sse2(char* out, const char* data, size_t size) {
+    const __m128i spaces = _mm_set1_epi8(' ');
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        __m128i c = dump_printable_sse2(_mm_loadu_si128((const __m128i*)(data + i)));
+        _mm_storeu_si128((__m128i*)(out + i * 2), _mm_unpacklo_epi8(c, spaces));
+        _mm_storeu_si128((__m128i*)(out + i * 2 + 16), _mm_unpackhi_epi8(c, spaces));
+    }
+    dump_raw_scalar(out + i * 2, data + i, size - i);
+    return size * DUMP_RAW_WIDTH;
+}
+
+// 16 bytes to 64: hex pairs and "c " pairs interleaved as 16 bit lanes
+static size_t dump_ascii_sse2(char* out, const char* data, size_t size) {
+    const __m128i low_nibble = _mm_set1_epi8(0x0F);
+    const __m128i spaces = _mm_set1_epi8(' ');
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+        __m128i hi = dump_hex_digits_sse2(_mm_and_si128(_mm_srli_epi16(v, 4), low_nibble));
+        __m128i lo = dump_hex_digits_sse2(_mm_and_si128(v, low_nibble));
+        __m128i c = dump_printable_sse2(v);
+
+        __m128i hex0 = _mm_unpacklo_epi8(hi, lo);
+        __m128i hex1 = _mm_unpackhi_epi8(hi, lo);
+        __m128i text0 = _mm_unpacklo_epi8(c, spaces);
+        __m128i text1 = _mm_unpackhi_epi8(c, spaces);
+
+        char* o = out + i * 4;
+        _mm_storeu_si128((__m128i*)(o), _mm_unpacklo_epi16(hex0, text0));
+        _mm_storeu_si128((__m128i*)(o + 16), _mm_unpackhi_epi16(hex0, text0));
+        _mm_storeu_si128((__m128i*)(o + 32), _mm_unpacklo_epi16(hex1, text1));
+        _mm_storeu_si128((__m128i*)(o + 48), _mm_unpackhi_epi16(hex1, text1));
+    }
+    dump_ascii_scalar(out + i * 4, data + i, size - i);
+    return size * DUMP_ASCII_WIDTH;
+}
+
+// 16 bytes to 48: digits come from a pshufb nibble lookup, then the 32 digits
+// are spread to a stride of three and the gaps filled with spaces
+__attribute__((target("ssse3")))
+static size_t dump_hex_ssse3(char* out, const char* data, size_t size) {
+    const __m128i digits = _mm_loadu_si128((const __m128i*)hex_digits);
+    const __m128i low_nibble = _mm_set1_epi8(0x0F);
+
+    const __m128i spread0 = _mm_setr_epi8(0, 1, -1, 2, 3, -1, 4, 5, -1, 6, 7, -1, 8, 9, -1, 10);
+    const __m128i spread1a = _mm_setr_epi8(11, -1, 12, 13, -1, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i spread1b = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, 0, 1, -1, 2, 3, -1, 4, 5);
+    const __m128i spread2 = _mm_setr_epi8(-1, 6, 7, -1, 8, 9, -1, 10, 11, -1, 12, 13, -1, 14, 15, -1);
+    const __m128i gaps0 = _mm_setr_epi8(0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0);
+    const __m128i gaps1 = _mm_setr_epi8(0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0);
+    const __m128i gaps2 = _mm_setr_epi8(' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ');
+
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+        __m128i hi = _mm_shuffle_epi8(digits, _mm_and_si128(_mm_srli_epi16(v, 4), low_nibble));
+        __m128i lo = _mm_shuffle_epi8(digits, _mm_and_si128(v, low_nibble));
+        __m128i pairs0 = _mm_unpacklo_epi8(hi, lo); // Bytes 0-7
+        __m128i pairs1 = _mm_unpackhi_epi8(hi, lo); // Bytes 8-15
+
+        char* o = out + i * 3;
+        _mm_storeu_si128((__m128i*)(o), _mm_or_si128(_mm_shuffle_epi8(pairs0, spread0), gaps0));
+        _mm_storeu_si128((__m128i*)(o + 16),
+                         _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(pairs0, spread1a),
+                                                   _mm_shuffle_epi8(pairs1, spread1b)), gaps1));
+        _mm_storeu_si128((__m128i*)(o + 32), _mm_or_si128(_mm_shuffle_epi8(pairs1, spread2), gaps2));
+    }
+    dump_hex_scalar(out + i * 3, data + i, size - i);
+    return size * DUMP_HEX_WIDTH;
+}
+#endif
+
+// Picked on first use, views run on the main thread only
+static dump_kernel raw_kernel = NULL;
+static dump_kernel hex_kernel = NULL;
+static dump_kernel ascii_kernel = NULL;
+
+static void dump_select_kernels(void) {
+#ifdef DUMP_X86
+    __builtin_cpu_init();
+    raw_kernel = dump_raw_sse2;
+    ascii_kernel = dump_ascii_sse2;
+    hex_kernel = __builtin_cpu_supports("ssse3") ? dump_hex_ssse3 : dump_hex_scalar;
+#else
+    raw_kernel = dump_raw_scalar;
+    ascii_kernel = dump_ascii_scalar;
+    hex_kernel = dump_hex_scalar;
+#endif
+}
+
+size_t dump_raw(char* out, const char* data, size_t size) {
+    assert(out != NULL);
+    assert(data != NULL || size == 0);
+
+    if (raw_kernel == NULL) dump_select_kernels();
+    return raw_kernel(out, data, size);
+}
+
+size_t dump_hex(char* out, const char* data, size_t size) {
+    assert(out != NULL);
+    assert(data != NULL || size == 0);
+
+    if (hex_kernel == NULL) dump_select_kernels();
+    return hex_kernel(out, data, size);
+}
+
+size_t dump_ascii(char* out, const char* data, size_t size) {
+    assert(out != NULL);
+    assert(data != NULL || size == 0);
+
+    if (ascii_kernel == NULL) dump_select_kernels();
+    return ascii_kernel(out, data, size);
+}
+
+size_t dump_textonly(char* out, const char* data, size_t size, bool* last_printable) {
+    assert(out != NULL);
+    assert(data != NULL || size == 0);
+    assert(last_printable != NULL);
+
+    size_t pos = 0;
+    bool last = *last_printable;
+    for (size_t i = 0; i < size; ++i) {
+        const unsigned char c = (unsigned char)data[i];
+        const bool printable = dump_printable(c);
+        if (printable) {
+            out[pos++] = (char)c;
+        } else if (last) {
+            out[pos++] = ' ';
+        }
+        last = printable;
+    }
+    *last_printable = last;
+    return pos;
+}
@@ -0,0 +1,25 @@
+#ifndef __HEX_DUMP_H__
+#define __HEX_DUMP_H__ 1
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Block formatters for the -v views. Fixed width ones write exactly
+// size * width bytes and return that count, lines are up to the caller.
+
+#define DUMP_RAW_WIDTH (2)   // "c "
+#define DUMP_HEX_WIDTH (3)   // "XX "
+#define DUMP_ASCII_WIDTH (4) // "XXc "
+
+// Scalar fallback, writes two uppercase hex digits
+size_t sprint_hex_byte(char* data, unsigned char byte);
+
+size_t dump_raw(char* out, const char* data, size_t size);
+size_t dump_hex(char* out, const char* data, size_t size);
+size_t dump_ascii(char* out, const char* data, size_t size);
+
+// Printable bytes as is, every run of other bytes as one space (at most size bytes).
+// last_printable carries the state between blocks, start with true.
+size_t dump_textonly(char* out, const char* data, size_t size, bool* last_printable);
+
+#endif // __HEX_DUMP_H__
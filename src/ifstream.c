@@ -1,28 +1,554 @@
+#if !defined(_WIN32) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
+
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #include "utf8_util.h"
 #include "ifstream.h"
+#include "thread.h"
+#include "decompress.h"
+
+// Read-ahead ring of IFSTREAM_ASYNC. The reader thread fills slots in order while the
+// consumer scans the slot it took last. Every slot starts with headroom for the retained
+// tail of the previous one, so a refill copies only that tail.
+typedef struct ifstream_reader {
+    thread th;
+    mutex lock;
+    condvar filled;  // A slot was filled or the reader is done
+    condvar drained; // A slot was taken or the reader has to stop
+    FILE* file;
+    decoder* decoder; // NULL - slots get the file bytes as they are
+    char** slots;
+    size_t* sizes;
+    size_t depth;
+    size_t read_size;
+    size_t headroom;
+    uint64_t remaining; // Bytes left in the window
+    size_t head;  // Next slot for the consumer, the one before it is being scanned
+    size_t count; // Filled slots from head on
+    bool done;    // End of file or read error
+    bool stop;
+    bool running;
+} ifstream_reader;
+
+// Maps the window of a regular file starting at offset, up to length bytes (0 - to the end).
+// Only the pages of the window are mapped. Leaves stream untouched on failure.
+static bool ifstream_map(ifstream* stream, bool sequential, uint64_t offset, uint64_t length) {
+    if (ftell(stream->file) != 0) return false;
+
+#ifdef _WIN32
+    HANDLE handle = (HANDLE)_get_osfhandle(_fileno(stream->file));
+    if (handle == INVALID_HANDLE_VALUE || GetFileType(handle) != FILE_TYPE_DISK) return false;
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(handle, &file_size)) return false;
+    const uint64_t file_bytes = (file_size.QuadPart > 0) ? (uint64_t)file_size.QuadPart : 0;
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    const uint64_t granularity = info.dwAllocationGranularity;
+#else
+    int fd = fileno(stream->file);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) return false;
+    const uint64_t file_bytes = (st.st_size > 0) ? (uint64_t)st.st_size : 0;
+    const long page = sysconf(_SC_PAGESIZE);
+    const uint64_t granularity = (page > 0) ? (uint64_t)page : 4096;
+#endif
+    if (offset >= file_bytes) return false;
+
+    // The view has to start on a granularity boundary, buffer skips the bytes before offset
+    uint64_t window = file_bytes - offset;
+    if (length != 0 && length < window) window = length;
+    const uint64_t base = offset - offset % granularity;
+    const uint64_t map_bytes = window + (offset - base);
+    if (map_bytes > SIZE_MAX) return false;
+    const size_t size = (size_t)map_bytes;
+
+#ifdef _WIN32
+    HANDLE mapping = CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping == NULL) return false;
+
+    void* view = MapViewOfFile(mapping, FILE_MAP_READ, (DWORD)(base >> 32), (DWORD)base, size);
+    if (view == NULL) {
+        CloseHandle(mapping);
+        return false;
+    }
+    stream->mapping = mapping;
+    (void)sequential;
+#else
+    void* view = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, (off_t)base);
+    if (view == MAP_FAILED) return false;
 
-#define IFSTREAM_BUFFER_SIZE (1 << 20) // 1 MB буфер
+    if (sequential) {
+#ifdef MADV_SEQUENTIAL
+        madvise(view, size, MADV_SEQUENTIAL);
+#endif
+#ifdef MADV_WILLNEED
+        madvise(view, size, MADV_WILLNEED);
+#endif
+    } else {
+#ifdef MADV_RANDOM
+        madvise(view, size, MADV_RANDOM);
+#endif
+    }
+#endif
+
+    // Compressed files are decoded from the descriptor instead
+    const size_t magic = (size < COMPRESSION_MAGIC_SIZE) ? size : COMPRESSION_MAGIC_SIZE;
+    if (!stream->probed && compression_detect(view, magic) != COMPRESSION_NONE) {
+#ifdef _WIN32
+        UnmapViewOfFile(view);
+        CloseHandle(stream->mapping);
+        stream->mapping = NULL;
+#else
+        munmap(view, size);
+#endif
+        return false;
+    }
+
+    stream->map_base = view;
+    stream->map_size = size;
+    stream->buffer = (char*)view + (offset - base);
+    stream->size = (size_t)window;
+    stream->total_read = window;
+    stream->mapped = true;
+    return true;
+}
+
+// Moves a file that can't seek forward by reading
+static bool ifstream_skip(FILE* file, uint64_t offset) {
+#ifdef _WIN32
+    if (_fseeki64(file, (__int64)offset, SEEK_SET) == 0) return true;
+#else
+    if (fseeko(file, (off_t)offset, SEEK_SET) == 0) return true;
+#endif
+    char* scratch = malloc(IFSTREAM_BUFFER_SIZE);
+    assert(scratch != NULL);
+    while (offset != 0) {
+        const size_t want = (offset < IFSTREAM_BUFFER_SIZE) ? (size_t)offset : IFSTREAM_BUFFER_SIZE;
+        const size_t read = fread(scratch, 1, want, file);
+        if (read == 0) break;
+        offset -= read;
+    }
+    free(scratch);
+    return offset == 0;
+}
 
 void ifstream_init(ifstream* stream, FILE* file) {
-    assert(stream != NULL);
-    assert(file != NULL);
+    ifstream_init_backend(stream, file, IFSTREAM_MMAP);
+}
 
+static void ifstream_open(ifstream* stream, FILE* file, ifstream_backend_t backend,
+                          uint64_t offset, uint64_t length) {
     stream->file = file;
-    stream->buffer = calloc(1, IFSTREAM_BUFFER_SIZE);
+    stream->async = backend == IFSTREAM_ASYNC;
+    // A window holds raw bytes, compressed files are decoded only as a whole
+    stream->probed = offset != 0 || length != 0;
+    stream->remaining = (length != 0) ? length : UINT64_MAX;
+    stream->buffer = NULL;
     stream->pos = 0;
     stream->size = 0;
     stream->eof = false;
     stream->total_read = 0;
+    stream->refills = 0;
+    stream->retain = 0;
+    stream->mapped = false;
+    stream->map_base = NULL;
+    stream->map_size = 0;
+#ifdef _WIN32
+    stream->mapping = NULL;
+#endif
+    if (stream->reader != NULL) stream->reader->remaining = stream->remaining;
+
+    const bool mappable = backend == IFSTREAM_MMAP || backend == IFSTREAM_MMAP_RANDOM;
+    if (mappable && ifstream_map(stream, backend == IFSTREAM_MMAP, offset, length)) return;
+    if (offset != 0 && !ifstream_skip(file, offset)) {
+        // Shorter than offset, the window is empty
+        stream->remaining = 0;
+        if (stream->reader != NULL) stream->reader->remaining = 0;
+    }
+    if (stream->async) return;
+    if (stream->heap == NULL) {
+        stream->heap = calloc(1, IFSTREAM_BUFFER_SIZE);
+        assert(stream->heap != NULL && "Failed to allocate stream buffer");
+    }
+    stream->buffer = stream->heap;
+}
+
+static void ifstream_reader_fill(ifstream_reader* r, size_t slot) {
+    char* data = r->slots[slot] + r->headroom;
+    const size_t want = (r->remaining < r->read_size) ? (size_t)r->remaining : r->read_size;
+    size_t read = 0;
+    if (want != 0) {
+        read = (r->decoder != NULL) ? decoder_read(r->decoder, data, want) : fread(data, 1, want, r->file);
+    }
+
+    mutex_lock(&r->lock);
+    r->sizes[slot] = read;
+    if (read != 0) ++r->count;
+    r->remaining -= read;
+    // fread only comes up short at the end of file or on an error
+    if (read < want || r->remaining == 0) r->done = true;
+    condvar_signal(&r->filled);
+    mutex_unlock(&r->lock);
+}
+
+static void ifstream_reader_main(void* arg) {
+    ifstream_reader* r = arg;
+
+    mutex_lock(&r->lock);
+    for (;;) {
+        // The slot before head is still being scanned
+        while (!r->stop && !r->done && r->count >= r->depth - 1) condvar_wait(&r->drained, &r->lock);
+        if (r->stop || r->done) break;
+        const size_t slot = (r->head + r->count) % r->depth;
+        mutex_unlock(&r->lock);
+
+        ifstream_reader_fill(r, slot);
+        mutex_lock(&r->lock);
+    }
+    mutex_unlock(&r->lock);
+}
+
+// Joins the reader thread, filled slots stay queued
+static void ifstream_reader_stop(ifstream_reader* r) {
+    if (r == NULL || !r->running) return;
+
+    mutex_lock(&r->lock);
+    r->stop = true;
+    condvar_broadcast(&r->drained);
+    mutex_unlock(&r->lock);
+    thread_join(&r->th);
+    r->running = false;
+}
+
+// Drops everything read so far, the next refill reads from the current file position
+static void ifstream_reader_reset(ifstream_reader* r) {
+    if (r == NULL) return;
+
+    ifstream_reader_stop(r);
+    decoder_free(r->decoder);
+    r->decoder = NULL;
+    r->head = 0;
+    r->count = 0;
+    r->done = false;
+}
+
+static void ifstream_reader_free(ifstream* stream) {
+    ifstream_reader* r = stream->reader;
+    if (r == NULL) return;
+
+    ifstream_reader_stop(r);
+    decoder_free(r->decoder);
+    for (size_t i = 0; i < r->depth; ++i) free(r->slots[i]);
+    free(r->slots);
+    free(r->sizes);
+    condvar_destroy(&r->drained);
+    condvar_destroy(&r->filled);
+    mutex_destroy(&r->lock);
+    free(r);
+    stream->reader = NULL;
+}
+
+// Moves the data of every slot back so headroom bytes fit in front of it
+static void ifstream_reader_grow(ifstream* stream, size_t headroom) {
+    ifstream_reader* r = stream->reader;
+    ifstream_reader_stop(r);
+
+    const size_t shift = headroom - r->headroom;
+    for (size_t i = 0; i < r->depth; ++i) {
+        char* old = r->slots[i];
+        const bool current = stream->buffer >= old && stream->buffer < old + r->headroom + r->read_size;
+        const size_t offset = current ? (size_t)(stream->buffer - old) : 0;
+
+        char* slot = realloc(old, headroom + r->read_size);
+        assert(slot != NULL && "Failed to grow stream buffer");
+        memmove(slot + shift, slot, r->headroom + r->read_size);
+        r->slots[i] = slot;
+        if (current) stream->buffer = slot + shift + offset;
+    }
+    r->headroom = headroom;
+}
+
+static ifstream_reader* ifstream_reader_new(ifstream* stream) {
+    ifstream_reader* r = calloc(1, sizeof(ifstream_reader));
+    assert(r != NULL);
+    r->depth = stream->read_depth;
+    r->read_size = stream->read_size;
+    r->remaining = stream->remaining;
+    r->headroom = stream->retain;
+    r->slots = calloc(r->depth, sizeof(char*));
+    r->sizes = calloc(r->depth, sizeof(size_t));
+    assert(r->slots != NULL && r->sizes != NULL);
+    for (size_t i = 0; i < r->depth; ++i) {
+        r->slots[i] = malloc(r->headroom + r->read_size);
+        assert(r->slots[i] != NULL && "Failed to allocate stream buffer");
+    }
+    mutex_init(&r->lock);
+    condvar_init(&r->filled);
+    condvar_init(&r->drained);
+    stream->reader = r;
+    return r;
+}
+
+static void ifstream_reader_start(ifstream* stream) {
+    ifstream_reader* r = stream->reader;
+    r->file = stream->file;
+    r->stop = false;
+    // Without a thread the consumer reads each slot itself when it needs it
+    r->running = thread_start(&r->th, ifstream_reader_main, r);
+}
+
+static void ifstream_unmap(ifstream* stream) {
+    if (!stream->mapped) return;
+#ifdef _WIN32
+    UnmapViewOfFile(stream->map_base);
+    CloseHandle(stream->mapping);
+    stream->mapping = NULL;
+#else
+    munmap(stream->map_base, stream->map_size);
+#endif
+    stream->mapped = false;
+    stream->buffer = NULL;
+}
+
+void ifstream_init_backend(ifstream* stream, FILE* file, ifstream_backend_t backend) {
+    ifstream_init_window(stream, file, backend, 0, 0);
+}
+
+void ifstream_init_window(ifstream* stream, FILE* file, ifstream_backend_t backend, uint64_t offset, uint64_t length) {
+    assert(stream != NULL);
+    assert(file != NULL);
+
+    stream->heap = NULL;
+    stream->reader = NULL;
+    stream->read_size = IFSTREAM_BUFFER_SIZE;
+    stream->read_depth = IFSTREAM_ASYNC_DEPTH;
+    ifstream_open(stream, file, backend, offset, length);
+}
+
+void ifstream_reopen(ifstream* stream, FILE* file, ifstream_backend_t backend) {
+    assert(stream != NULL);
+    assert(file != NULL);
+
+    ifstream_unmap(stream);
+    ifstream_reader_reset(stream->reader);
+    ifstream_open(stream, file, backend, 0, 0);
+}
+
+void ifstream_set_read_ahead(ifstream* stream, size_t size, size_t depth) {
+    assert(stream != NULL);
+    assert(size != 0);
+    assert(depth >= 2 && depth <= IFSTREAM_ASYNC_MAX_DEPTH);
+
+    if (size == stream->read_size && depth == stream->read_depth) return;
+    // Only before the first refill, the ring is rebuilt with the new shape
+    assert(stream->reader == NULL || stream->size == 0);
+    ifstream_reader_free(stream);
+    stream->read_size = size;
+    stream->read_depth = depth;
 }
 
 void ifstream_close(ifstream* stream) {
-    if (stream && stream->buffer) {
-        free(stream->buffer);
-        stream->buffer = NULL;
+    if (stream == NULL) return;
+
+    ifstream_unmap(stream);
+    ifstream_reader_free(stream);
+    free(stream->heap);
+    stream->heap = NULL;
+    stream->buffer = NULL;
+}
+
+// Puts a decoder between the file and the read-ahead ring when data, the first bytes
+// of the file, starts with a known magic. The stream turns async and data goes to the decoder.
+static bool ifstream_decode(ifstream* stream, const char* data, size_t size) {
+    const compression_t kind = compression_detect(data, size);
+    if (kind == COMPRESSION_NONE) return false;
+    decoder* dec = decoder_new(kind, stream->file, data, size);
+    if (dec == NULL) return false;
+
+    ifstream_reader* r = (stream->reader != NULL) ? stream->reader : ifstream_reader_new(stream);
+    assert(!r->running);
+    r->decoder = dec;
+    r->head = 0;
+    r->count = 0;
+    r->done = false;
+    stream->async = true;
+    stream->pos = 0;
+    stream->size = 0;
+    return true;
+}
+
+static bool ifstream_refill_async(ifstream* stream) {
+    ifstream_reader* r = (stream->reader != NULL) ? stream->reader : ifstream_reader_new(stream);
+    if (!stream->probed) {
+        // The first read has to be waited for anyway, it is done here to check the magic
+        stream->probed = true;
+        r->file = stream->file;
+        ifstream_reader_fill(r, r->head);
+        if (r->count != 0) ifstream_decode(stream, r->slots[r->head] + r->headroom, r->sizes[r->head]);
+    }
+    if (!r->running) ifstream_reader_start(stream);
+
+    mutex_lock(&r->lock);
+    if (!r->running && r->count == 0 && !r->done) {
+        mutex_unlock(&r->lock);
+        ifstream_reader_fill(r, r->head);
+        mutex_lock(&r->lock);
     }
+    while (r->count == 0 && !r->done) condvar_wait(&r->filled, &r->lock);
+    const bool empty = r->count == 0;
+    const size_t slot = r->head;
+    mutex_unlock(&r->lock);
+
+    // Retained tail goes right in front of the new data, at the end keep it readable in place
+    size_t keep = (stream->retain < stream->size) ? stream->retain : stream->size;
+    if (empty) {
+        if (stream->size != 0) stream->buffer += stream->size - keep;
+        stream->pos = keep;
+        stream->size = keep;
+        stream->eof = true;
+        return false;
+    }
+
+    char* data = r->slots[slot] + r->headroom;
+    if (keep != 0) memcpy(data - keep, stream->buffer + stream->size - keep, keep);
+    const size_t read = r->sizes[slot];
+    stream->buffer = data - keep;
+    stream->pos = keep;
+    stream->size = keep + read;
+    stream->total_read += read;
+    ++stream->refills;
+
+    // The slot scanned so far goes back to the reader only now that its tail was copied
+    mutex_lock(&r->lock);
+    r->head = (r->head + 1) % r->depth;
+    --r->count;
+    condvar_signal(&r->drained);
+    mutex_unlock(&r->lock);
+    return true;
+}
+
+static bool ifstream_refill(ifstream* stream) {
+    if (stream->async) return ifstream_refill_async(stream);
+    if (stream->mapped) {
+        stream->eof = true;
+        return false;
+    }
+
+    // Slide retained tail of consumed data to the front
+    size_t keep = (stream->retain < stream->size) ? stream->retain : stream->size;
+    memmove(stream->buffer, stream->buffer + stream->size - keep, keep);
+
+    const size_t want = (stream->remaining < IFSTREAM_BUFFER_SIZE) ? (size_t)stream->remaining : IFSTREAM_BUFFER_SIZE;
+    size_t read = (want != 0) ? fread(stream->buffer + keep, 1, want, stream->file) : 0;
+    stream->remaining -= read;
+    if (!stream->probed) {
+        stream->probed = true;
+        if (read != 0 && ifstream_decode(stream, stream->buffer + keep, read)) return ifstream_refill_async(stream);
+    }
+    stream->total_read += read;
+    stream->refills += (read != 0);
+    stream->pos = keep;
+    stream->size = keep + read;
+
+    if (read == 0) {
+        stream->eof = true;
+        return false;
+    }
+    return true;
+}
+
+bool ifstream_resume(ifstream* stream) {
+    assert(stream != NULL);
+
+    if (stream->mapped) return false;
+    ifstream_reader* r = stream->reader;
+    if (stream->async && r != NULL) {
+        if (r->decoder != NULL) return false;
+        // The thread left when it hit the end, the next refill starts another one
+        ifstream_reader_stop(r);
+        r->done = r->remaining == 0;
+    }
+    clearerr(stream->file);
+    stream->eof = false;
+    return true;
+}
+
+bool ifstream_seek(ifstream* stream, uint64_t offset) {
+    assert(stream != NULL);
+
+    if (stream->mapped) {
+        stream->pos = (offset < stream->size) ? (size_t)offset : stream->size;
+        return true;
+    }
+    if (stream->reader != NULL && stream->reader->decoder != NULL) return false;
+
+    // The reader thread must be off the file before it moves
+    ifstream_reader_reset(stream->reader);
+#ifdef _WIN32
+    if (_fseeki64(stream->file, (__int64)offset, SEEK_SET) != 0) return false;
+#else
+    if (fseeko(stream->file, (off_t)offset, SEEK_SET) != 0) return false;
+#endif
+    // Nothing buffered so far belongs in front of the new position, and
+    // bytes in the middle of a file say nothing about compression
+    if (offset != 0) stream->probed = true;
+    stream->pos = 0;
+    stream->size = 0;
+    stream->eof = false;
+    return true;
+}
+
+void ifstream_retain(ifstream* stream, size_t size) {
+    assert(stream != NULL);
+
+    if (size <= stream->retain) return;
+    if (stream->async) {
+        if (stream->reader != NULL && size > stream->reader->headroom) ifstream_reader_grow(stream, size);
+    } else if (!stream->mapped) {
+        char* buffer = realloc(stream->heap, IFSTREAM_BUFFER_SIZE + size);
+        assert(buffer != NULL && "Failed to grow stream buffer");
+        stream->heap = buffer;
+        stream->buffer = buffer;
+    }
+    stream->retain = size;
+}
+
+size_t ifstream_retained(const ifstream* stream) {
+    assert(stream != NULL);
+    return stream->pos;
+}
+
+const char* ifstream_peek(ifstream* stream, size_t* size) {
+    assert(stream != NULL);
+    assert(size != NULL);
+
+    if (stream->pos >= stream->size) {
+        ifstream_refill(stream);
+    }
+    *size = stream->size - stream->pos;
+    return stream->buffer + stream->pos;
+}
+
+void ifstream_consume(ifstream* stream, size_t size) {
+    assert(stream != NULL);
+    assert(size <= stream->size - stream->pos);
+
+    stream->pos += size;
 }
 
 int ifstream_getc(ifstream* stream) {
@@ -30,30 +556,27 @@ int ifstream_getc(ifstream* stream) {
     assert(stream->file != NULL);
 
     if (stream->pos >= stream->size) {
-        stream->size = fread(stream->buffer, 1, IFSTREAM_BUFFER_SIZE, stream->file);
-        stream->total_read += stream->size;
-        stream->pos = 0;
-        
-        if (stream->size == 0) {
-            stream->eof = true;
-            return EOF;
-        }
+        if (!ifstream_refill(stream)) return EOF;
     }
     
     return (unsigned char)stream->buffer[stream->pos++];
 }
 
-int32_t ifstream_getc_utf8(ifstream* stream) {
-
-    int first_byte = ifstream_getc(stream);
-    if (first_byte == EOF) return EOF;
+static int32_t utf8_check_codepoint(int32_t codepoint, int bytes_total) {
+    // Overlong encoding
+    if ((bytes_total == 2 && codepoint < 0x80) ||
+        (bytes_total == 3 && codepoint < 0x800) ||
+        (bytes_total == 4 && codepoint < 0x10000)) {
+        return -1;
+    }
 
-    const uint8_t byte = (uint8_t)first_byte;
-    const int bytes_total = utf8_length[byte];
+    if (codepoint > 0x10FFFF) return -1;
     
-    if (bytes_total == 0) return -1;
-    if (bytes_total == 1) return byte; // ASCII
+    return codepoint;
+}
 
+// Character split between two refills
+static int32_t ifstream_getc_utf8_split(ifstream* stream, uint8_t byte, int bytes_total) {
     int32_t codepoint = byte & (0x7F >> bytes_total);
     for (int i = 1; i < bytes_total; i++) {
         int next_byte = ifstream_getc(stream);
@@ -62,15 +585,36 @@ int32_t ifstream_getc_utf8(ifstream* stream) {
         
         codepoint = (codepoint << 6) | (next_byte & 0x3F);
     }
+    return utf8_check_codepoint(codepoint, bytes_total);
+}
+
+int32_t ifstream_getc_utf8(ifstream* stream) {
+    size_t available = 0;
+    const char* data = ifstream_peek(stream, &available);
+    if (available == 0) return EOF;
+
+    const uint8_t byte = (uint8_t)data[0];
+    const int bytes_total = utf8_length[byte];
+    
+    if (bytes_total <= 1) {
+        ifstream_consume(stream, 1);
+        return (bytes_total == 0) ? -1 : byte; // ASCII
+    }
+    if (available < (size_t)bytes_total) {
+        ifstream_consume(stream, 1);
+        return ifstream_getc_utf8_split(stream, byte, bytes_total);
+    }
 
-    // Overlong encoding
-    if ((bytes_total == 2 && codepoint < 0x80) ||
-        (bytes_total == 3 && codepoint < 0x800) ||
-        (bytes_total == 4 && codepoint < 0x10000)) {
-        return -1;
+    int32_t codepoint = byte & (0x7F >> bytes_total);
+    for (int i = 1; i < bytes_total; i++) {
+        const uint8_t next_byte = (uint8_t)data[i];
+        if ((next_byte & 0xC0) != 0x80) {
+            ifstream_consume(stream, (size_t)i + 1);
+            return -1;
+        }
+        codepoint = (codepoint << 6) | (next_byte & 0x3F);
     }
+    ifstream_consume(stream, (size_t)bytes_total);
 
-    if (codepoint > 0x10FFFF) return -1;
-    
-    return codepoint;
-}
\ No newline at end of file
+    return utf8_check_codepoint(codepoint, bytes_total);
+}
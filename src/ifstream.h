@@ -6,6 +6,22 @@
 #include <stdint.h>
 #include <stdio.h>
 
+typedef enum {
+    IFSTREAM_BUFFERED,
+    IFSTREAM_MMAP, // Falls back to buffered for pipes and special files
+    IFSTREAM_MMAP_RANDOM, // Mapped without read-ahead, for sparse access through ifstream_seek
+    IFSTREAM_ASYNC, // Buffered, a reader thread fills the next buffers while the current one is scanned
+} ifstream_backend_t;
+
+// Every backend checks the first bytes for gzip or zstd magic. Compressed input is
+// decoded on the reader thread of IFSTREAM_ASYNC and can't seek.
+
+#define IFSTREAM_BUFFER_SIZE (1 << 20) // 1 MB буфер
+#define IFSTREAM_ASYNC_DEPTH (4)
+#define IFSTREAM_ASYNC_MAX_DEPTH (64)
+
+struct ifstream_reader;
+
 typedef struct ifstream {
     FILE* file;
     char* buffer;
@@ -13,11 +29,53 @@ typedef struct ifstream {
     size_t size;
     bool eof;
     size_t total_read;
+    uint64_t remaining; // Bytes the window still allows, UINT64_MAX - up to the end
+    size_t refills; // Reads that returned data
+    size_t retain;
+    bool mapped;
+    void* map_base; // The mapping starts up to a page before buffer
+    size_t map_size;
+    char* heap; // Owned read buffer, kept across ifstream_reopen
+    bool async;
+    bool probed; // First bytes were checked for compression
+    struct ifstream_reader* reader; // Started on the first async refill, kept across ifstream_reopen
+    size_t read_size;  // Bytes per async read
+    size_t read_depth; // Async buffers, one of them is the one being scanned
+#ifdef _WIN32
+    void* mapping;
+#endif
 } ifstream;
 
 
 void ifstream_init(ifstream *stream, FILE* file);
+void ifstream_init_backend(ifstream* stream, FILE* file, ifstream_backend_t backend);
+// Stream of the length bytes at offset (0 - up to the end), as if they were the whole file.
+// Mapped backends map only that window, the others seek (or read past offset on pipes).
+// Such a stream is read front to back, ifstream_seek is for whole file streams.
+void ifstream_init_window(ifstream* stream, FILE* file, ifstream_backend_t backend, uint64_t offset, uint64_t length);
 void ifstream_close(ifstream* stream);
+// Switches a live stream to another file, reusing its read buffer
+void ifstream_reopen(ifstream* stream, FILE* file, ifstream_backend_t backend);
+// Buffer size and count for IFSTREAM_ASYNC, depth is 2..IFSTREAM_ASYNC_MAX_DEPTH.
+// Kept across ifstream_reopen, ignored by the other backends.
+void ifstream_set_read_ahead(ifstream* stream, size_t size, size_t depth);
+
+// Next contiguous readable region, refilled once the previous one is consumed.
+// *size == 0 means end of stream.
+const char* ifstream_peek(ifstream* stream, size_t* size);
+void ifstream_consume(ifstream* stream, size_t size);
+
+// After the end of the file was reached, lets the next peek read what was appended since.
+// Mapped and decoded streams can't go on and return false.
+bool ifstream_resume(ifstream* stream);
+
+// Next peek starts at offset. Returns false when the file can't seek.
+bool ifstream_seek(ifstream* stream, uint64_t offset);
+
+// Keep up to size consumed bytes readable right before the peeked region across refills
+void ifstream_retain(ifstream* stream, size_t size);
+// Number of bytes readable before the peeked region
+size_t ifstream_retained(const ifstream* stream);
 
 int ifstream_getc(ifstream* stream);
 int32_t ifstream_getc_utf8(ifstream* stream);
@@ -0,0 +1,668 @@
+#include <stdalign.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lazy_dfa.h"
+
+#define DFA_TABLE_SIZE (DFA_MAX_STATES * 2)
+#define STARTS_MIN_CAPACITY (64)
+
+static void dfa_init(lazy_dfa* dfa, const regex* re, const re_program* program, bool unanchored) {
+    memset(dfa, 0, sizeof(*dfa));
+    dfa->re = re;
+    dfa->program = program;
+    dfa->unanchored = unanchored;
+    dfa->states = malloc(DFA_MAX_STATES * sizeof(dfa_state*));
+    dfa->table = calloc(DFA_TABLE_SIZE, sizeof(uint32_t));
+    dfa->stack = malloc((program->count * 2 + 2) * sizeof(uint32_t));
+    dfa->set = malloc(program->count * sizeof(uint32_t));
+    dfa->marks = calloc(program->count, sizeof(uint32_t));
+    assert(dfa->states != NULL && dfa->table != NULL && dfa->stack != NULL);
+    assert(dfa->set != NULL && dfa->marks != NULL);
+    dfa->start[0] = DFA_UNKNOWN;
+    dfa->start[1] = DFA_UNKNOWN;
+}
+
+static void dfa_free(lazy_dfa* dfa) {
+    arena_drop(&dfa->arena);
+    free(dfa->states);
+    free(dfa->table);
+    free(dfa->stack);
+    free(dfa->set);
+    free(dfa->marks);
+}
+
+// Drops every state, indices held by callers become invalid
+static void dfa_flush(lazy_dfa* dfa) {
+    arena_drop(&dfa->arena);
+    dfa->page = NULL;
+    dfa->page_left = 0;
+    dfa->cache_size = 0;
+    dfa->state_count = 0;
+    memset(dfa->table, 0, DFA_TABLE_SIZE * sizeof(uint32_t));
+    dfa->start[0] = DFA_UNKNOWN;
+    dfa->start[1] = DFA_UNKNOWN;
+    ++dfa->flushes;
+}
+
+// States are carved from big pages, so the arena keeps a short block chain
+static void* dfa_allocate(lazy_dfa* dfa, size_t size) {
+    size = (size + alignof(dfa_state) - 1) & ~(alignof(dfa_state) - 1);
+    if (size > dfa->page_left) {
+        size_t page_size = (size > DFA_PAGE_SIZE) ? size : DFA_PAGE_SIZE;
+        dfa->page = arena_allocate(&dfa->arena, page_size, alignof(dfa_state));
+        dfa->page_left = page_size;
+        dfa->cache_size += page_size;
+    }
+    void* result = dfa->page;
+    dfa->page += size;
+    dfa->page_left -= size;
+    return result;
+}
+
+static void closure_add(lazy_dfa* dfa, uint32_t pc, bool at_bol) {
+    const re_inst* insts = dfa->program->insts;
+    size_t top = 0;
+    dfa->stack[top++] = pc;
+    while (top != 0) {
+        pc = dfa->stack[--top];
+        if (dfa->marks[pc] == dfa->generation) continue;
+        dfa->marks[pc] = dfa->generation;
+
+        switch (insts[pc].op) {
+            case RE_SPLIT:
+                dfa->stack[top++] = insts[pc].alt;
+                dfa->stack[top++] = insts[pc].next;
+                break;
+            case RE_BOL:
+                if (at_bol) dfa->stack[top++] = insts[pc].next;
+                break;
+            default:
+                dfa->set[dfa->set_count++] = pc;
+                break;
+        }
+    }
+}
+
+static void next_generation(lazy_dfa* dfa) {
+    if (++dfa->generation == 0) {
+        memset(dfa->marks, 0, dfa->program->count * sizeof(uint32_t));
+        dfa->generation = 1;
+    }
+}
+
+// Whether MATCH is reachable from the set when the line ends right here
+static bool closure_matches_at_eol(lazy_dfa* dfa, bool at_bol) {
+    const re_inst* insts = dfa->program->insts;
+    next_generation(dfa);
+
+    size_t top = 0;
+    for (size_t i = 0; i < dfa->set_count; ++i) {
+        if (insts[dfa->set[i]].op == RE_EOL) dfa->stack[top++] = insts[dfa->set[i]].next;
+    }
+    while (top != 0) {
+        uint32_t pc = dfa->stack[--top];
+        if (dfa->marks[pc] == dfa->generation) continue;
+        dfa->marks[pc] = dfa->generation;
+
+        switch (insts[pc].op) {
+            case RE_MATCH:
+                return true;
+            case RE_SPLIT:
+                dfa->stack[top++] = insts[pc].alt;
+                dfa->stack[top++] = insts[pc].next;
+                break;
+            case RE_EOL:
+                dfa->stack[top++] = insts[pc].next;
+                break;
+            case RE_BOL:
+                if (at_bol) dfa->stack[top++] = insts[pc].next;
+                break;
+            default:
+                break;
+        }
+    }
+    return false;
+}
+
+static int pc_compare(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+// Finds or adds the state for dfa->set, may flush the cache
+static uint32_t dfa_intern(lazy_dfa* dfa, bool at_bol) {
+    if (dfa->set_count == 0) return DFA_DEAD;
+    qsort(dfa->set, dfa->set_count, sizeof(uint32_t), pc_compare);
+
+    uint32_t flags = 0;
+    bool has_eol = false;
+    for (size_t i = 0; i < dfa->set_count; ++i) {
+        uint8_t op = dfa->program->insts[dfa->set[i]].op;
+        if (op == RE_MATCH) flags |= DFA_MATCH;
+        if (op == RE_EOL) has_eol = true;
+    }
+    if ((flags & DFA_MATCH) || (has_eol && closure_matches_at_eol(dfa, at_bol))) flags |= DFA_MATCH_EOL;
+
+    // FNV-1a
+    uint32_t hash = 2166136261u ^ flags;
+    for (size_t i = 0; i < dfa->set_count; ++i) {
+        hash = (hash ^ dfa->set[i]) * 16777619u;
+    }
+
+    size_t slot = hash & (DFA_TABLE_SIZE - 1);
+    for (; dfa->table[slot] != 0; slot = (slot + 1) & (DFA_TABLE_SIZE - 1)) {
+        const dfa_state* state = dfa->states[dfa->table[slot] - 1];
+        if (state->hash == hash && state->flags == flags && state->count == dfa->set_count &&
+            memcmp(state->pcs, dfa->set, dfa->set_count * sizeof(uint32_t)) == 0) {
+            return dfa->table[slot] - 1;
+        }
+    }
+
+    const size_t class_count = dfa->re->class_count;
+    const size_t state_size = sizeof(dfa_state) + class_count * sizeof(uint32_t);
+    const size_t pcs_size = dfa->set_count * sizeof(uint32_t);
+    if (dfa->state_count == DFA_MAX_STATES || dfa->cache_size + state_size + pcs_size > DFA_CACHE_SIZE) {
+        dfa_flush(dfa);
+        slot = hash & (DFA_TABLE_SIZE - 1);
+    }
+
+    dfa_state* state = dfa_allocate(dfa, state_size);
+    uint32_t* pcs = dfa_allocate(dfa, pcs_size);
+    memcpy(pcs, dfa->set, pcs_size);
+    state->flags = flags;
+    state->count = (uint32_t)dfa->set_count;
+    state->hash = hash;
+    state->pcs = pcs;
+    for (size_t i = 0; i < class_count; ++i) state->next[i] = DFA_UNKNOWN;
+
+    const uint32_t index = (uint32_t)dfa->state_count++;
+    dfa->states[index] = state;
+    dfa->table[slot] = index + 1;
+    ++dfa->built;
+    return index;
+}
+
+static uint32_t dfa_start(lazy_dfa* dfa, bool at_bol) {
+    if (dfa->start[at_bol] != DFA_UNKNOWN) return dfa->start[at_bol];
+
+    next_generation(dfa);
+    dfa->set_count = 0;
+    closure_add(dfa, dfa->program->start, at_bol);
+    uint32_t start = dfa_intern(dfa, at_bol);
+    dfa->start[at_bol] = start;
+    return start;
+}
+
+static uint32_t dfa_compute(lazy_dfa* dfa, uint32_t from, uint8_t cls) {
+    const dfa_state* state = dfa->states[from];
+    const uint8_t byte = dfa->re->class_bytes[cls];
+    const re_inst* insts = dfa->program->insts;
+
+    next_generation(dfa);
+    dfa->set_count = 0;
+    for (uint32_t i = 0; i < state->count; ++i) {
+        const re_inst* inst = &insts[state->pcs[i]];
+        if (inst->op == RE_RANGE && byte >= inst->lo && byte <= inst->hi) {
+            closure_add(dfa, inst->next, false);
+        }
+    }
+    if (dfa->unanchored) closure_add(dfa, dfa->program->start, false);
+
+    const size_t flushes = dfa->flushes;
+    uint32_t target = dfa_intern(dfa, false);
+    if (dfa->flushes == flushes) dfa->states[from]->next[cls] = target;
+    return target;
+}
+
+static inline uint32_t dfa_step(lazy_dfa* dfa, uint32_t from, uint8_t byte) {
+    const uint8_t cls = dfa->re->classes[byte];
+    uint32_t target = dfa->states[from]->next[cls];
+    return (target != DFA_UNKNOWN) ? target : dfa_compute(dfa, from, cls);
+}
+
+void regex_matcher_init(regex_matcher* m, const regex* re) {
+    assert(m != NULL);
+    assert(re != NULL);
+
+    memset(m, 0, sizeof(*m));
+    m->re = re;
+    dfa_init(&m->forward, re, &re->forward, true);
+    dfa_init(&m->reverse, re, &re->reverse, true);
+    dfa_init(&m->anchored, re, &re->forward, false);
+    m->use_literal = re->literal != NULL;
+    if (m->use_literal) {
+        search_engine_init(&m->literal, ENGINE_AUTO, re->literal, re->literal_size);
+    }
+    m->owner = malloc(DFA_MAX_STATES * sizeof(size_t));
+    m->owner_stamp = calloc(DFA_MAX_STATES, sizeof(uint32_t));
+    assert(m->owner != NULL && m->owner_stamp != NULL);
+}
+
+void regex_matcher_free(regex_matcher* m) {
+    dfa_free(&m->forward);
+    dfa_free(&m->reverse);
+    dfa_free(&m->anchored);
+    free(m->starts);
+    free(m->matches);
+    free(m->followed);
+    free(m->groups);
+    free(m->live);
+    free(m->spare);
+    free(m->owner);
+    free(m->owner_stamp);
+    m->starts = NULL;
+}
+
+void regex_matcher_reset(regex_matcher* m) {
+    m->line_begin = NULL;
+    m->line_end = NULL;
+    m->start_count = 0;
+}
+
+static const char* line_end_of(const char* from, const char* end) {
+    const char* newline = memchr(from, '\n', (size_t)(end - from));
+    return newline ? newline : end;
+}
+
+// Finds the first line at or after from that may hold a match
+static bool find_candidate_line(regex_matcher* m, const char* from, const char* end,
+                                const char** line_begin, const char** line_end) {
+    if (m->use_literal) {
+        const char* hit = search_engine_find(&m->literal, from, end);
+        if (hit == NULL) return false;
+
+        const char* begin = hit;
+        while (begin > from && begin[-1] != '\n') --begin;
+        *line_begin = begin;
+        *line_end = line_end_of(hit, end);
+        return true;
+    }
+
+    lazy_dfa* dfa = &m->forward;
+    const char* line = from;
+    uint32_t state = dfa_start(dfa, true);
+    for (const char* p = from; p < end; ++p) {
+        if (*p == '\n') {
+            if (state != DFA_DEAD && (dfa->states[state]->flags & DFA_MATCH_EOL)) {
+                *line_begin = line;
+                *line_end = p;
+                return true;
+            }
+            line = p + 1;
+            state = dfa_start(dfa, true);
+            continue;
+        }
+        if (state == DFA_DEAD) {
+            // Nothing can match before the next line
+            const char* newline = memchr(p, '\n', (size_t)(end - p));
+            if (newline == NULL) return false;
+            p = newline - 1;
+            continue;
+        }
+        if (dfa->states[state]->flags & DFA_MATCH) {
+            *line_begin = line;
+            *line_end = line_end_of(p, end);
+            return true;
+        }
+        state = dfa_step(dfa, state, (uint8_t)*p);
+    }
+    // Past the final '\n' there is no line left
+    if (line < end && state != DFA_DEAD && (dfa->states[state]->flags & DFA_MATCH_EOL)) {
+        *line_begin = line;
+        *line_end = end;
+        return true;
+    }
+    return false;
+}
+
+static void push_start(regex_matcher* m, size_t offset) {
+    if (m->start_count == m->start_capacity) {
+        size_t new_capacity = m->start_capacity ? m->start_capacity * 2 : STARTS_MIN_CAPACITY;
+        size_t* starts = realloc(m->starts, new_capacity * sizeof(size_t));
+        assert(starts != NULL && "Failed to grow match starts");
+        m->starts = starts;
+        m->start_capacity = new_capacity;
+    }
+    m->starts[m->start_count++] = offset;
+}
+
+// One backward pass over the line collects every position some match starts at
+static void collect_starts(regex_matcher* m, const char* line_begin, const char* line_end) {
+    lazy_dfa* dfa = &m->reverse;
+    m->line_begin = line_begin;
+    m->line_end = line_end;
+    m->start_count = 0;
+    m->last_end = MATCH_NONE;
+    m->scanned = 0;
+    m->rescanned = 0;
+    m->following = false;
+    m->match_count = 0;
+    m->match_next = 0;
+
+    uint32_t state = dfa_start(dfa, true);
+    for (const char* p = line_end; state != DFA_DEAD; --p) {
+        uint32_t flags = dfa->states[state]->flags;
+        if ((flags & DFA_MATCH) || (p == line_begin && (flags & DFA_MATCH_EOL))) {
+            push_start(m, (size_t)(p - line_begin));
+        }
+        if (p == line_begin) break;
+        state = dfa_step(dfa, state, (uint8_t)p[-1]);
+    }
+}
+
+static void reverse_offsets(size_t* offsets, size_t count) {
+    for (size_t i = 0, j = count; i + 1 < j; ++i, --j) {
+        const size_t offset = offsets[i];
+        offsets[i] = offsets[j - 1];
+        offsets[j - 1] = offset;
+    }
+}
+
+// An empty match right where the previous one ended doesn't count
+static bool match_counts(const regex_matcher* m, size_t begin, size_t end) {
+    return end > begin || begin != m->last_end;
+}
+
+static void push_match(regex_matcher* m, size_t begin, size_t end) {
+    m->matches[m->match_count * 2] = begin;
+    m->matches[m->match_count * 2 + 1] = end;
+    ++m->match_count;
+}
+
+// End of the longest match starting at begin, NULL if there is none.
+// Moves m->scanned up to the end of the bytes read.
+static const char* longest_match(regex_matcher* m, const char* begin) {
+    lazy_dfa* dfa = &m->anchored;
+    const char* line_end = m->line_end;
+    const char* last = NULL;
+
+    uint32_t state = dfa_start(dfa, begin == m->line_begin);
+    const char* p = begin;
+    for (; state != DFA_DEAD; ++p) {
+        uint32_t flags = dfa->states[state]->flags;
+        if ((flags & DFA_MATCH) || (p == line_end && (flags & DFA_MATCH_EOL))) last = p;
+        if (p == line_end) break;
+        state = dfa_step(dfa, state, (uint8_t)*p);
+    }
+    if ((size_t)(p - m->line_begin) > m->scanned) m->scanned = (size_t)(p - m->line_begin);
+    return last;
+}
+
+static void next_stamp(regex_matcher* m) {
+    if (++m->stamp == 0) {
+        memset(m->owner_stamp, 0, DFA_MAX_STATES * sizeof(uint32_t));
+        m->stamp = 1;
+    }
+}
+
+// Longest match end of a start known so far
+static size_t start_end(const regex_matcher* m, const match_start* start) {
+    if (start->join == MATCH_NONE) return start->end;
+    const size_t group_end = m->groups[start->group].end;
+    return (group_end != MATCH_NONE && group_end >= start->join) ? group_end : start->end;
+}
+
+static void finish_group(regex_matcher* m, size_t group) {
+    for (size_t i = m->groups[group].first; i != MATCH_NONE; i = m->followed[i].next) {
+        match_start* start = &m->followed[i];
+        start->end = start_end(m, start);
+        start->join = MATCH_NONE;
+    }
+}
+
+// Moves the starts of group from into group to, their states met at offset
+static void merge_groups(regex_matcher* m, size_t to, size_t from, size_t offset) {
+    match_group* target = &m->groups[to];
+    const match_group* source = &m->groups[from];
+    for (size_t i = source->first; i != MATCH_NONE; i = m->followed[i].next) {
+        match_start* start = &m->followed[i];
+        start->end = start_end(m, start);
+        start->join = offset;
+        start->group = to;
+    }
+    m->followed[target->last].next = source->first;
+    target->last = source->last;
+    target->size += source->size;
+}
+
+// Moves finished starts from the head of the queue into the match list
+static size_t settle_matches(regex_matcher* m, size_t head, size_t* bound) {
+    for (; head < m->start_count; ++head) {
+        const size_t offset = m->starts[head];
+        const match_start* start = &m->followed[head];
+        if (offset < *bound) continue;
+        if (start->join != MATCH_NONE) break;
+        if (start->end != MATCH_NONE && match_counts(m, offset, start->end)) {
+            push_match(m, offset, start->end);
+            *bound = start->end;
+            m->last_end = start->end;
+        }
+    }
+    return head;
+}
+
+// Starts a group for the start at index, or adds it to the group already in its state
+static void follow_start(regex_matcher* m, size_t index) {
+    lazy_dfa* dfa = &m->anchored;
+    match_start* start = &m->followed[index];
+    const uint32_t state = dfa_start(dfa, m->starts[index] == 0);
+    ++m->candidates;
+    start->end = MATCH_NONE;
+    start->join = m->starts[index];
+    start->next = MATCH_NONE;
+    if (state == DFA_DEAD) {
+        start->join = MATCH_NONE;
+        return;
+    }
+
+    if (m->owner_stamp[state] == m->stamp) {
+        const size_t group = m->live[m->owner[state]];
+        start->group = group;
+        m->followed[m->groups[group].last].next = index;
+        m->groups[group].last = index;
+        ++m->groups[group].size;
+        return;
+    }
+    const size_t group = m->group_count++;
+    m->groups[group] = (match_group){.state = state, .first = index, .last = index, .size = 1, .end = MATCH_NONE};
+    start->group = group;
+    m->owner_stamp[state] = m->stamp;
+    m->owner[state] = m->live_count;
+    m->live[m->live_count++] = group;
+}
+
+// Runs every live group over the byte at offset, groups landing in one state merge
+static void step_groups(regex_matcher* m, size_t offset, size_t flushes) {
+    lazy_dfa* dfa = &m->anchored;
+    next_stamp(m);
+    size_t running = 0;
+    for (size_t i = 0; i < m->live_count; ++i) {
+        const size_t index = m->live[i];
+        match_group* group = &m->groups[index];
+        group->state = dfa_step(dfa, group->state, (uint8_t)m->line_begin[offset]);
+        if (dfa->flushes != flushes) return;
+        if (group->state == DFA_DEAD) {
+            finish_group(m, index);
+            continue;
+        }
+        if (m->owner_stamp[group->state] != m->stamp) {
+            m->owner_stamp[group->state] = m->stamp;
+            m->owner[group->state] = running;
+            m->spare[running++] = index;
+            continue;
+        }
+        // The bigger group stays, so fewer starts get moved
+        const size_t slot = m->owner[group->state];
+        const size_t other = m->spare[slot];
+        if (m->groups[other].size >= group->size) {
+            merge_groups(m, other, index, offset + 1);
+        } else {
+            merge_groups(m, index, other, offset + 1);
+            m->spare[slot] = index;
+        }
+    }
+    size_t* live = m->live;
+    m->live = m->spare;
+    m->spare = live;
+    m->live_count = running;
+}
+
+static void reserve_followed(regex_matcher* m) {
+    if (m->follow_capacity >= m->start_count) return;
+    const size_t capacity = m->start_capacity;
+    match_start* followed = realloc(m->followed, capacity * sizeof(match_start));
+    match_group* groups = realloc(m->groups, capacity * sizeof(match_group));
+    size_t* live = realloc(m->live, capacity * sizeof(size_t));
+    size_t* spare = realloc(m->spare, capacity * sizeof(size_t));
+    size_t* matches = realloc(m->matches, capacity * 2 * sizeof(size_t));
+    assert(followed != NULL && groups != NULL && live != NULL && spare != NULL && matches != NULL &&
+           "Failed to grow followed starts");
+    m->matches = matches;
+    m->followed = followed;
+    m->groups = groups;
+    m->live = live;
+    m->spare = spare;
+    m->follow_capacity = capacity;
+}
+
+// One pass from the start at head to the end of the line. Starts run side by side,
+// a start reaching the state of another one joins its group and shares its future
+// matches. Starts before the end of the current match can't begin the next one and
+// aren't followed. Returns false if the DFA cache got flushed under the running states.
+static bool follow_starts(regex_matcher* m, size_t* head, size_t* bound) {
+    lazy_dfa* dfa = &m->anchored;
+    const size_t length = (size_t)(m->line_end - m->line_begin);
+    const size_t flushes = dfa->flushes;
+    reserve_followed(m);
+    for (size_t i = *head; i < m->start_count; ++i) {
+        m->followed[i].group = MATCH_NONE;
+        m->followed[i].join = 0;
+    }
+    m->group_count = 0;
+    m->live_count = 0;
+
+    size_t next = *head;
+    size_t offset = 0;
+    while (next < m->start_count || m->live_count != 0) {
+        if (m->live_count == 0) {
+            offset = m->starts[next];
+            next_stamp(m);
+        }
+        for (; next < m->start_count && m->starts[next] == offset; ++next) {
+            const match_start* first = &m->followed[*head];
+            if (*head < next && first->group != MATCH_NONE && first->join != MATCH_NONE) {
+                const size_t end = start_end(m, first);
+                if (end != MATCH_NONE && offset < end) continue;
+            }
+            follow_start(m, next);
+            if (dfa->flushes != flushes) return false;
+        }
+
+        const bool at_end = offset == length;
+        for (size_t i = 0; i < m->live_count; ++i) {
+            match_group* group = &m->groups[m->live[i]];
+            const uint32_t flags = dfa->states[group->state]->flags;
+            if ((flags & DFA_MATCH) || (at_end && (flags & DFA_MATCH_EOL))) group->end = offset;
+        }
+        if (at_end) {
+            for (size_t i = 0; i < m->live_count; ++i) finish_group(m, m->live[i]);
+            m->live_count = 0;
+            break;
+        }
+
+        step_groups(m, offset, flushes);
+        if (dfa->flushes != flushes) return false;
+        ++offset;
+        *head = settle_matches(m, *head, bound);
+    }
+    *head = settle_matches(m, *head, bound);
+    return true;
+}
+
+// Matches from bound to the end of the line with follow_starts, which wants the
+// starts ascending. If the DFA cache gets flushed under its running states, the
+// matches found so far stand and the starts left go back to anchored scans.
+static void find_rest(regex_matcher* m, size_t bound) {
+    reverse_offsets(m->starts, m->start_count);
+    m->following = true;
+
+    size_t head = 0;
+    if (follow_starts(m, &head, &bound)) {
+        m->start_count = 0;
+        return;
+    }
+    const size_t left = m->start_count - head;
+    reverse_offsets(m->starts + head, left);
+    memmove(m->starts, m->starts + head, left * sizeof(size_t));
+    m->start_count = left;
+}
+
+// Next match the one pass search found at or after from
+static bool next_found(regex_matcher* m, const char* from, const char** match_begin, const char** match_end) {
+    while (m->match_next < m->match_count) {
+        const size_t* match = &m->matches[m->match_next * 2];
+        ++m->match_next;
+        if (m->line_begin + match[0] < from) continue;
+        *match_begin = m->line_begin + match[0];
+        *match_end = m->line_begin + match[1];
+        return true;
+    }
+    return false;
+}
+
+static bool next_in_line(regex_matcher* m, const char* from, const char** match_begin, const char** match_end) {
+    if (m->following && next_found(m, from, match_begin, match_end)) return true;
+
+    const char* line = m->line_begin;
+    while (m->start_count != 0) {
+        const size_t offset = m->starts[m->start_count - 1];
+        if (line + offset < from) {
+            --m->start_count;
+            continue;
+        }
+        // A scan often reads a little past its match, the next one reads that again
+        if (offset < m->scanned && !m->following) {
+            m->rescanned += m->scanned - offset;
+            if (m->rescanned > (size_t)(m->line_end - line)) {
+                find_rest(m, (size_t)(from - line));
+                if (next_found(m, from, match_begin, match_end)) return true;
+                continue;
+            }
+        }
+
+        --m->start_count;
+        ++m->candidates;
+        const char* end = longest_match(m, line + offset);
+        if (end != NULL && match_counts(m, offset, (size_t)(end - line))) {
+            *match_begin = line + offset;
+            *match_end = end;
+            m->last_end = (size_t)(end - line);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool regex_find(regex_matcher* m, const char* from, const char* end,
+                const char** match_begin, const char** match_end) {
+    assert(m != NULL);
+    assert(from <= end);
+
+    for (;;) {
+        if (m->line_begin != NULL && from >= m->line_begin && from <= m->line_end) {
+            if (next_in_line(m, from, match_begin, match_end)) return true;
+            from = (m->line_end < end) ? m->line_end + 1 : end;
+            regex_matcher_reset(m);
+        }
+        if (from >= end) return false;
+
+        const char* line_begin = NULL;
+        const char* line_end = NULL;
+        if (!find_candidate_line(m, from, end, &line_begin, &line_end)) return false;
+        collect_starts(m, line_begin, line_end);
+        from = line_begin;
+    }
+}
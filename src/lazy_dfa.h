@@ -0,0 +1,120 @@
+#ifndef __LAZY_DFA_H__
+#define __LAZY_DFA_H__ 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena_allocator.h"
+#include "regex.h"
+#include "search_engine.h"
+
+// DFA built while scanning: a state is a set of program positions, its transitions are
+// computed on first use and cached in an arena. A full cache is dropped and rebuilt.
+
+#define DFA_MAX_STATES (4096)
+#define DFA_CACHE_SIZE (8 * 1024 * 1024)
+#define DFA_PAGE_SIZE (64 * 1024)
+
+#define DFA_UNKNOWN (UINT32_MAX)
+#define DFA_DEAD (UINT32_MAX - 1)
+
+#define DFA_MATCH (1u << 0)     // a match ends before the next byte
+#define DFA_MATCH_EOL (1u << 1) // a match ends here if the line ends here
+
+typedef struct dfa_state {
+    uint32_t flags;
+    uint32_t count;
+    uint32_t hash;
+    const uint32_t* pcs; // sorted
+    uint32_t next[];     // per byte class: state index, DFA_DEAD or DFA_UNKNOWN
+} dfa_state;
+
+typedef struct lazy_dfa {
+    const regex* re;
+    const re_program* program;
+    bool unanchored; // the program may also start after every byte
+    arena_allocator arena;
+    char* page;
+    size_t page_left;
+    size_t cache_size;
+    dfa_state** states;
+    size_t state_count;
+    uint32_t* table; // open addressing, state index + 1
+    uint32_t start[2]; // by "at line start"
+    uint32_t* stack;
+    uint32_t* set;
+    size_t set_count;
+    uint32_t* marks;
+    uint32_t generation;
+    size_t built;   // states built since init
+    size_t flushes;
+} lazy_dfa;
+
+#define MATCH_NONE (SIZE_MAX)
+
+// A start followed by the one pass search
+typedef struct match_start {
+    size_t end;   // longest match end seen before join, MATCH_NONE if none
+    size_t join;  // offset it joined its group at, MATCH_NONE once end is final
+    size_t next;  // next start of the same group
+    size_t group; // MATCH_NONE while not followed
+} match_start;
+
+// Starts in the same anchored DFA state share a group, their futures are equal
+typedef struct match_group {
+    uint32_t state;
+    size_t first;
+    size_t last;
+    size_t size;
+    size_t end; // last offset the state matched at, MATCH_NONE if none
+} match_group;
+
+// Leftmost-longest search inside lines. Time stays linear in
+// the line length: once anchored scans have read as many bytes again as the line
+// holds, the rest of its starts are followed in one left to right pass.
+typedef struct regex_matcher {
+    const regex* re;
+    lazy_dfa forward;  // unanchored, finds lines holding a match
+    lazy_dfa reverse;  // unanchored over the reversed line, finds match starts
+    lazy_dfa anchored; // longest match from a start
+    bool use_literal;
+    search_engine literal;
+    const char* line_begin; // line with cached starts, NULL if none
+    const char* line_end;
+    size_t* starts; // offsets from line_begin, descending
+    size_t start_count;
+    size_t start_capacity;
+    size_t last_end;  // end of the match found last, MATCH_NONE if none
+    size_t scanned;   // end of the bytes anchored scans read so far
+    size_t rescanned; // bytes they read more than once
+    bool following;   // the one pass search ran over the line
+    // One pass search, sized for follow_capacity starts
+    size_t* matches; // begin and end offset pairs it found
+    size_t match_count;
+    size_t match_next;
+    match_start* followed;
+    match_group* groups;
+    size_t group_count;
+    size_t* live;  // groups still running
+    size_t* spare; // groups running after the next byte
+    size_t live_count;
+    size_t follow_capacity;
+    size_t* owner; // DFA state -> index in spare, valid if owner_stamp matches
+    uint32_t* owner_stamp;
+    uint32_t stamp;
+    size_t candidates; // Start positions run through the anchored DFA so far
+} regex_matcher;
+
+void regex_matcher_init(regex_matcher* m, const regex* re);
+void regex_matcher_free(regex_matcher* m);
+// Forgets cached positions, needed before searching memory that changed
+void regex_matcher_reset(regex_matcher* m);
+
+// [from, end) ends with a whole line, the last one may miss its '\n'. from is a line start
+// or the end of the previous match. Returns the first match starting at or after from.
+// Matches may be empty, but not right where the previous match ended.
+bool regex_find(regex_matcher* m, const char* from, const char* end,
+                const char** match_begin, const char** match_end);
+
+#endif // __LAZY_DFA_H__
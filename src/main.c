@@ -1,336 +1,127 @@
+#include <stdalign.h>
 #include <stdbool.h>
 #include <assert.h>
 #include <stdlib.h>
 #include <locale.h>
 #include <string.h>
 #include <stdint.h>
+#include <limits.h>
 #include <stdio.h>
 #include <errno.h>
 #include <ctype.h>
 #include <time.h>
 
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
 #include "arena_allocator.h"
 #include "utf8_util.h"
+#include "hex_dump.h"
+#include "output.h"
 #include "ifstream.h"
 #include "general.h"
 #include "dynamic_string.h"
-
-typedef enum {
-    OUTPUT_RAW,
-    OUTPUT_HEX,
-    OUTPUT_ASCII,
-    OUTPUT_TEXTONLY,s
-} output_mode_t;
-
-#define BUFFER_SIZE (128)
-#define SEARCH_PATTERN_MAX_SIZE (256)
-#define DEFAULT_CHUNK_SIZE (1024 * 1024)
-
-static arena_allocator temp_arena = {0};
-
-typedef struct search_ctx {
-    const char* pattern;
-    size_t pattern_size;
-    size_t pattern_utf8_len;
-    const char* filepath;
-    ifstream* stream;
-    dstring line_buffer;
-    size_t current_line;
-    size_t current_char;
-    bool timing;
-    bool counting;
-    bool printing;
-    bool grep_mode;
-} search_ctx;
-
-typedef struct print_ctx {
-    output_mode_t mode;
-    size_t bytes_per_line;
-} print_ctx;
-
-
-void print_usage(const char* prog_name) {
-    printf("Usage: %s <filename> [options]\n", prog_name);
-    printf("\nBasic options:\n");
-    printf("  -h/--help      Show this message\n");
-    printf("  -s <str>       Search for text pattern\n");
-    printf("  -x <hex>       Search for hex pattern (e.g. \"DEADBEEF\")\n");
-    printf("  -v <mode>      View file content with specified mode\n");
-    printf("  -w <num>       Bytes per line (default: 16, only with -v)\n");
-    printf("\nOutput control:\n");
-    printf("  -np            Disable printing of matches (only count)\n");
-    printf("  -nc            Disable match counting\n");
-    printf("  -t             Enable timing measurements\n");
-    printf("\nView modes (-v option):\n");
-    printf("  raw            Raw byte output (default)\n");
-    printf("  hex            Hexadecimal dump\n");
-    printf("  ascii          Combined hex/ASCII view\n");
-    printf("  textonly       Text only output (UTF-8 aware)\n");
-    printf("\nExamples:\n");
-    printf("  %s file.txt -s \"pattern\"      Search for text pattern\n", prog_name);
-    printf("  %s file.bin -x \"C0FFEE\" -t    Search hex with timing\n", prog_name);
-    printf("  %s file.txt -v hex -w 32      View as hex dump (32 bytes/line)\n", prog_name);
-    printf("  %s file.txt -s \"text\" -np     Search without printing matches\n", prog_name);
-}
-
-output_mode_t parse_output_mode(const char* mode_str) {
-    assert(mode_str != NULL);
-
-    if (strcmp(mode_str, "hex") == 0) return OUTPUT_HEX;
-    if (strcmp(mode_str, "ascii") == 0) return OUTPUT_ASCII;
-    if (strcmp(mode_str, "textonly") == 0) return OUTPUT_TEXTONLY;
-    return OUTPUT_RAW;
+#include "search_engine.h"
+#include "pattern_set.h"
+#include "regex.h"
+#include "dir_walk.h"
+#include "trigram_index.h"
+#include "search.h"
+#include "thread.h"
+#include "view.h"
+#include "run_stats.h"
+
+static output_writer out = {0};
+
+void print_usage(output_writer* out, const char* prog_name) {
+    output_printf(out, "Usage: %s <path>... [options]\n", prog_name);
+    output_string(out, "A single path of - reads standard input, .gz and .zst input is decompressed on the fly\n");
+    output_string(out, "\nBasic options:\n");
+    output_string(out, "  -h/--help      Show this message\n");
+    output_string(out, "  -s <str>       Search for text pattern (repeatable)\n");
+    output_string(out, "  -x <hex>       Search for hex pattern (e.g. \"DEADBEEF\", repeatable)\n");
+    output_string(out, "                 ?? - any byte, ? - any nibble, [n-m] - n to m any bytes (\"DE ?? B? [2-8] EF\")\n");
+    output_string(out, "  -f <file>      Search for patterns from file, one per line (\"hex:\" prefix for hex)\n");
+    output_string(out, "  -e <regex>     Search for regular expression matches (repeatable, alternatives)\n");
+    output_string(out, "  -i             Ignore case of text patterns (-s, -f)\n");
+    output_string(out, "  -v <mode>      View file content with specified mode\n");
+    output_string(out, "  -w <num>       Bytes per line (default: 16, only with -v)\n");
+    output_string(out, "  --engine <e>   Search engine: auto, packed, horspool, twoway, rare\n");
+    output_string(out, "  -j <num>       Search with num threads (0 - one per core)\n");
+    output_string(out, "  -F             Follow the file: keep searching what is appended, like tail -F\n");
+    output_printf(out, "  --index <m>    build: write trigram index <file>%s, off: ignore it\n", INDEX_SUFFIX);
+    output_string(out, "\nDirectory search (directories are searched recursively):\n");
+    output_string(out, "  --ignore <g>   Skip files and directories matching glob (repeatable)\n");
+    output_string(out, "  --max-size <n> Skip files larger than n bytes (K, M, G suffixes)\n");
+    output_string(out, "  --offset <n>   Start view or search at byte n of the file (0x hex, K/M/G/T suffixes)\n");
+    output_string(out, "  --length <n>   Stop after n bytes, the rest of the file is never read\n");
+    output_string(out, "\nOutput control:\n");
+    output_string(out, "  -np            Disable printing of matches (only count)\n");
+    output_string(out, "  -nc            Disable match counting\n");
+    output_string(out, "  --max-line <n> Cut grep mode lines after n bytes (default 64M, 0 - no limit)\n");
+    output_string(out, "  -A/-B <n>      Print n lines after/before every matching line (grep mode)\n");
+    output_string(out, "  -C <n>         Same as -A n -B n\n");
+    output_string(out, "  -t             Enable timing measurements\n");
+    output_string(out, "  --stats[=json] Print a run breakdown to stderr (time, I/O, candidates, memory)\n");
+    output_string(out, "  --no-mmap      Read through a buffer instead of mapping the file\n");
+    output_string(out, "  --huge-pages   Back worker scratch memory with huge pages (-j)\n");
+    output_string(out, "  --read-ahead <n>   Read through n buffers on a reader thread instead of mapping (default 4)\n");
+    output_string(out, "  --read-buffer <n>  Size of each read-ahead buffer (K, M suffixes, default 1M)\n");
+    output_string(out, "\nView modes (-v option):\n");
+    output_string(out, "  raw            Raw byte output (default)\n");
+    output_string(out, "  hex            Hexadecimal dump\n");
+    output_string(out, "  ascii          Combined hex/ASCII view\n");
+    output_string(out, "  textonly       Text only output (UTF-8 aware)\n");
+    output_string(out, "\nExamples:\n");
+    output_printf(out, "  %s file.txt -s \"pattern\"      Search for text pattern\n", prog_name);
+    output_printf(out, "  %s file.bin -x \"C0FFEE\" -t    Search hex with timing\n", prog_name);
+    output_printf(out, "  %s file.txt -v hex -w 32      View as hex dump (32 bytes/line)\n", prog_name);
+    output_printf(out, "  %s file.txt -s \"text\" -np     Search without printing matches\n", prog_name);
+    output_printf(out, "  %s src -s \"TODO\" -j 0 --ignore .git\n", prog_name);
+    output_printf(out, "  %s app.log -e \"^ERROR .*timeout\" -g\n", prog_name);
+    output_printf(out, "  %s capture.bin --index build  Index once, later searches read candidate blocks only\n", prog_name);
 }
 
-bool parse_hex_pattern(const char* str, size_t max_str_size, char* out, size_t* out_len) {
+bool parse_size(const char* str, uint64_t* out) {
     assert(str != NULL);
     assert(out != NULL);
-    assert(out_len != NULL);
-    assert(max_str_size != 0);
-
-    size_t len = 0;
-    const char* p = str;
-    
-    while ((max_str_size > len) && *p) {
-        while (*p && !isxdigit(*p)) p++;
-        if (!*p) break;
-        
-        if (!*(p + 1) || !isxdigit(*(p + 1))) return false;
-        
-        if (sscanf_s(p, "%2hhx", &out[len++]) != 1) {
-            return false;
-        }
-        p += 2;
-    }
-    
-    *out_len = len;
-    return (len > 0);
-}
-size_t sprint_hex_byte(char* data, unsigned char byte) {
-    assert(data != NULL);
-    
-    static const char hex_digits[] = "0123456789ABCDEF";
-    
-    data[0] = hex_digits[(byte >> 4) & 0x0F];  // H
-    data[1] = hex_digits[byte & 0x0F];         // L
-    
-    return 2;
-}
-
-void print_data(const char* data, size_t size, size_t bytes_per_line, output_mode_t mode) {
-    char buffer[BUFFER_SIZE];
-    size_t buffer_pos = 0;
-    bool last_printable = true;
-
-    memset(buffer, 0, BUFFER_SIZE);
-
-    for (size_t i = 0; i < size; ++i) {
-        switch (mode) {
-            case OUTPUT_HEX: {
-                buffer_pos += sprint_hex_byte(&buffer[buffer_pos], (unsigned char)data[i]);
-                buffer[buffer_pos++] = ' ';
-                break;
-            }
-            case OUTPUT_ASCII: {
-                bool printable = isascii(data[i]) && !isspace(data[i]) && !iscntrl(data[i]);
-                
-                buffer_pos += sprint_hex_byte(&buffer[buffer_pos], (unsigned char)data[i]);
-                buffer[buffer_pos++] = printable ? data[i] : '.';
-                buffer[buffer_pos++] = ' ';
-                break;
-            }
-            
-            case OUTPUT_TEXTONLY: {
-                bool printable = isascii(data[i]) && !isspace(data[i]) && !iscntrl(data[i]);
-                
-                if (last_printable && !printable) {
-                    buffer[buffer_pos++] = ' ';
-                } else if (printable) {
-                    buffer[buffer_pos++] = data[i];
-                }
-                last_printable = printable;
-                break;
-            }
-            
-            default:
-            case OUTPUT_RAW: {
-                bool printable = isascii(data[i]) && !isspace(data[i]) && !iscntrl(data[i]);
-                buffer[buffer_pos++] = printable ? data[i] : '.';
-                buffer[buffer_pos++] = ' ';
-                break;
-            }
-        }
-
-        
-        if ((i % bytes_per_line == 0) && (i != 0)) {
-            if (mode != OUTPUT_TEXTONLY) {
-                // buffer[buffer_pos++] = '\n';
-                // fwrite(buffer, buffer_pos, 1, stdout);
-                // buffer_pos = 0;
-            }
-        }
-        if (buffer_pos >= (BUFFER_SIZE - 32)) {
-            fwrite(buffer, buffer_pos, 1, stdout);
-            buffer_pos = 0;
-        }
-    }
-    
-    if (buffer_pos > 0) {
-        fwrite(buffer, 1, buffer_pos, stdout);
-    }
-    printf("\n");
-    fflush(stdout);
-}
-
-void search_file(search_ctx* ctx) {
-    if (ctx->pattern_size == 0) {
-        fprintf(stderr, "Empty search pattern\n");
-        exit(EXIT_FAILURE);
-    }
-    arena_slice slice = arena_push(&temp_arena, ctx->pattern_size, 8);
-    char* window = slice.allocated;
-
-    clock_t start_time = clock();
-
-    size_t window_pos = 0;
-    int ch = 0;
-    size_t char_in_line = 0;
-    size_t line_number = 0;
-    size_t counter = 0;
-    size_t char_counter = 0;
-    bool match_this_line = false;
-    while ((ch = ifstream_getc(ctx->stream)) != EOF) {
-        window[window_pos] = (char)ch;
-        window_pos = (window_pos + 1) % ctx->pattern_size;
-        
-        bool match = true;
-        for (size_t i = 0; i < ctx->pattern_size; i++) {
-            size_t idx = (window_pos + i) % ctx->pattern_size;
-            if (window[idx] != ctx->pattern[i]) {
-                match = false;
-                break;
-            }
-        }
-        if (ctx->grep_mode && ctx->printing && ch != '\n')
-            dstring_append_char(&ctx->line_buffer, (char)ch);
-        match_this_line = match_this_line || match;
-        
-        if (match) {
-            ++counter;
-            const size_t match_pos = char_in_line - ctx->pattern_utf8_len + 1;
-            if (ctx->printing && !ctx->grep_mode) {
-                printf("%s:%zu:%zu\n", ctx->filepath, line_number + 1, match_pos + 1);
-            }
-        }
-
-        if (char_counter == 0) {
-            if (ch == '\n') {
-                char_in_line = 0;
-                if (ctx->grep_mode && ctx->printing) {
-                    if (match_this_line)
-                        printf("%zu:%s\n", line_number + 1, dstring_cstr(&ctx->line_buffer));
-                    dstring_clear(&ctx->line_buffer);
-                }
-                ++line_number;
-                match_this_line = false;
-            } else {
-                ++char_in_line;
-                char_counter = utf8_length[ch];
-            }
-            
-            // if ((ch & 0xC0) != 0x80) char_in_line++; // A bit slower for some reason
-        }
-        if (char_counter == 0) {
-            char_counter = 1;
-        }
-        --char_counter;
 
+    char* end = NULL;
+    const bool hex = str[0] == '0' && (str[1] == 'x' || str[1] == 'X');
+    unsigned long long value = strtoull(str, &end, hex ? 16 : 10);
+    if (end == str) return false;
+
+    unsigned shift = 0;
+    switch (toupper((unsigned char)*end)) {
+        case 'T': shift += 10; // fallthrough
+        case 'G': shift += 10; // fallthrough
+        case 'M': shift += 10; // fallthrough
+        case 'K': shift += 10; ++end; break;
+        default: break;
     }
+    if (*end != '\0' || value > (ULLONG_MAX >> shift)) return false;
+    value <<= shift;
 
-    clock_t end_time = clock();
-    double elapsed_sec = (double)(end_time - start_time) / CLOCKS_PER_SEC;
-
-    if (ctx->counting) {
-        printf("Total matches: %zu\n", counter);
-    }
-    if (ctx->timing) {
-        printf("Search time: %.3lf seconds\n", elapsed_sec);
-    }
-    arena_pop(slice);
+    *out = (uint64_t)value;
+    return true;
 }
-void print_file(print_ctx* ctx, ifstream* stream) {
-    char buffer[BUFFER_SIZE];
-    int ch = 0;
-    size_t printed = 0;
-
-    memset(buffer, 0, BUFFER_SIZE);
-
-    while ((ch = ifstream_getc(stream)) != EOF) {
-        size_t buffer_pos = 0;
-        bool last_printable = true;
-        buffer[0] = '\0';
-
-        switch (ctx->mode) {
-            case OUTPUT_HEX: {
-                buffer_pos += sprint_hex_byte(&buffer[buffer_pos], (unsigned char)ch);
-                buffer[buffer_pos++] = ' ';
-                break;
-            }
-            case OUTPUT_ASCII: {
-                bool printable = isascii(ch) && !isspace(ch) && !iscntrl(ch);
-                
-                buffer_pos += sprint_hex_byte(&buffer[buffer_pos], (unsigned char)ch);
-                buffer[buffer_pos++] = printable ? ch : '.';
-                buffer[buffer_pos++] = ' ';
-                break;
-            }
-            
-            case OUTPUT_TEXTONLY: {
-                bool printable = isascii(ch) && !isspace(ch) && !iscntrl(ch);
-                
-                if (last_printable && !printable) {
-                    buffer[buffer_pos++] = ' ';
-                } else if (printable) {
-                    buffer[buffer_pos++] = ch;
-                }
-                last_printable = printable;
-                break;
-            }
-            
-            default:
-            case OUTPUT_RAW: {
-                bool printable = isascii(ch) && !isspace(ch) && !iscntrl(ch);
-                buffer[buffer_pos++] = printable ? ch : '.';
-                buffer[buffer_pos++] = ' ';
-                break;
-            }
-        }
 
-        
-        if ((printed % ctx->bytes_per_line == 0) && (printed != 0)) {
-            if (ctx->mode != OUTPUT_TEXTONLY) {
-                buffer[buffer_pos++] = '\n';
-            }
-        }
-        if (buffer_pos >= (BUFFER_SIZE - 32)) {
-            fwrite(buffer, buffer_pos, 1, stdout);
-            buffer_pos = 0;
-        }
-        
-        if (buffer_pos > 0) {
-            fwrite(buffer, 1, buffer_pos, stdout);
-        }
-        ++printed;
-    }
-    printf("\n");
-    fflush(stdout);
+// Output counts only once it reached the descriptor
+static void report_stats(run_stats* stats, bool json) {
+    output_flush(&out);
+    stats_end(stats);
+    stats->output_bytes = out.written;
+    stats_print(stderr, stats, json);
 }
 
 void cleanup() {
-    arena_drop(&temp_arena);
+    output_close(&out);
 }
 
 int main(int argc, char** argv) {
+    output_init(&out, stdout);
     atexit(cleanup);
 
     if (!setlocale(LC_CTYPE, "en_US.UTF-8")) {
@@ -343,25 +134,53 @@ int main(int argc, char** argv) {
     }
 
     if (argc < 2) {
-        print_usage(argv[0]);
+        print_usage(&out, argv[0]);
         return EXIT_FAILURE;
     }
 
     output_mode_t mode = OUTPUT_RAW;
     size_t bytes_per_line = 16;
-    const char* filename = NULL;
+    const char** paths = NULL;
+    size_t path_count = 0;
     bool search_mode = false;
     bool is_view_mode = false;
     bool counting = true;
     bool timing = false;
     bool printing = true;
     bool grep_mode = false;
-    char search_pattern[SEARCH_PATTERN_MAX_SIZE] = {0};
-    size_t search_pattern_size = 0;
+    bool caseless = false;
+    bool huge_pages = false;
+    bool stats_on = false;
+    bool stats_json = false;
+    run_stats stats = {0};
+    arena_allocator alloc = {0};
+    pattern_set patterns = pattern_set_new(&alloc);
+    dstring regex_source = dstring_new(&alloc);
+    size_t regex_count = 0;
+    engine_kind_t engine = ENGINE_AUTO;
+    ifstream_backend_t backend = IFSTREAM_MMAP;
+    size_t threads = 1;
+    const char** ignore = NULL;
+    size_t ignore_count = 0;
+    uint64_t max_size = 0;
+    uint64_t max_line = SEARCH_MAX_LINE_DEFAULT;
+    size_t before = 0;
+    size_t after = 0;
+    uint64_t offset = 0;
+    uint64_t length = 0;
+    size_t read_size = IFSTREAM_BUFFER_SIZE;
+    size_t read_depth = IFSTREAM_ASYNC_DEPTH;
+    bool build_index = false;
+    bool use_index = true;
+    bool follow = false;
+
+    // Both lists get at most one entry per argument
+    paths = arena_allocate(&alloc, (size_t)argc * sizeof(const char*), alignof(const char*));
+    ignore = arena_allocate(&alloc, (size_t)argc * sizeof(const char*), alignof(const char*));
 
     for (int i = 1; i < argc; ++i) {
         if ((strcmp(argv[i], "-h") == 0) || (strcmp(argv[i], "--help") == 0)) {
-            print_usage(argv[0]);
+            print_usage(&out, argv[0]);
             
         } if (strcmp(argv[i], "-np") == 0) {
             printing = false;
@@ -375,6 +194,22 @@ int main(int argc, char** argv) {
         } else if (strcmp(argv[i], "-g") == 0) {
             grep_mode = true;
             
+        } else if (strcmp(argv[i], "-i") == 0) {
+            caseless = true;
+            
+        } else if (strcmp(argv[i], "-F") == 0) {
+            follow = true;
+            
+        } else if (strcmp(argv[i], "--no-mmap") == 0) {
+            backend = IFSTREAM_BUFFERED;
+            
+        } else if (strcmp(argv[i], "--huge-pages") == 0) {
+            huge_pages = true;
+            
+        } else if (strcmp(argv[i], "--stats") == 0 || strcmp(argv[i], "--stats=json") == 0) {
+            stats_on = true;
+            stats_json = argv[i][7] == '=';
+            
         } else if (strcmp(argv[i], "-w") == 0) {
             if (++i >= argc) {
                 fprintf(stderr, "Missing argument for -w\n");
@@ -385,6 +220,121 @@ int main(int argc, char** argv) {
                 fprintf(stderr, "Invalid bytes per line value\n");
                 return EXIT_FAILURE;
             }
+        } else if (strcmp(argv[i], "-j") == 0) {
+            if (++i >= argc) {
+                fprintf(stderr, "Missing argument for -j\n");
+                return EXIT_FAILURE;
+            }
+            threads = strtoul(argv[i], NULL, 10);
+            if (threads == 0) threads = cpu_count();
+            if (threads > 256) {
+                fprintf(stderr, "Invalid thread count\n");
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--ignore") == 0) {
+            if (++i >= argc) {
+                fprintf(stderr, "Missing glob for --ignore\n");
+                return EXIT_FAILURE;
+            }
+            ignore[ignore_count++] = argv[i];
+
+        } else if (strcmp(argv[i], "--max-size") == 0) {
+            if (++i >= argc) {
+                fprintf(stderr, "Missing argument for --max-size\n");
+                return EXIT_FAILURE;
+            }
+            if (!parse_size(argv[i], &max_size)) {
+                fprintf(stderr, "Invalid file size: %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--offset") == 0 || strcmp(argv[i], "--length") == 0) {
+            const char* option = argv[i];
+            if (++i >= argc) {
+                fprintf(stderr, "Missing argument for %s\n", option);
+                return EXIT_FAILURE;
+            }
+            uint64_t* value = (option[2] == 'o') ? &offset : &length;
+            if (!parse_size(argv[i], value)) {
+                fprintf(stderr, "Invalid %s: %s\n", option + 2, argv[i]);
+                return EXIT_FAILURE;
+            }
+
+        } else if (strcmp(argv[i], "--read-ahead") == 0) {
+            if (++i >= argc) {
+                fprintf(stderr, "Missing argument for --read-ahead\n");
+                return EXIT_FAILURE;
+            }
+            char* end = NULL;
+            unsigned long depth = strtoul(argv[i], &end, 10);
+            if (*end != '\0' || depth < 2 || depth > IFSTREAM_ASYNC_MAX_DEPTH) {
+                fprintf(stderr, "Read-ahead depth must be 2 to %d\n", IFSTREAM_ASYNC_MAX_DEPTH);
+                return EXIT_FAILURE;
+            }
+            read_depth = (size_t)depth;
+            backend = IFSTREAM_ASYNC;
+
+        } else if (strcmp(argv[i], "--read-buffer") == 0) {
+            if (++i >= argc) {
+                fprintf(stderr, "Missing argument for --read-buffer\n");
+                return EXIT_FAILURE;
+            }
+            uint64_t size = 0;
+            if (!parse_size(argv[i], &size) || size < 4096 || size > SIZE_MAX / 2) {
+                fprintf(stderr, "Invalid read buffer size: %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+            read_size = (size_t)size;
+            backend = IFSTREAM_ASYNC;
+
+        } else if (strcmp(argv[i], "--max-line") == 0) {
+            if (++i >= argc) {
+                fprintf(stderr, "Missing argument for --max-line\n");
+                return EXIT_FAILURE;
+            }
+            if (!parse_size(argv[i], &max_line) || max_line > SIZE_MAX) {
+                fprintf(stderr, "Invalid line size: %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "-A") == 0 || strcmp(argv[i], "-B") == 0 || strcmp(argv[i], "-C") == 0) {
+            const char option = argv[i][1];
+            if (++i >= argc) {
+                fprintf(stderr, "Missing argument for -%c\n", option);
+                return EXIT_FAILURE;
+            }
+            char* end = NULL;
+            unsigned long lines = strtoul(argv[i], &end, 10);
+            if (end == argv[i] || *end != '\0' || lines > CONTEXT_MAX_LINES) {
+                fprintf(stderr, "Invalid context line count: %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+            if (option != 'A') before = (size_t)lines;
+            if (option != 'B') after = (size_t)lines;
+            grep_mode = true;
+
+        } else if (strcmp(argv[i], "--index") == 0) {
+            if (++i >= argc) {
+                fprintf(stderr, "Missing argument for --index\n");
+                return EXIT_FAILURE;
+            }
+            if (strcmp(argv[i], "build") == 0) {
+                build_index = true;
+            } else if (strcmp(argv[i], "off") == 0) {
+                use_index = false;
+            } else {
+                fprintf(stderr, "Unknown index mode: %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--engine") == 0) {
+            if (++i >= argc) {
+                fprintf(stderr, "Missing argument for --engine\n");
+                return EXIT_FAILURE;
+            }
+            bool known = false;
+            engine = parse_engine_kind(argv[i], &known);
+            if (!known) {
+                fprintf(stderr, "Unknown search engine: %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
         } else if (strcmp(argv[i], "-v") == 0) {
             if (++i >= argc) {
                 fprintf(stderr, "Missing argument for -v\n");
@@ -406,12 +356,13 @@ int main(int argc, char** argv) {
                 fprintf(stderr, "Cannot combine view and search options\n");
                 return EXIT_FAILURE;
             }
-            if (strncpy_s(search_pattern, sizeof(search_pattern), argv[i], _TRUNCATE) != 0) {
-                PRINT_ERRNO("Failed to copy search pattern");
+            size_t size = strlen(argv[i]);
+            if (size == 0) {
+                fprintf(stderr, "Empty search pattern\n");
                 return EXIT_FAILURE;
             }
-            search_pattern[sizeof(search_pattern) - 1] = '\0';
-            search_pattern_size = strlen(search_pattern);
+            if (size > SEARCH_PATTERN_MAX_SIZE - 1) size = SEARCH_PATTERN_MAX_SIZE - 1;
+            pattern_set_add(&patterns, argv[i], size, argv[i]);
             search_mode = true;
 
         } else if (strcmp(argv[i], "-x") == 0) {
@@ -419,7 +370,7 @@ int main(int argc, char** argv) {
                 fprintf(stderr, "Missing hex pattern for -x\n");
                 return EXIT_FAILURE;
             }
-            if (!parse_hex_pattern(argv[i], sizeof(search_pattern), search_pattern, &search_pattern_size)) {
+            if (!pattern_set_add_hex(&patterns, argv[i])) {
                 fprintf(stderr, "Invalid hex pattern\n");
                 return EXIT_FAILURE;
             }
@@ -428,53 +379,265 @@ int main(int argc, char** argv) {
                 return EXIT_FAILURE;
             }
             search_mode = true;
-        } else if (argv[i][0] != '-') {
-            if (!filename)
-                filename = argv[i];
+
+        } else if (strcmp(argv[i], "-f") == 0) {
+            if (++i >= argc) {
+                fprintf(stderr, "Missing pattern file for -f\n");
+                return EXIT_FAILURE;
+            }
+            if (is_view_mode) {
+                fprintf(stderr, "Cannot combine view and search options\n");
+                return EXIT_FAILURE;
+            }
+            if (!pattern_set_load_file(&patterns, argv[i])) {
+                return EXIT_FAILURE;
+            }
+            search_mode = true;
+
+        } else if (strcmp(argv[i], "-e") == 0) {
+            if (++i >= argc) {
+                fprintf(stderr, "Missing regex for -e\n");
+                return EXIT_FAILURE;
+            }
+            if (is_view_mode) {
+                fprintf(stderr, "Cannot combine view and search options\n");
+                return EXIT_FAILURE;
+            }
+            // Several expressions become alternatives of one
+            if (regex_count++ != 0) dstring_append_char(&regex_source, '|');
+            dstring_append(&regex_source, "(?:");
+            dstring_append(&regex_source, argv[i]);
+            dstring_append_char(&regex_source, ')');
+            search_mode = true;
+        } else if (argv[i][0] != '-' || argv[i][1] == '\0') {
+            paths[path_count++] = argv[i];
+        }
+    }
+
+    if (path_count == 0) {
+        print_usage(&out, argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // Several paths or a directory go through the tree search
+    const bool tree_mode = (path_count > 1) || path_is_directory(paths[0]);
+    if (build_index) {
+        if (tree_mode || search_mode || is_view_mode) {
+            fprintf(stderr, "--index build takes a single file and no other mode\n");
+            return EXIT_FAILURE;
+        }
+        bool built = trigram_index_build(paths[0], &out);
+        arena_drop(&alloc);
+        return built ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (tree_mode && !search_mode) {
+        fprintf(stderr, "View mode takes a single file\n");
+        return EXIT_FAILURE;
+    }
+    const bool windowed = offset != 0 || length != 0;
+    if (tree_mode && windowed) {
+        fprintf(stderr, "--offset and --length take a single file\n");
+        return EXIT_FAILURE;
+    }
+    if (follow && (tree_mode || !search_mode || length != 0 || strcmp(paths[0], "-") == 0)) {
+        fprintf(stderr, "-F follows a single file in search mode, without --length\n");
+        return EXIT_FAILURE;
+    }
+    // A mapping is sized once, appended bytes come through reads
+    if (follow && backend != IFSTREAM_ASYNC) backend = IFSTREAM_BUFFERED;
+
+    regex re = {0};
+    if (regex_count != 0) {
+        if (patterns.count != 0) {
+            fprintf(stderr, "Cannot combine -e with -s, -x or -f\n");
+            return EXIT_FAILURE;
+        }
+        const char* error = NULL;
+        size_t error_offset = 0;
+        if (!regex_compile(&re, &alloc, dstring_cstr(&regex_source), &error, &error_offset)) {
+            // Offsets count from the user's text, not the joined expression
+            if (regex_count == 1 && error_offset >= 3) error_offset -= 3;
+            fprintf(stderr, "Invalid regex at %zu: %s\n", error_offset, error);
+            return EXIT_FAILURE;
         }
     }
 
-    if (!filename) {
-        print_usage(argv[0]);
+    if (caseless) {
+        if (regex_count != 0) {
+            fprintf(stderr, "-i works with -s and -f patterns only\n");
+            return EXIT_FAILURE;
+        }
+        if (!pattern_set_fold_case(&patterns)) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (search_mode && patterns.count > 1 && engine != ENGINE_AUTO) {
+        // Several patterns always run through Aho-Corasick
+        fprintf(stderr, "%s\n", (caseless && patterns.source_count == 1)
+                                    ? "-i expands this pattern into case variants, --engine can't be used with it"
+                                    : "--engine works with a single pattern only");
         return EXIT_FAILURE;
     }
 
+    if (search_mode && patterns.count == 1 && (patterns.items[0].fold != NULL || patterns.items[0].mask != NULL)) {
+        // Folding and wildcards are built into the prefilter engines only
+        const search_pattern* pattern = &patterns.items[0];
+        if (engine == ENGINE_AUTO) {
+            engine = search_engine_select_caseless(pattern->size);
+        } else if (engine != ENGINE_PACKED && engine != ENGINE_RARE) {
+            fprintf(stderr, "%s with the packed and rare engines only\n",
+                    (pattern->fold != NULL) ? "-i works" : "Hex wildcards work");
+            return EXIT_FAILURE;
+        } else if (engine == ENGINE_PACKED && pattern->size > PACKED_ENGINE_MAX_SIZE) {
+            fprintf(stderr, "Packed engine supports patterns up to %d bytes\n", PACKED_ENGINE_MAX_SIZE);
+            return EXIT_FAILURE;
+        }
+    } else if (search_mode && patterns.count == 1) {
+        const search_pattern* pattern = &patterns.items[0];
+        if (engine == ENGINE_AUTO) {
+            engine = search_engine_select(pattern->data, pattern->size);
+        } else if (engine == ENGINE_PACKED && pattern->size > PACKED_ENGINE_MAX_SIZE) {
+            fprintf(stderr, "Packed engine supports patterns up to %d bytes\n", PACKED_ENGINE_MAX_SIZE);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (tree_mode) {
+        if (stats_on) stats_begin(&stats, "tree");
+        search_ctx ctx = {
+            .patterns = patterns.items,
+            .pattern_count = patterns.count,
+            .engine = engine,
+            .regex = (regex_count != 0) ? &re : NULL,
+            .labels = patterns.source_count > 1,
+            .backend = backend,
+            .read_size = read_size,
+            .read_depth = read_depth,
+            .arena = &alloc,
+            .threads = threads,
+            .timing = timing,
+            .counting = counting,
+            .printing = printing,
+            .out = &out,
+            .max_line = (size_t)max_line,
+            .before = before,
+            .after = after,
+            .huge_pages = huge_pages,
+            .stats = stats_on ? &stats : NULL,
+            .grep_mode = grep_mode,
+            .with_filename = true,
+        };
+        walk_options options = {
+            .ignore = ignore,
+            .ignore_count = ignore_count,
+            .max_size = max_size,
+        };
+
+        search_tree(&ctx, paths, path_count, &options);
+        if (stats_on) {
+            stats.arena_peak += alloc.peak;
+            report_stats(&stats, stats_json);
+        }
+        arena_drop(&alloc);
+        return EXIT_SUCCESS;
+    }
+
+    const char* filename = paths[0];
+    if (stats_on) stats_begin(&stats, search_mode ? "search" : "view");
+
+    // Candidate blocks are scattered, so the mapping skips read-ahead
+    trigram_index index = {0};
+    // The index holds exact trigrams only, and block offsets of the whole file
+    const bool index_search = search_mode && !grep_mode && regex_count == 0 && !caseless && !windowed && !follow;
+    // From --offset on, line numbers start where the index says the offset is
+    const bool indexed = use_index && (index_search || (search_mode && offset != 0)) &&
+                         trigram_index_open(&index, filename);
+    if (indexed && index_search && backend == IFSTREAM_MMAP) backend = IFSTREAM_MMAP_RANDOM;
+
     FILE* file = NULL;
-    if (fopen_s(&file, filename, "rb") != 0) {
+    const bool from_stdin = strcmp(filename, "-") == 0;
+    if (from_stdin) {
+#ifdef _WIN32
+        _setmode(_fileno(stdin), _O_BINARY);
+#endif
+        file = stdin;
+    } else if (fopen_s(&file, filename, "rb") != 0) {
         PRINT_ERRNO("Failed to open file");
         return EXIT_FAILURE;
     }
 
-    arena_allocator alloc = {0};
+    uint64_t start_line = 0;
+    uint64_t start_column = 0;
+    if (search_mode && offset != 0 &&
+        !(indexed && trigram_index_locate(&index, file, offset, &start_line, &start_column))) {
+        start_line = 0;
+        start_column = 0;
+        fprintf(stderr, "Line numbers count from --offset, build an index (--index build) for file lines\n");
+    }
+
     ifstream stream = {0};
-    ifstream_init(&stream, file);
+    ifstream_init_window(&stream, file, backend, offset, length);
+    ifstream_set_read_ahead(&stream, read_size, read_depth);
+
+    // Owns the file from here on, rotation may swap it
+    file_follower follower = {0};
+    if (follow) {
+        follower_init(&follower, filename, file);
+        follower.start = offset;
+    }
 
     if (search_mode) {
         search_ctx ctx = {
-            .pattern = search_pattern,
-            .pattern_size = search_pattern_size,
-            .pattern_utf8_len = utf8_strlen(search_pattern, search_pattern_size),
+            .patterns = patterns.items,
+            .pattern_count = patterns.count,
+            .engine = engine,
+            .regex = (regex_count != 0) ? &re : NULL,
+            .labels = patterns.source_count > 1,
             .filepath = filename,
+            .arena = &alloc,
             .line_buffer = dstring_new(&alloc),
             .stream = &stream,
-            .current_line = 0,
-            .current_char = 0,
+            .backend = backend,
+            .read_size = read_size,
+            .read_depth = read_depth,
+            .index = (indexed && index_search) ? &index : NULL,
+            .current_line = (size_t)start_line,
+            .current_char = (size_t)start_column,
+            .threads = threads,
             .timing = timing,
             .counting = counting,
             .printing = printing,
+            .out = &out,
+            .max_line = (size_t)max_line,
+            .before = before,
+            .after = after,
+            .huge_pages = huge_pages,
+            .stats = stats_on ? &stats : NULL,
+            .follow = follow ? &follower : NULL,
             .grep_mode = grep_mode,
         };
 
         search_file(&ctx);
     } else {
-        print_ctx ctx = { mode, bytes_per_line };
+        print_ctx ctx = { mode, bytes_per_line, &out };
         print_file(&ctx, &stream);
+        stats.bytes_read = stream.total_read;
+        stats.refills = stream.refills;
+        stats.files = 1;
     }
 
     ifstream_close(&stream);
-    fclose(file);
-    if (file && ferror(file)) {
-        PRINT_ERRNO("Error closing file");
+    trigram_index_close(&index);
+    if (follow) {
+        follower_close(&follower);
+    } else {
+        if (ferror(file)) PRINT_ERRNO("Error reading file");
+        if (!from_stdin && fclose(file) != 0) PRINT_ERRNO("Error closing file");
+    }
+    if (stats_on) {
+        stats.arena_peak += alloc.peak;
+        report_stats(&stats, stats_json);
     }
     arena_drop(&alloc);
 
@@ -0,0 +1,272 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE // F_SETPIPE_SZ
+#elif !defined(_WIN32) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
+
+#include <assert.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <stdio.h>
+#include <errno.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <malloc.h>
+#include <io.h>
+#else
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+
+#include "general.h"
+#include "output.h"
+
+#define OUTPUT_PAGE_SIZE (4096)
+
+static const char digit_pairs[] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+size_t format_uint(char* out, uint64_t value) {
+    assert(out != NULL);
+
+    // Two digits per division, written backwards
+    char digits[OUTPUT_UINT_MAX_SIZE];
+    size_t pos = sizeof(digits);
+    while (value >= 100) {
+        const size_t pair = (size_t)(value % 100) * 2;
+        value /= 100;
+        pos -= 2;
+        memcpy(&digits[pos], &digit_pairs[pair], 2);
+    }
+    if (value >= 10) {
+        pos -= 2;
+        memcpy(&digits[pos], &digit_pairs[value * 2], 2);
+    } else {
+        digits[--pos] = (char)('0' + value);
+    }
+
+    const size_t size = sizeof(digits) - pos;
+    memcpy(out, &digits[pos], size);
+    return size;
+}
+
+static bool output_write_fd(output_writer* out, const char* data, size_t size) {
+    const int fd = out->fd;
+    while (size != 0) {
+#ifdef _WIN32
+        unsigned chunk = (size > INT_MAX) ? INT_MAX : (unsigned)size;
+        int written = _write(fd, data, chunk);
+        if (written < 0) return false;
+#else
+        ssize_t written = write(fd, data, size);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+#endif
+        data += written;
+        size -= (size_t)written;
+        out->written += (uint64_t)written;
+    }
+    return true;
+}
+
+// Buffered bytes and data in one system call, data is not copied
+static bool output_write_direct(output_writer* out, const char* data, size_t size) {
+#ifdef _WIN32
+    return output_write_fd(out, out->buffer, out->used) && output_write_fd(out, data, size);
+#else
+    struct iovec parts[2] = {
+        { out->buffer, out->used },
+        { (void*)data, size },
+    };
+    int first = (out->used == 0) ? 1 : 0;
+    while (first < 2) {
+        ssize_t written = writev(out->fd, &parts[first], 2 - first);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+
+        // Drop what went out, a short write may stop inside either part
+        out->written += (uint64_t)written;
+        size_t left = (size_t)written;
+        while (first < 2 && left >= parts[first].iov_len) {
+            left -= parts[first].iov_len;
+            ++first;
+        }
+        if (first < 2) {
+            parts[first].iov_base = (char*)parts[first].iov_base + left;
+            parts[first].iov_len -= left;
+        }
+    }
+    return true;
+#endif
+}
+
+static void output_fail(output_writer* out) {
+    if (!out->failed) PRINT_ERRNO("Failed to write output");
+    out->failed = true;
+}
+
+void output_init(output_writer* out, FILE* file) {
+    assert(out != NULL);
+    assert(file != NULL);
+
+#ifdef _WIN32
+    const int fd = _fileno(file);
+#else
+    const int fd = fileno(file);
+#endif
+    assert(fd >= 0);
+
+    out->fd = fd;
+    out->used = 0;
+    out->written = 0;
+    out->failed = false;
+#ifdef _WIN32
+    out->buffer = _aligned_malloc(OUTPUT_BUFFER_SIZE, OUTPUT_PAGE_SIZE);
+    out->terminal = _isatty(fd) != 0;
+    out->pipe = GetFileType((HANDLE)_get_osfhandle(fd)) == FILE_TYPE_PIPE;
+#else
+    void* buffer = NULL;
+    out->buffer = (posix_memalign(&buffer, OUTPUT_PAGE_SIZE, OUTPUT_BUFFER_SIZE) == 0) ? buffer : NULL;
+    out->terminal = isatty(fd) != 0;
+    struct stat st;
+    out->pipe = fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode);
+#endif
+    assert(out->buffer != NULL && "Failed to allocate output buffer");
+
+#ifdef F_SETPIPE_SZ
+    // A pipe as big as the buffer takes a whole flush without waking the reader
+    // in between. Best effort, the limit for unprivileged users may be lower.
+    if (out->pipe) fcntl(fd, F_SETPIPE_SZ, OUTPUT_BUFFER_SIZE);
+#endif
+}
+
+void output_close(output_writer* out) {
+    assert(out != NULL);
+    if (out->buffer == NULL) return;
+
+    output_flush(out);
+#ifdef _WIN32
+    _aligned_free(out->buffer);
+#else
+    free(out->buffer);
+#endif
+    out->buffer = NULL;
+}
+
+void output_flush(output_writer* out) {
+    assert(out != NULL);
+
+    if (out->used != 0 && !out->failed && !output_write_fd(out, out->buffer, out->used)) {
+        output_fail(out);
+    }
+    out->used = 0;
+}
+
+static void output_line_flush(output_writer* out, const char* data, size_t size) {
+    if (out->terminal && memchr(data, '\n', size) != NULL) output_flush(out);
+}
+
+void output_write(output_writer* out, const char* data, size_t size) {
+    assert(out != NULL);
+    assert(data != NULL || size == 0);
+
+    if (out->failed) return;
+    if (size >= OUTPUT_DIRECT_MIN_SIZE && !out->terminal) {
+        if (!output_write_direct(out, data, size)) output_fail(out);
+        out->used = 0;
+        return;
+    }
+
+    const char* begin = data;
+    const size_t total = size;
+    while (size != 0) {
+        size_t n = OUTPUT_BUFFER_SIZE - out->used;
+        if (n > size) n = size;
+        memcpy(out->buffer + out->used, data, n);
+        out->used += n;
+        data += n;
+        size -= n;
+        if (out->used == OUTPUT_BUFFER_SIZE) output_flush(out);
+    }
+    output_line_flush(out, begin, total);
+}
+
+void output_string(output_writer* out, const char* str) {
+    assert(str != NULL);
+    output_write(out, str, strlen(str));
+}
+
+void output_char(output_writer* out, char c) {
+    assert(out != NULL);
+
+    if (out->used == OUTPUT_BUFFER_SIZE) output_flush(out);
+    out->buffer[out->used++] = c;
+    if (c == '\n' && out->terminal) output_flush(out);
+}
+
+void output_uint(output_writer* out, uint64_t value) {
+    output_commit(out, format_uint(output_reserve(out, OUTPUT_UINT_MAX_SIZE), value));
+}
+
+void output_printf(output_writer* out, const char* format, ...) {
+    assert(out != NULL);
+    assert(format != NULL);
+
+    va_list args;
+    va_start(args, format);
+    va_list retry;
+    va_copy(retry, args);
+
+    int size = vsnprintf(out->buffer + out->used, OUTPUT_BUFFER_SIZE - out->used, format, args);
+    if (size >= 0 && (size_t)size >= OUTPUT_BUFFER_SIZE - out->used) {
+        if ((size_t)size < OUTPUT_BUFFER_SIZE) {
+            output_flush(out);
+            vsnprintf(out->buffer, OUTPUT_BUFFER_SIZE, format, retry);
+        } else {
+            char* text = malloc((size_t)size + 1);
+            assert(text != NULL);
+            vsnprintf(text, (size_t)size + 1, format, retry);
+            output_write(out, text, (size_t)size);
+            free(text);
+            size = -1;
+        }
+    }
+    if (size > 0) output_commit(out, (size_t)size);
+
+    va_end(retry);
+    va_end(args);
+}
+
+char* output_reserve(output_writer* out, size_t size) {
+    assert(out != NULL);
+    assert(size <= OUTPUT_BUFFER_SIZE);
+
+    if (OUTPUT_BUFFER_SIZE - out->used < size) output_flush(out);
+    return out->buffer + out->used;
+}
+
+size_t output_available(const output_writer* out) {
+    assert(out != NULL);
+    return OUTPUT_BUFFER_SIZE - out->used;
+}
+
+void output_commit(output_writer* out, size_t size) {
+    assert(out != NULL);
+    assert(size <= OUTPUT_BUFFER_SIZE - out->used);
+
+    out->used += size;
+    output_line_flush(out, out->buffer + out->used - size, size);
+}
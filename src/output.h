@@ -0,0 +1,48 @@
+#ifndef __OUTPUT_H__
+#define __OUTPUT_H__ 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Buffered writer over the descriptor of a stdio file, replaces stdio for
+// everything the tool prints. Not thread safe, callers serialize access themselves.
+
+#define OUTPUT_BUFFER_SIZE (1024 * 1024)
+#define OUTPUT_DIRECT_MIN_SIZE (64 * 1024) // Writes this big skip the buffer
+#define OUTPUT_UINT_MAX_SIZE (20)
+
+typedef struct output_writer {
+    int fd;
+    char* buffer; // OUTPUT_BUFFER_SIZE bytes, page aligned
+    size_t used;
+    uint64_t written; // Bytes that reached the descriptor
+    bool terminal; // Flush at line ends
+    bool pipe;
+    bool failed;   // After a write error the rest of the output is dropped
+} output_writer;
+
+// Nothing may be written through file itself afterwards
+void output_init(output_writer* out, FILE* file);
+// Flushes and frees the buffer
+void output_close(output_writer* out);
+
+void output_flush(output_writer* out);
+
+void output_write(output_writer* out, const char* data, size_t size);
+void output_string(output_writer* out, const char* str);
+void output_char(output_writer* out, char c);
+void output_uint(output_writer* out, uint64_t value);
+void output_printf(output_writer* out, const char* format, ...);
+
+// Direct formatting into the buffer: reserve returns room for at least size
+// bytes (size <= OUTPUT_BUFFER_SIZE), commit takes the bytes actually written
+char* output_reserve(output_writer* out, size_t size);
+size_t output_available(const output_writer* out);
+void output_commit(output_writer* out, size_t size);
+
+// Writes decimal digits of value, returns their count (at most OUTPUT_UINT_MAX_SIZE)
+size_t format_uint(char* out, uint64_t value);
+
+#endif // __OUTPUT_H__
@@ -0,0 +1,386 @@
+#include <stdalign.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdio.h>
+
+#include "general.h"
+#include "ifstream.h"
+#include "utf8_util.h"
+#include "pattern_set.h"
+
+#define PATTERN_SET_MIN_CAPACITY 16
+
+pattern_set pattern_set_new(arena_allocator* arena) {
+    return (pattern_set) {
+        .arena = arena,
+        .items = NULL,
+        .count = 0,
+        .capacity = 0,
+        .max_size = 0,
+        .source_count = 0,
+    };
+}
+
+static int hex_digit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1; // '?'
+}
+
+// "[n]" or "[n-m]", returns the position after it or NULL
+static const char* parse_hex_gap(const char* p, hex_gap* gap) {
+    char* end = NULL;
+    if (!isdigit((unsigned char)p[1])) return NULL;
+    gap->min = strtoul(p + 1, &end, 10);
+    gap->max = gap->min;
+    if (*end == '-') {
+        if (!isdigit((unsigned char)end[1])) return NULL;
+        gap->max = strtoul(end + 1, &end, 10);
+    }
+    if (*end != ']' || gap->max < gap->min || gap->max > SEARCH_PATTERN_MAX_SIZE) return NULL;
+    return end + 1;
+}
+
+bool parse_hex_pattern(const char* str, hex_pattern* out) {
+    assert(str != NULL);
+    assert(out != NULL);
+
+    out->size = 0;
+    out->gap_count = 0;
+    const char* p = str;
+    for (;;) {
+        while (*p && !isxdigit((unsigned char)*p) && *p != '?' && *p != '[') p++;
+        if (!*p) break;
+
+        if (*p == '[') {
+            hex_gap gap = {0};
+            p = parse_hex_gap(p, &gap);
+            // A gap at the start would only move the match start
+            if (p == NULL || out->size == 0) return false;
+
+            hex_gap* last = (out->gap_count != 0) ? &out->gaps[out->gap_count - 1] : NULL;
+            if (last != NULL && last->offset == out->size) {
+                last->min += gap.min;
+                last->max += gap.max;
+            } else if (out->gap_count < HEX_PATTERN_MAX_GAPS) {
+                gap.offset = out->size;
+                out->gaps[out->gap_count++] = gap;
+            } else {
+                return false;
+            }
+            continue;
+        }
+
+        if (!isxdigit((unsigned char)p[1]) && p[1] != '?') return false;
+        if (out->size == SEARCH_PATTERN_MAX_SIZE) return false;
+
+        const int high = hex_digit(p[0]);
+        const int low = hex_digit(p[1]);
+        out->bytes[out->size] = (char)(((high < 0) ? 0 : high << 4) | ((low < 0) ? 0 : low));
+        out->mask[out->size] = (unsigned char)(((high < 0) ? 0 : 0xF0) | ((low < 0) ? 0 : 0x0F));
+        ++out->size;
+        p += 2;
+    }
+
+    // Nor at the end
+    if (out->gap_count != 0 && out->gaps[out->gap_count - 1].offset == out->size) return false;
+    return out->size > 0;
+}
+
+size_t pattern_exact_run(const search_pattern* pattern, size_t* size) {
+    assert(pattern != NULL);
+    assert(size != NULL);
+
+    if (pattern->mask == NULL) {
+        *size = pattern->size;
+        return 0;
+    }
+    size_t best = 0;
+    *size = 0;
+    for (size_t i = 0; i < pattern->size;) {
+        size_t run = 0;
+        while (i + run < pattern->size && pattern->mask[i + run] == 0xFF) ++run;
+        if (run > *size) {
+            best = i;
+            *size = run;
+        }
+        i += run + 1;
+    }
+    return best;
+}
+
+static char* pattern_set_copy(pattern_set* set, const char* data, size_t size) {
+    char* copy = arena_allocate(set->arena, size + 1, 1);
+    memcpy(copy, data, size);
+    copy[size] = '\0';
+    return copy;
+}
+
+static search_pattern* pattern_set_push(pattern_set* set, const char* data, size_t size, const char* label) {
+    if (set->count == set->capacity) {
+        size_t new_capacity = set->capacity ? set->capacity * 2 : PATTERN_SET_MIN_CAPACITY;
+        search_pattern* items = arena_allocate(set->arena, new_capacity * sizeof(search_pattern), alignof(search_pattern));
+        if (set->count > 0) {
+            memcpy(items, set->items, set->count * sizeof(search_pattern));
+        }
+        set->items = items;
+        set->capacity = new_capacity;
+    }
+
+    search_pattern* pattern = &set->items[set->count++];
+    pattern->data = pattern_set_copy(set, data, size);
+    pattern->size = size;
+    pattern->label = pattern_set_copy(set, label, strlen(label));
+    pattern->text = false;
+    pattern->fold = NULL;
+    pattern->mask = NULL;
+    pattern->source = set->source_count;
+    if (size > set->max_size) set->max_size = size;
+    return pattern;
+}
+
+void pattern_set_add(pattern_set* set, const char* data, size_t size, const char* label) {
+    assert(set != NULL);
+    assert(data != NULL);
+    assert(size != 0);
+
+    pattern_set_push(set, data, size, label)->text = true;
+    ++set->source_count;
+}
+
+bool pattern_set_add_hex(pattern_set* set, const char* hex) {
+    hex_pattern pattern;
+    if (!parse_hex_pattern(hex, &pattern)) return false;
+
+    // Candidates are found by exact bytes only
+    bool masked = pattern.gap_count != 0;
+    bool exact = false;
+    for (size_t i = 0; i < pattern.size; ++i) {
+        masked = masked || pattern.mask[i] != 0xFF;
+        exact = exact || pattern.mask[i] == 0xFF;
+    }
+    if (!exact) {
+        fprintf(stderr, "Hex pattern needs at least one byte without wildcards: %s\n", hex);
+        return false;
+    }
+
+    size_t total = 1;
+    size_t longest = pattern.size;
+    for (size_t g = 0; g < pattern.gap_count; ++g) {
+        total *= pattern.gaps[g].max - pattern.gaps[g].min + 1;
+        longest += pattern.gaps[g].max;
+        if (total > PATTERN_MAX_GAP_VARIANTS || longest > SEARCH_PATTERN_MAX_SIZE) {
+            fprintf(stderr, "Hex pattern gaps make too many or too long variants: %s\n", hex);
+            return false;
+        }
+    }
+
+    // Every combination of gap sizes, counting in mixed radix
+    char bytes[SEARCH_PATTERN_MAX_SIZE];
+    unsigned char mask[SEARCH_PATTERN_MAX_SIZE];
+    for (size_t n = 0; n < total; ++n) {
+        size_t rest = n;
+        size_t size = 0;
+        size_t g = 0;
+        for (size_t i = 0; i < pattern.size; ++i) {
+            if (g < pattern.gap_count && pattern.gaps[g].offset == i) {
+                const size_t range = pattern.gaps[g].max - pattern.gaps[g].min + 1;
+                const size_t width = pattern.gaps[g].min + rest % range;
+                rest /= range;
+                memset(bytes + size, 0, width);
+                memset(mask + size, 0, width);
+                size += width;
+                ++g;
+            }
+            bytes[size] = pattern.bytes[i];
+            mask[size] = pattern.mask[i];
+            ++size;
+        }
+        search_pattern* variant = pattern_set_push(set, bytes, size, hex);
+        if (masked) variant->mask = (const unsigned char*)pattern_set_copy(set, (const char*)mask, size);
+    }
+    ++set->source_count;
+    return true;
+}
+
+static bool pattern_set_add_line(pattern_set* set, const char* line, size_t size, const char* path, size_t line_number) {
+    while (size > 0 && line[size - 1] == '\r') --size;
+    if (size == 0) return true;
+
+    char text[SEARCH_PATTERN_MAX_SIZE * 4];
+    if (size >= sizeof(text)) {
+        fprintf(stderr, "%s:%zu: pattern is too long\n", path, line_number);
+        return false;
+    }
+    memcpy(text, line, size);
+    text[size] = '\0';
+
+    if (strncmp(text, "hex:", 4) == 0) {
+        if (!pattern_set_add_hex(set, text + 4)) {
+            fprintf(stderr, "%s:%zu: invalid hex pattern\n", path, line_number);
+            return false;
+        }
+        return true;
+    }
+    if (size > SEARCH_PATTERN_MAX_SIZE) {
+        fprintf(stderr, "%s:%zu: pattern is too long\n", path, line_number);
+        return false;
+    }
+    pattern_set_add(set, text, size, text);
+    return true;
+}
+
+bool pattern_set_load_file(pattern_set* set, const char* path) {
+    assert(set != NULL);
+    assert(path != NULL);
+
+    FILE* file = NULL;
+    if (fopen_s(&file, path, "rb") != 0) {
+        PRINT_ERRNO("Failed to open pattern file");
+        return false;
+    }
+
+    ifstream stream = {0};
+    ifstream_init(&stream, file);
+
+    // Lines may cross spans, so collect them in a scratch buffer.
+    // Anything filling it up is rejected by pattern_set_add_line as too long.
+    char line[SEARCH_PATTERN_MAX_SIZE * 4];
+    size_t line_size = 0;
+    size_t line_number = 1;
+    bool ok = true;
+
+    size_t size = 0;
+    const char* data = ifstream_peek(&stream, &size);
+    while (ok && size != 0) {
+        for (size_t i = 0; ok && i < size; ++i) {
+            if (data[i] == '\n') {
+                ok = pattern_set_add_line(set, line, line_size, path, line_number);
+                line_size = 0;
+                ++line_number;
+            } else if (line_size < sizeof(line)) {
+                line[line_size++] = data[i];
+            }
+        }
+        ifstream_consume(&stream, size);
+        data = ifstream_peek(&stream, &size);
+    }
+    if (ok && line_size > 0) {
+        ok = pattern_set_add_line(set, line, line_size, path, line_number);
+    }
+
+    ifstream_close(&stream);
+    fclose(file);
+    return ok;
+}
+
+typedef struct case_position {
+    size_t offset;
+    size_t count;
+    char bytes[UTF8_MAX_CASE_VARIANTS][4];
+} case_position;
+
+// Two cases that differ in one bit of one byte are matched with an OR of that bit
+static bool case_fold_bit(const case_position* position, size_t size, size_t* offset, unsigned char* bit) {
+    if (position->count != 2) return false;
+
+    size_t differing = 0;
+    for (size_t i = 0; i < size; ++i) {
+        unsigned char diff = (unsigned char)(position->bytes[0][i] ^ position->bytes[1][i]);
+        if (diff == 0) continue;
+        if ((diff & (diff - 1)) != 0 || differing++ != 0) return false;
+        *offset = i;
+        *bit = diff;
+    }
+    return differing == 1;
+}
+
+static bool pattern_set_add_caseless(pattern_set* set, const search_pattern* pattern) {
+    char text[SEARCH_PATTERN_MAX_SIZE];
+    unsigned char fold[SEARCH_PATTERN_MAX_SIZE] = {0};
+    case_position positions[SEARCH_PATTERN_MAX_SIZE];
+    size_t position_count = 0;
+    size_t total = 1;
+
+    assert(pattern->size <= sizeof(text));
+    memcpy(text, pattern->data, pattern->size);
+    for (size_t i = 0; i < pattern->size;) {
+        uint32_t codepoint = 0;
+        size_t char_size = utf8_decode(text + i, pattern->size - i, &codepoint);
+        if (char_size == 0) {
+            ++i; // Not UTF-8, stays as is
+            continue;
+        }
+        if (char_size == 1) {
+            if ((text[i] | 0x20) >= 'a' && (text[i] | 0x20) <= 'z') {
+                text[i] = (char)(text[i] | 0x20);
+                fold[i] = 0x20;
+            }
+            ++i;
+            continue;
+        }
+
+        uint32_t variants[UTF8_MAX_CASE_VARIANTS];
+        case_position* position = &positions[position_count];
+        position->offset = i;
+        position->count = utf8_case_variants(codepoint, variants);
+        for (size_t v = 0; v < position->count; ++v) utf8_encode(variants[v], position->bytes[v]);
+
+        size_t offset = 0;
+        unsigned char bit = 0;
+        if (case_fold_bit(position, char_size, &offset, &bit)) {
+            text[i + offset] = (char)(text[i + offset] | bit);
+            fold[i + offset] = bit;
+        } else if (position->count > 1) {
+            ++position_count;
+            total *= position->count;
+            if (total > PATTERN_MAX_CASE_VARIANTS) {
+                fprintf(stderr, "Pattern has too many case variants: %s\n", pattern->label);
+                return false;
+            }
+        }
+        i += char_size;
+    }
+    const unsigned char* shared_fold = (const unsigned char*)pattern_set_copy(set, (const char*)fold, pattern->size);
+
+    // Every combination of the remaining characters, counting in mixed radix
+    for (size_t n = 0; n < total; ++n) {
+        size_t rest = n;
+        for (size_t p = 0; p < position_count; ++p) {
+            const case_position* position = &positions[p];
+            const char* bytes = position->bytes[rest % position->count];
+            memcpy(text + position->offset, bytes, utf8_length[(unsigned char)bytes[0]]);
+            rest /= position->count;
+        }
+        search_pattern* variant = pattern_set_push(set, text, pattern->size, pattern->label);
+        variant->text = true;
+        variant->fold = shared_fold;
+        variant->source = pattern->source;
+    }
+    return true;
+}
+
+bool pattern_set_fold_case(pattern_set* set) {
+    assert(set != NULL);
+
+    const search_pattern* patterns = set->items;
+    const size_t count = set->count;
+
+    set->items = NULL;
+    set->count = 0;
+    set->capacity = 0;
+    set->max_size = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (!patterns[i].text) {
+            search_pattern* copy = pattern_set_push(set, patterns[i].data, patterns[i].size, patterns[i].label);
+            copy->mask = patterns[i].mask;
+            copy->source = patterns[i].source;
+        } else if (!pattern_set_add_caseless(set, &patterns[i])) {
+            return false;
+        }
+    }
+    return true;
+}
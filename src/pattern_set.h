@@ -0,0 +1,70 @@
+#ifndef __PATTERN_SET_H__
+#define __PATTERN_SET_H__ 1
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "arena_allocator.h"
+
+#define SEARCH_PATTERN_MAX_SIZE (256)
+#define PATTERN_MAX_CASE_VARIANTS (1024)
+#define PATTERN_MAX_GAP_VARIANTS (256)
+#define HEX_PATTERN_MAX_GAPS (16)
+
+typedef struct search_pattern {
+    const char* data;
+    size_t size;
+    const char* label; // How the pattern is shown in output
+    bool text;         // Given as text, not hex
+    const unsigned char* fold; // Caseless: bits ORed into text bytes before comparing, NULL - exact
+    const unsigned char* mask; // Hex wildcards: text bytes are ANDed with it before comparing, NULL - exact
+    size_t source;             // Index of the pattern as given, its case and gap variants share it
+} search_pattern;
+
+typedef struct hex_gap {
+    size_t offset; // Gap comes before this byte
+    size_t min;
+    size_t max;
+} hex_gap;
+
+typedef struct hex_pattern {
+    char bytes[SEARCH_PATTERN_MAX_SIZE];         // Wildcard bits are 0
+    unsigned char mask[SEARCH_PATTERN_MAX_SIZE]; // 0xFF - exact byte, 0xF0/0x0F - one nibble, 0 - any byte
+    size_t size;
+    hex_gap gaps[HEX_PATTERN_MAX_GAPS];
+    size_t gap_count;
+} hex_pattern;
+
+typedef struct pattern_set {
+    arena_allocator* arena;
+    search_pattern* items;
+    size_t count;
+    size_t capacity;
+    size_t max_size;
+    size_t source_count; // Patterns as given, case variants of one count once
+} pattern_set;
+
+pattern_set pattern_set_new(arena_allocator* arena);
+
+// Pairs of hex digits, anything else between pairs is skipped. "??" is any byte, "?" in place
+// of one digit any nibble, "[n-m]" or "[n]" any n to m bytes between two others.
+bool parse_hex_pattern(const char* str, hex_pattern* out);
+
+// Offset of the longest run of exact bytes, its size goes to *size
+size_t pattern_exact_run(const search_pattern* pattern, size_t* size);
+
+// Pattern bytes and label are copied into the set's arena
+void pattern_set_add(pattern_set* set, const char* data, size_t size, const char* label);
+// A pattern with gaps becomes one pattern per combination of gap sizes
+bool pattern_set_add_hex(pattern_set* set, const char* hex);
+
+// One text pattern per line, "hex:" prefix for hex patterns. Empty lines are skipped.
+bool pattern_set_load_file(pattern_set* set, const char* path);
+
+// Makes text patterns case-insensitive. Letters whose cases differ in a single bit
+// (ASCII, most of Latin-1, Greek and Cyrillic) get that bit set in data and fold,
+// other characters with case are expanded into one pattern per variant.
+// Returns false after printing an error when a pattern has too many variants.
+bool pattern_set_fold_case(pattern_set* set);
+
+#endif // __PATTERN_SET_H__
@@ -0,0 +1,207 @@
+#include <stdbool.h>
+#include <assert.h>
+#include <string.h>
+
+#include "prefilter.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#define PREFILTER_X86 1
+#include <immintrin.h>
+#endif
+
+#define FOLD_AT(fold, i) ((fold) ? (fold)[i] : 0)
+#define EXACT_AT(mask, i) (!(mask) || (mask)[i] == 0xFF)
+
+// Rank of each byte value by frequency in a mixed corpus of executables,
+// shared libraries, logs and text (0 - rarest, 255 - most common).
+static const unsigned char byte_frequency_rank[256] = {
+    255, 247, 217, 207, 214, 209, 185, 190, 234, 157, 215, 152, 182, 174, 225, 248,
+    224, 158, 186,  91, 136, 144,  83,  78, 203,  63,  52,  51, 109,  58,  64, 208,
+    250,  99, 111,  65, 244, 179,  36,  75, 201, 168,  82,  93, 137, 172, 205, 236,
+    204, 218, 169, 119, 133, 166, 104,  97, 188, 192, 135,  98, 125, 162,  71,  59,
+    199, 237, 195, 187, 228, 211, 145, 151, 254, 220,  94, 107, 232, 181, 171, 120,
+    198,  45, 134, 194, 193, 173, 112, 115, 141,  61, 108, 147, 155, 163,  95, 229,
+    148, 239, 210, 231, 223, 249, 227, 200, 212, 245,  80, 140, 240, 213, 233, 242,
+    238,  92, 241, 243, 251, 222, 180, 149, 191, 183,  69,  77, 164,  90,  87,  79,
+    197, 106,  43, 226, 216, 221, 102,  68, 139, 252,  22, 246, 110, 230,  70,  56,
+    177,  19,  23,  31,  74,  32,  17,  18,  88,  12,  10,   8,  38,  13,   2,  11,
+    117,   0,  15,  28,  26,   5,   9,   7,  89,  14,  25,  21,  44,   4,   1,  24,
+    113,   3,   6,  16,  54,  20, 132,  49, 143,  72, 124,  47, 100,  55, 142, 101,
+    219, 178, 127, 189, 160, 130, 159, 196, 122, 123,  62,  29,  41,  34,  39,  27,
+    156,  73, 128,  57,  37,  42,  46,  35, 131,  96,  48, 116,  30,  50,  85, 165,
+    153,  60,  81,  33,  66,  40,  76, 103, 235, 206,  84, 167, 126, 105, 114, 176,
+    146,  53, 118, 121,  67,  86, 170, 138, 175, 129, 150, 154, 161, 184, 202, 253
+};
+
+static const char* prefilter_find_scalar(const prefilter* pf, const char* p, const char* last) {
+    while (p <= last) {
+        const char* hit = memchr(p + pf->rare1_offset, pf->rare1, (size_t)(last - p) + 1);
+        if (hit == NULL) return NULL;
+
+        p = hit - pf->rare1_offset;
+        if ((unsigned char)p[pf->rare2_offset] == pf->rare2) return p;
+        ++p;
+    }
+    return NULL;
+}
+
+// Caseless kernels set the fold bit in the text, so a lowercase letter compares
+// equal to both of its cases with one OR and one compare
+static const char* prefilter_find_caseless_scalar(const prefilter* pf, const char* p, const char* last) {
+    for (; p <= last; ++p) {
+        if ((((unsigned char)p[pf->rare1_offset] | pf->fold1) == pf->rare1) &&
+            (((unsigned char)p[pf->rare2_offset] | pf->fold2) == pf->rare2)) {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+#ifdef PREFILTER_X86
+static const char* prefilter_find_sse2(const prefilter* pf, const char* p, const char* last) {
+    const __m128i rare1 = _mm_set1_epi8((char)pf->rare1);
+    const __m128i rare2 = _mm_set1_epi8((char)pf->rare2);
+
+    // 16 candidates per step, all of them <= last
+    while (last - p >= 15) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(p + pf->rare1_offset));
+        __m128i b = _mm_loadu_si128((const __m128i*)(p + pf->rare2_offset));
+        unsigned mask = (unsigned)_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(a, rare1), _mm_cmpeq_epi8(b, rare2)));
+        if (mask) return p + __builtin_ctz(mask);
+        p += 16;
+    }
+    return prefilter_find_scalar(pf, p, last);
+}
+
+__attribute__((target("avx2")))
+static const char* prefilter_find_avx2(const prefilter* pf, const char* p, const char* last) {
+    const __m256i rare1 = _mm256_set1_epi8((char)pf->rare1);
+    const __m256i rare2 = _mm256_set1_epi8((char)pf->rare2);
+
+    while (last - p >= 31) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(p + pf->rare1_offset));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(p + pf->rare2_offset));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(a, rare1), _mm256_cmpeq_epi8(b, rare2)));
+        if (mask) return p + __builtin_ctz(mask);
+        p += 32;
+    }
+    return prefilter_find_sse2(pf, p, last);
+}
+
+static const char* prefilter_find_caseless_sse2(const prefilter* pf, const char* p, const char* last) {
+    const __m128i rare1 = _mm_set1_epi8((char)pf->rare1);
+    const __m128i rare2 = _mm_set1_epi8((char)pf->rare2);
+    const __m128i fold1 = _mm_set1_epi8((char)pf->fold1);
+    const __m128i fold2 = _mm_set1_epi8((char)pf->fold2);
+
+    while (last - p >= 15) {
+        __m128i a = _mm_or_si128(_mm_loadu_si128((const __m128i*)(p + pf->rare1_offset)), fold1);
+        __m128i b = _mm_or_si128(_mm_loadu_si128((const __m128i*)(p + pf->rare2_offset)), fold2);
+        unsigned mask = (unsigned)_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(a, rare1), _mm_cmpeq_epi8(b, rare2)));
+        if (mask) return p + __builtin_ctz(mask);
+        p += 16;
+    }
+    return prefilter_find_caseless_scalar(pf, p, last);
+}
+
+__attribute__((target("avx2")))
+static const char* prefilter_find_caseless_avx2(const prefilter* pf, const char* p, const char* last) {
+    const __m256i rare1 = _mm256_set1_epi8((char)pf->rare1);
+    const __m256i rare2 = _mm256_set1_epi8((char)pf->rare2);
+    const __m256i fold1 = _mm256_set1_epi8((char)pf->fold1);
+    const __m256i fold2 = _mm256_set1_epi8((char)pf->fold2);
+
+    while (last - p >= 31) {
+        __m256i a = _mm256_or_si256(_mm256_loadu_si256((const __m256i*)(p + pf->rare1_offset)), fold1);
+        __m256i b = _mm256_or_si256(_mm256_loadu_si256((const __m256i*)(p + pf->rare2_offset)), fold2);
+        unsigned mask = (unsigned)_mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(a, rare1), _mm256_cmpeq_epi8(b, rare2)));
+        if (mask) return p + __builtin_ctz(mask);
+        p += 32;
+    }
+    return prefilter_find_caseless_sse2(pf, p, last);
+}
+#endif
+
+static prefilter_kernel prefilter_select_kernel(bool caseless) {
+#ifdef PREFILTER_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return caseless ? prefilter_find_caseless_avx2 : prefilter_find_avx2;
+    return caseless ? prefilter_find_caseless_sse2 : prefilter_find_sse2;
+#else
+    return caseless ? prefilter_find_caseless_scalar : prefilter_find_scalar;
+#endif
+}
+
+// A folded byte is as common as both of its forms, the more common one is close enough
+static unsigned char byte_rank(unsigned char c, unsigned char fold) {
+    unsigned char other = byte_frequency_rank[c & ~fold];
+    return (other > byte_frequency_rank[c]) ? other : byte_frequency_rank[c];
+}
+
+static void prefilter_setup(prefilter* pf, const char* pattern, const unsigned char* fold,
+                            const unsigned char* mask, size_t pattern_size) {
+    assert(pf != NULL);
+    assert(pattern != NULL);
+    assert(pattern_size != 0);
+
+    const unsigned char* p = (const unsigned char*)pattern;
+
+    // Wildcard positions can't be compared whole, they are never picked
+    size_t rare1 = 0;
+    while (rare1 < pattern_size && !EXACT_AT(mask, rare1)) ++rare1;
+    assert(rare1 < pattern_size && "Pattern has no exact byte");
+    for (size_t i = rare1 + 1; i < pattern_size; ++i) {
+        if (EXACT_AT(mask, i) && byte_rank(p[i], FOLD_AT(fold, i)) < byte_rank(p[rare1], FOLD_AT(fold, rare1))) rare1 = i;
+    }
+
+    // Prefer second byte with a different value, it filters much better
+    size_t rare2 = rare1;
+    for (size_t i = 0; i < pattern_size; ++i) {
+        if (i == rare1 || !EXACT_AT(mask, i)) continue;
+        if (rare2 == rare1) {
+            rare2 = i;
+            continue;
+        }
+        bool same_now = p[rare2] == p[rare1];
+        bool same_new = p[i] == p[rare1];
+        if ((same_now && !same_new) ||
+            (same_now == same_new && byte_rank(p[i], FOLD_AT(fold, i)) < byte_rank(p[rare2], FOLD_AT(fold, rare2)))) {
+            rare2 = i;
+        }
+    }
+
+    pf->pattern_size = pattern_size;
+    pf->rare1_offset = rare1;
+    pf->rare2_offset = rare2;
+    pf->rare1 = p[rare1];
+    pf->rare2 = p[rare2];
+    pf->fold1 = FOLD_AT(fold, rare1);
+    pf->fold2 = FOLD_AT(fold, rare2);
+    pf->kernel = prefilter_select_kernel(pf->fold1 != 0 || pf->fold2 != 0);
+}
+
+void prefilter_init(prefilter* pf, const char* pattern, size_t pattern_size) {
+    prefilter_setup(pf, pattern, NULL, NULL, pattern_size);
+}
+
+void prefilter_init_caseless(prefilter* pf, const char* pattern, const unsigned char* fold, size_t pattern_size) {
+    assert(fold != NULL);
+    prefilter_setup(pf, pattern, fold, NULL, pattern_size);
+}
+
+void prefilter_init_masked(prefilter* pf, const char* pattern, const unsigned char* mask, size_t pattern_size) {
+    assert(mask != NULL);
+    prefilter_setup(pf, pattern, NULL, mask, pattern_size);
+}
+
+const char* prefilter_find(const prefilter* pf, const char* begin, const char* end) {
+    assert(pf != NULL);
+    assert(begin <= end);
+
+    if ((size_t)(end - begin) < pf->pattern_size) return NULL;
+    return pf->kernel(pf, begin, end - pf->pattern_size);
+}
@@ -0,0 +1,32 @@
+#ifndef __PREFILTER_H__
+#define __PREFILTER_H__ 1
+
+#include <stddef.h>
+
+// Candidate scanner: finds positions where the two rarest bytes of a pattern
+// sit at their offsets. Full match still has to be verified by the caller.
+
+typedef struct prefilter prefilter;
+typedef const char* (*prefilter_kernel)(const prefilter*, const char* begin, const char* last);
+
+struct prefilter {
+    size_t pattern_size;
+    size_t rare1_offset;
+    size_t rare2_offset;
+    unsigned char rare1;
+    unsigned char rare2;
+    unsigned char fold1; // ORed into the text byte before comparing, caseless patterns only
+    unsigned char fold2;
+    prefilter_kernel kernel;
+};
+
+void prefilter_init(prefilter* pf, const char* pattern, size_t pattern_size);
+// Text bytes get fold[i] set before they are compared with pattern[i]
+void prefilter_init_caseless(prefilter* pf, const char* pattern, const unsigned char* fold, size_t pattern_size);
+// Rare bytes are picked where mask[i] is 0xFF, there has to be one such position
+void prefilter_init_masked(prefilter* pf, const char* pattern, const unsigned char* mask, size_t pattern_size);
+
+// Returns first candidate start in [begin, end - pattern_size] or NULL
+const char* prefilter_find(const prefilter* pf, const char* begin, const char* end);
+
+#endif // __PREFILTER_H__
@@ -0,0 +1,742 @@
+#include <stdalign.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utf8_util.h"
+#include "regex.h"
+
+#define RE_INFINITE (UINT32_MAX)
+#define RE_MAX_DEPTH (256)
+#define RE_NONE (UINT32_MAX)
+#define RE_CODEPOINT_MAX (0x10FFFF)
+
+typedef struct cp_range {
+    uint32_t lo;
+    uint32_t hi;
+} cp_range;
+
+typedef enum {
+    NODE_EMPTY,
+    NODE_CLASS,  // UTF-8 character from codepoint ranges
+    NODE_BYTES,  // single byte from byte ranges
+    NODE_CONCAT,
+    NODE_ALT,
+    NODE_REPEAT, // children[0] between min and max times
+    NODE_BOL,
+    NODE_EOL,
+} node_kind;
+
+typedef struct re_node {
+    node_kind kind;
+    cp_range* ranges;
+    size_t range_count;
+    struct re_node** children;
+    size_t child_count;
+    uint32_t min;
+    uint32_t max;
+} re_node;
+
+typedef struct range_list {
+    cp_range* items;
+    size_t count;
+    size_t capacity;
+} range_list;
+
+typedef struct node_list {
+    re_node** items;
+    size_t count;
+    size_t capacity;
+} node_list;
+
+typedef struct re_parser {
+    arena_allocator* arena;
+    const char* pattern;
+    const char* p;
+    const char* end;
+    const char* error;
+    size_t depth;
+} re_parser;
+
+typedef struct re_compiler {
+    re_inst* insts;
+    size_t count;
+    size_t capacity;
+    bool overflow;
+} re_compiler;
+
+// Parsing
+
+static re_node* node_new(re_parser* ps, node_kind kind) {
+    re_node* node = arena_allocate(ps->arena, sizeof(re_node), alignof(re_node));
+    memset(node, 0, sizeof(*node));
+    node->kind = kind;
+    return node;
+}
+
+static void range_push(re_parser* ps, range_list* list, uint32_t lo, uint32_t hi) {
+    if (list->count == list->capacity) {
+        size_t new_capacity = list->capacity ? list->capacity * 2 : 8;
+        cp_range* items = arena_allocate(ps->arena, new_capacity * sizeof(cp_range), alignof(cp_range));
+        if (list->count) memcpy(items, list->items, list->count * sizeof(cp_range));
+        list->items = items;
+        list->capacity = new_capacity;
+    }
+    list->items[list->count++] = (cp_range){ lo, hi };
+}
+
+static void node_push(re_parser* ps, node_list* list, re_node* node) {
+    if (list->count == list->capacity) {
+        size_t new_capacity = list->capacity ? list->capacity * 2 : 8;
+        re_node** items = arena_allocate(ps->arena, new_capacity * sizeof(re_node*), alignof(re_node*));
+        if (list->count) memcpy(items, list->items, list->count * sizeof(re_node*));
+        list->items = items;
+        list->capacity = new_capacity;
+    }
+    list->items[list->count++] = node;
+}
+
+static int range_compare(const void* a, const void* b) {
+    const cp_range* x = a;
+    const cp_range* y = b;
+    if (x->lo != y->lo) return (x->lo < y->lo) ? -1 : 1;
+    return (x->hi < y->hi) ? -1 : (x->hi > y->hi);
+}
+
+// Sorts and merges overlapping or touching ranges in place
+static void range_normalize(range_list* list) {
+    if (list->count < 2) return;
+    qsort(list->items, list->count, sizeof(cp_range), range_compare);
+
+    size_t out = 0;
+    for (size_t i = 1; i < list->count; ++i) {
+        cp_range* last = &list->items[out];
+        if (list->items[i].lo <= last->hi + 1) {
+            if (list->items[i].hi > last->hi) last->hi = list->items[i].hi;
+        } else {
+            list->items[++out] = list->items[i];
+        }
+    }
+    list->count = out + 1;
+}
+
+// Everything in [0, max] not covered by a normalized list
+static range_list range_complement(re_parser* ps, const range_list* list, uint32_t max) {
+    range_list result = {0};
+    uint32_t next = 0;
+    for (size_t i = 0; i < list->count; ++i) {
+        if (list->items[i].lo > next) range_push(ps, &result, next, list->items[i].lo - 1);
+        next = list->items[i].hi + 1;
+    }
+    if (next <= max) range_push(ps, &result, next, max);
+    return result;
+}
+
+static re_node* class_node(re_parser* ps, range_list* list, bool negate) {
+    range_normalize(list);
+    range_list ranges = negate ? range_complement(ps, list, RE_CODEPOINT_MAX) : *list;
+
+    // Lines never contain '\n'
+    range_list newline = { .items = NULL, .count = 0, .capacity = 0 };
+    range_push(ps, &newline, '\n', '\n');
+    range_list without = range_complement(ps, &newline, RE_CODEPOINT_MAX);
+    range_list result = {0};
+    for (size_t i = 0; i < ranges.count; ++i) {
+        for (size_t j = 0; j < without.count; ++j) {
+            uint32_t lo = (ranges.items[i].lo > without.items[j].lo) ? ranges.items[i].lo : without.items[j].lo;
+            uint32_t hi = (ranges.items[i].hi < without.items[j].hi) ? ranges.items[i].hi : without.items[j].hi;
+            if (lo <= hi) range_push(ps, &result, lo, hi);
+        }
+    }
+
+    re_node* node = node_new(ps, NODE_CLASS);
+    node->ranges = result.items;
+    node->range_count = result.count;
+    return node;
+}
+
+// ASCII sets only, as documented in regex.h
+static bool perl_class(re_parser* ps, char name, range_list* list) {
+    range_list set = {0};
+    switch (name | 0x20) {
+        case 'd':
+            range_push(ps, &set, '0', '9');
+            break;
+        case 'w':
+            range_push(ps, &set, '0', '9');
+            range_push(ps, &set, 'A', 'Z');
+            range_push(ps, &set, '_', '_');
+            range_push(ps, &set, 'a', 'z');
+            break;
+        case 's':
+            range_push(ps, &set, '\t', '\r');
+            range_push(ps, &set, ' ', ' ');
+            break;
+        default:
+            return false;
+    }
+    if (name >= 'A' && name <= 'Z') set = range_complement(ps, &set, RE_CODEPOINT_MAX);
+    for (size_t i = 0; i < set.count; ++i) range_push(ps, list, set.items[i].lo, set.items[i].hi);
+    return true;
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Single character escape after '\', *codepoint gets its value
+static bool parse_escape_char(re_parser* ps, uint32_t* codepoint) {
+    if (ps->p >= ps->end) {
+        ps->error = "trailing backslash";
+        return false;
+    }
+    char c = *ps->p++;
+    switch (c) {
+        case 'n': *codepoint = '\n'; return true;
+        case 't': *codepoint = '\t'; return true;
+        case 'r': *codepoint = '\r'; return true;
+        case 'f': *codepoint = '\f'; return true;
+        case 'v': *codepoint = '\v'; return true;
+        case '0': *codepoint = 0; return true;
+        case 'x': {
+            int high = (ps->p < ps->end) ? hex_value(ps->p[0]) : -1;
+            int low = (ps->p + 1 < ps->end) ? hex_value(ps->p[1]) : -1;
+            if (high < 0 || low < 0) {
+                ps->error = "\\x needs two hex digits";
+                return false;
+            }
+            ps->p += 2;
+            *codepoint = (uint32_t)(high * 16 + low);
+            return true;
+        }
+        default:
+            if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')) {
+                ps->error = "unsupported escape";
+                --ps->p;
+                return false;
+            }
+            *codepoint = (unsigned char)c;
+            return true;
+    }
+}
+
+static uint32_t parse_codepoint(re_parser* ps) {
+    uint32_t codepoint = 0;
+    size_t size = utf8_decode(ps->p, (size_t)(ps->end - ps->p), &codepoint);
+    if (size == 0) {
+        // Not UTF-8, take the byte as Latin-1
+        codepoint = (unsigned char)*ps->p;
+        size = 1;
+    }
+    ps->p += size;
+    return codepoint;
+}
+
+static re_node* parse_class(re_parser* ps) {
+    // ps->p is right after '['
+    bool negate = (ps->p < ps->end && *ps->p == '^');
+    if (negate) ++ps->p;
+
+    range_list list = {0};
+    bool first = true;
+    for (;;) {
+        if (ps->p >= ps->end) {
+            ps->error = "missing ]";
+            return NULL;
+        }
+        if (*ps->p == ']' && !first) {
+            ++ps->p;
+            break;
+        }
+        first = false;
+
+        uint32_t lo = 0;
+        if (*ps->p == '\\') {
+            ++ps->p;
+            if (ps->p < ps->end && perl_class(ps, *ps->p, &list)) {
+                ++ps->p;
+                continue;
+            }
+            if (!parse_escape_char(ps, &lo)) return NULL;
+        } else {
+            lo = parse_codepoint(ps);
+        }
+
+        uint32_t hi = lo;
+        if (ps->p + 1 < ps->end && ps->p[0] == '-' && ps->p[1] != ']') {
+            ++ps->p;
+            if (*ps->p == '\\') {
+                ++ps->p;
+                if (!parse_escape_char(ps, &hi)) return NULL;
+            } else {
+                hi = parse_codepoint(ps);
+            }
+            if (hi < lo) {
+                ps->error = "invalid class range";
+                return NULL;
+            }
+        }
+        range_push(ps, &list, lo, hi);
+    }
+    return class_node(ps, &list, negate);
+}
+
+static re_node* parse_alt(re_parser* ps);
+
+static re_node* parse_atom(re_parser* ps) {
+    const char c = *ps->p;
+    switch (c) {
+        case '(': {
+            ++ps->p;
+            if (ps->end - ps->p >= 2 && ps->p[0] == '?' && ps->p[1] == ':') ps->p += 2;
+            if (++ps->depth > RE_MAX_DEPTH) {
+                ps->error = "nesting is too deep";
+                return NULL;
+            }
+            re_node* inner = parse_alt(ps);
+            if (inner == NULL) return NULL;
+            if (ps->p >= ps->end || *ps->p != ')') {
+                ps->error = "missing )";
+                return NULL;
+            }
+            ++ps->p;
+            --ps->depth;
+            return inner;
+        }
+        case '[':
+            ++ps->p;
+            return parse_class(ps);
+        case '.': {
+            ++ps->p;
+            range_list none = {0};
+            return class_node(ps, &none, true);
+        }
+        case '^':
+            ++ps->p;
+            return node_new(ps, NODE_BOL);
+        case '$':
+            ++ps->p;
+            return node_new(ps, NODE_EOL);
+        case '*':
+        case '+':
+        case '?':
+            ps->error = "nothing to repeat";
+            return NULL;
+        case '\\': {
+            ++ps->p;
+            range_list list = {0};
+            if (ps->p < ps->end && perl_class(ps, *ps->p, &list)) {
+                ++ps->p;
+                return class_node(ps, &list, false);
+            }
+            const bool raw = (ps->p < ps->end && *ps->p == 'x');
+            uint32_t codepoint = 0;
+            if (!parse_escape_char(ps, &codepoint)) return NULL;
+            if (raw) {
+                re_node* node = node_new(ps, NODE_BYTES);
+                range_push(ps, &list, codepoint, codepoint);
+                node->ranges = list.items;
+                node->range_count = list.count;
+                return node;
+            }
+            range_push(ps, &list, codepoint, codepoint);
+            return class_node(ps, &list, false);
+        }
+        default: {
+            range_list list = {0};
+            uint32_t codepoint = parse_codepoint(ps);
+            range_push(ps, &list, codepoint, codepoint);
+            return class_node(ps, &list, false);
+        }
+    }
+}
+
+static bool parse_number(re_parser* ps, uint32_t* value) {
+    if (ps->p >= ps->end || *ps->p < '0' || *ps->p > '9') return false;
+    uint32_t result = 0;
+    while (ps->p < ps->end && *ps->p >= '0' && *ps->p <= '9') {
+        if (result <= RE_MAX_REPEAT) result = result * 10 + (uint32_t)(*ps->p - '0');
+        ++ps->p;
+    }
+    *value = result;
+    return true;
+}
+
+// {m}, {m,} or {m,n}; anything else leaves '{' to be read as a literal
+static bool parse_braces(re_parser* ps, uint32_t* min, uint32_t* max) {
+    const char* start = ps->p;
+    ++ps->p;
+    if (!parse_number(ps, min)) {
+        ps->p = start;
+        return false;
+    }
+    *max = *min;
+    if (ps->p < ps->end && *ps->p == ',') {
+        ++ps->p;
+        if (!parse_number(ps, max)) *max = RE_INFINITE;
+    }
+    if (ps->p >= ps->end || *ps->p != '}') {
+        ps->p = start;
+        return false;
+    }
+    ++ps->p;
+    return true;
+}
+
+static re_node* parse_repeat(re_parser* ps) {
+    re_node* node = parse_atom(ps);
+    while (node != NULL && ps->p < ps->end) {
+        uint32_t min = 0;
+        uint32_t max = 0;
+        const char* quantifier = ps->p;
+        switch (*ps->p) {
+            case '*': min = 0; max = RE_INFINITE; ++ps->p; break;
+            case '+': min = 1; max = RE_INFINITE; ++ps->p; break;
+            case '?': min = 0; max = 1; ++ps->p; break;
+            case '{':
+                if (!parse_braces(ps, &min, &max)) return node;
+                break;
+            default:
+                return node;
+        }
+        if ((max != RE_INFINITE && max < min)) {
+            ps->p = quantifier;
+            ps->error = "invalid repeat range";
+            return NULL;
+        }
+        if (min > RE_MAX_REPEAT || (max != RE_INFINITE && max > RE_MAX_REPEAT)) {
+            ps->p = quantifier;
+            ps->error = "repeat count is too large";
+            return NULL;
+        }
+
+        re_node* repeat = node_new(ps, NODE_REPEAT);
+        repeat->children = arena_allocate(ps->arena, sizeof(re_node*), alignof(re_node*));
+        repeat->children[0] = node;
+        repeat->child_count = 1;
+        repeat->min = min;
+        repeat->max = max;
+        node = repeat;
+    }
+    return node;
+}
+
+static re_node* parse_concat(re_parser* ps) {
+    node_list list = {0};
+    while (ps->p < ps->end && *ps->p != '|' && *ps->p != ')') {
+        re_node* node = parse_repeat(ps);
+        if (node == NULL) return NULL;
+        node_push(ps, &list, node);
+    }
+    if (list.count == 0) return node_new(ps, NODE_EMPTY);
+    if (list.count == 1) return list.items[0];
+
+    re_node* node = node_new(ps, NODE_CONCAT);
+    node->children = list.items;
+    node->child_count = list.count;
+    return node;
+}
+
+static re_node* parse_alt(re_parser* ps) {
+    node_list list = {0};
+    for (;;) {
+        re_node* node = parse_concat(ps);
+        if (node == NULL) return NULL;
+        node_push(ps, &list, node);
+        if (ps->p >= ps->end || *ps->p != '|') break;
+        ++ps->p;
+    }
+    if (list.count == 1) return list.items[0];
+
+    re_node* node = node_new(ps, NODE_ALT);
+    node->children = list.items;
+    node->child_count = list.count;
+    return node;
+}
+
+// Compiling. Nodes are compiled back to front: every call gets the pc that follows
+// the node and returns the pc of its entry.
+
+static uint32_t emit(re_compiler* c, re_op op, uint8_t lo, uint8_t hi, uint32_t next, uint32_t alt) {
+    if (c->count == RE_MAX_INSTS) {
+        c->overflow = true;
+        return 0;
+    }
+    if (c->count == c->capacity) {
+        size_t new_capacity = c->capacity ? c->capacity * 2 : 64;
+        re_inst* insts = realloc(c->insts, new_capacity * sizeof(re_inst));
+        assert(insts != NULL && "Failed to grow regex program");
+        c->insts = insts;
+        c->capacity = new_capacity;
+    }
+    c->insts[c->count] = (re_inst){ (uint8_t)op, lo, hi, next, alt };
+    return (uint32_t)c->count++;
+}
+
+typedef struct utf8_sequence {
+    uint8_t lo[4];
+    uint8_t hi[4];
+    size_t size;
+} utf8_sequence;
+
+typedef struct class_emit {
+    re_compiler* compiler;
+    uint32_t next;
+    uint32_t entry;
+    bool reverse;
+} class_emit;
+
+static void class_emit_sequence(class_emit* ce, const utf8_sequence* seq) {
+    uint32_t pc = ce->next;
+    for (size_t i = 0; i < seq->size; ++i) {
+        size_t at = ce->reverse ? i : seq->size - 1 - i;
+        pc = emit(ce->compiler, RE_RANGE, seq->lo[at], seq->hi[at], pc, 0);
+    }
+    ce->entry = (ce->entry == RE_NONE) ? pc : emit(ce->compiler, RE_SPLIT, 0, 0, pc, ce->entry);
+}
+
+// Splits a codepoint range into ranges whose UTF-8 forms differ only by per-byte ranges
+static void utf8_split(class_emit* ce, uint32_t lo, uint32_t hi) {
+    if (lo > hi || ce->compiler->overflow) return;
+
+    if (lo <= 0xDFFF && hi >= 0xD800) {
+        if (lo < 0xD800) utf8_split(ce, lo, 0xD7FF);
+        if (hi > 0xDFFF) utf8_split(ce, 0xE000, hi);
+        return;
+    }
+    static const uint32_t size_limits[3] = { 0x7F, 0x7FF, 0xFFFF };
+    for (size_t i = 0; i < 3; ++i) {
+        if (lo <= size_limits[i] && hi > size_limits[i]) {
+            utf8_split(ce, lo, size_limits[i]);
+            utf8_split(ce, size_limits[i] + 1, hi);
+            return;
+        }
+    }
+    for (unsigned i = 1; i < 4; ++i) {
+        uint32_t mask = (1u << (6 * i)) - 1;
+        if ((lo & ~mask) != (hi & ~mask)) {
+            if ((lo & mask) != 0) {
+                utf8_split(ce, lo, lo | mask);
+                utf8_split(ce, (lo | mask) + 1, hi);
+                return;
+            }
+            if ((hi & mask) != mask) {
+                utf8_split(ce, lo, (hi & ~mask) - 1);
+                utf8_split(ce, hi & ~mask, hi);
+                return;
+            }
+        }
+    }
+
+    char lo_bytes[4];
+    char hi_bytes[4];
+    utf8_sequence seq;
+    seq.size = utf8_encode(lo, lo_bytes);
+    utf8_encode(hi, hi_bytes);
+    for (size_t i = 0; i < seq.size; ++i) {
+        seq.lo[i] = (uint8_t)lo_bytes[i];
+        seq.hi[i] = (uint8_t)hi_bytes[i];
+    }
+    class_emit_sequence(ce, &seq);
+}
+
+static uint32_t compile_node(re_compiler* c, const re_node* node, uint32_t next, bool reverse) {
+    if (c->overflow) return 0;
+
+    switch (node->kind) {
+        case NODE_EMPTY:
+            return next;
+        case NODE_BOL:
+            return emit(c, reverse ? RE_EOL : RE_BOL, 0, 0, next, 0);
+        case NODE_EOL:
+            return emit(c, reverse ? RE_BOL : RE_EOL, 0, 0, next, 0);
+        case NODE_BYTES:
+        case NODE_CLASS: {
+            class_emit ce = { c, next, RE_NONE, reverse };
+            for (size_t i = 0; i < node->range_count; ++i) {
+                if (node->kind == NODE_BYTES) {
+                    utf8_sequence seq = { { (uint8_t)node->ranges[i].lo }, { (uint8_t)node->ranges[i].hi }, 1 };
+                    class_emit_sequence(&ce, &seq);
+                } else {
+                    utf8_split(&ce, node->ranges[i].lo, node->ranges[i].hi);
+                }
+            }
+            // Empty class: a range no byte falls into
+            return (ce.entry != RE_NONE) ? ce.entry : emit(c, RE_RANGE, 1, 0, next, 0);
+        }
+        case NODE_CONCAT: {
+            for (size_t i = 0; i < node->child_count; ++i) {
+                size_t at = reverse ? i : node->child_count - 1 - i;
+                next = compile_node(c, node->children[at], next, reverse);
+            }
+            return next;
+        }
+        case NODE_ALT: {
+            uint32_t entry = compile_node(c, node->children[node->child_count - 1], next, reverse);
+            for (size_t i = node->child_count - 1; i-- > 0;) {
+                uint32_t branch = compile_node(c, node->children[i], next, reverse);
+                entry = emit(c, RE_SPLIT, 0, 0, branch, entry);
+            }
+            return entry;
+        }
+        case NODE_REPEAT: {
+            const re_node* child = node->children[0];
+            uint32_t entry = next;
+            if (node->max == RE_INFINITE) {
+                uint32_t loop = emit(c, RE_SPLIT, 0, 0, 0, next);
+                uint32_t body = compile_node(c, child, loop, reverse);
+                if (c->overflow) return 0;
+                c->insts[loop].next = body;
+                entry = loop;
+            } else {
+                for (uint32_t i = node->min; i < node->max; ++i) {
+                    uint32_t body = compile_node(c, child, entry, reverse);
+                    entry = emit(c, RE_SPLIT, 0, 0, body, next);
+                }
+            }
+            for (uint32_t i = 0; i < node->min; ++i) {
+                entry = compile_node(c, child, entry, reverse);
+            }
+            return entry;
+        }
+    }
+    return next;
+}
+
+static bool compile_program(re_program* program, arena_allocator* arena, const re_node* root, bool reverse) {
+    re_compiler c = {0};
+    uint32_t match = emit(&c, RE_MATCH, 0, 0, 0, 0);
+    uint32_t start = compile_node(&c, root, match, reverse);
+    if (c.overflow) {
+        free(c.insts);
+        return false;
+    }
+
+    re_inst* insts = arena_allocate(arena, c.count * sizeof(re_inst), alignof(re_inst));
+    memcpy(insts, c.insts, c.count * sizeof(re_inst));
+    free(c.insts);
+
+    program->insts = insts;
+    program->count = c.count;
+    program->start = start;
+    return true;
+}
+
+// Literal prefilter: longest run of single characters every match goes through
+
+typedef struct literal_scan {
+    char run[RE_LITERAL_MAX_SIZE];
+    size_t run_size;
+    char best[RE_LITERAL_MAX_SIZE];
+    size_t best_size;
+} literal_scan;
+
+static void literal_commit(literal_scan* ls) {
+    if (ls->run_size > ls->best_size) {
+        memcpy(ls->best, ls->run, ls->run_size);
+        ls->best_size = ls->run_size;
+    }
+    ls->run_size = 0;
+}
+
+static void literal_append(literal_scan* ls, const char* bytes, size_t size) {
+    if (ls->run_size + size > sizeof(ls->run)) literal_commit(ls);
+    memcpy(ls->run + ls->run_size, bytes, size);
+    ls->run_size += size;
+}
+
+static void literal_walk(literal_scan* ls, const re_node* node) {
+    switch (node->kind) {
+        case NODE_EMPTY:
+        case NODE_BOL:
+        case NODE_EOL:
+            return;
+        case NODE_CONCAT:
+            for (size_t i = 0; i < node->child_count; ++i) literal_walk(ls, node->children[i]);
+            return;
+        case NODE_CLASS:
+            if (node->range_count == 1 && node->ranges[0].lo == node->ranges[0].hi) {
+                char bytes[4];
+                literal_append(ls, bytes, utf8_encode(node->ranges[0].lo, bytes));
+                return;
+            }
+            break;
+        case NODE_BYTES:
+            // Lines never hold '\n', a literal with it would only cost time
+            if (node->range_count == 1 && node->ranges[0].lo == node->ranges[0].hi && node->ranges[0].lo != '\n') {
+                char byte = (char)node->ranges[0].lo;
+                literal_append(ls, &byte, 1);
+                return;
+            }
+            break;
+        default:
+            break;
+    }
+    literal_commit(ls);
+}
+
+static void compute_classes(regex* re) {
+    bool boundary[257] = {0};
+    boundary['\n'] = true;
+    boundary['\n' + 1] = true;
+    for (size_t i = 0; i < re->forward.count; ++i) {
+        const re_inst* inst = &re->forward.insts[i];
+        if (inst->op != RE_RANGE) continue;
+        boundary[inst->lo] = true;
+        boundary[inst->hi + 1] = true;
+    }
+
+    size_t cls = 0;
+    re->class_bytes[0] = 0;
+    for (size_t b = 0; b < 256; ++b) {
+        if (b != 0 && boundary[b]) re->class_bytes[++cls] = (uint8_t)b;
+        re->classes[b] = (uint8_t)cls;
+    }
+    re->class_count = cls + 1;
+}
+
+bool regex_compile(regex* re, arena_allocator* arena, const char* pattern,
+                   const char** error, size_t* error_offset) {
+    assert(re != NULL);
+    assert(arena != NULL);
+    assert(pattern != NULL);
+
+    re_parser ps = {
+        .arena = arena,
+        .pattern = pattern,
+        .p = pattern,
+        .end = pattern + strlen(pattern),
+    };
+    re_node* root = parse_alt(&ps);
+    if (root != NULL && ps.p < ps.end) {
+        ps.error = "unmatched )";
+        root = NULL;
+    }
+    if (root == NULL) {
+        *error = ps.error;
+        *error_offset = (size_t)(ps.p - ps.pattern);
+        return false;
+    }
+
+    if (!compile_program(&re->forward, arena, root, false) || !compile_program(&re->reverse, arena, root, true)) {
+        *error = "regex is too large";
+        *error_offset = 0;
+        return false;
+    }
+    compute_classes(re);
+
+    literal_scan ls = {0};
+    literal_walk(&ls, root);
+    literal_commit(&ls);
+    re->literal = NULL;
+    re->literal_size = ls.best_size;
+    if (ls.best_size != 0) {
+        char* literal = arena_allocate(arena, ls.best_size, 1);
+        memcpy(literal, ls.best, ls.best_size);
+        re->literal = literal;
+    }
+    return true;
+}
@@ -0,0 +1,56 @@
+#ifndef __REGEX_H__
+#define __REGEX_H__ 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena_allocator.h"
+
+// Line-oriented regular expressions compiled to byte programs. Supported syntax:
+// literals, ., [...] and [^...] classes, \d \w \s \D \W \S, \xHH (raw byte),
+// ( ), (?: ), |, * + ? {m} {m,} {m,n}, ^ and $ at line boundaries.
+// Patterns are UTF-8; . and classes match whole UTF-8 characters, never '\n'.
+// \d \w \s are ASCII-only: non-ASCII letters and spaces match \W and \S.
+
+#define RE_MAX_INSTS (1 << 18)
+#define RE_MAX_REPEAT (1000)
+#define RE_LITERAL_MAX_SIZE (255)
+
+typedef enum {
+    RE_RANGE, // byte in [lo, hi] then next
+    RE_SPLIT, // next and alt
+    RE_BOL,   // line start then next
+    RE_EOL,   // line end then next
+    RE_MATCH,
+} re_op;
+
+typedef struct re_inst {
+    uint8_t op;
+    uint8_t lo;
+    uint8_t hi;
+    uint32_t next;
+    uint32_t alt;
+} re_inst;
+
+typedef struct re_program {
+    const re_inst* insts;
+    size_t count;
+    uint32_t start;
+} re_program;
+
+typedef struct regex {
+    re_program forward;
+    re_program reverse; // matches reversed input, ^ and $ swap roles
+    uint8_t classes[256];     // bytes no instruction tells apart share a class
+    uint8_t class_bytes[256]; // class -> one of its bytes
+    size_t class_count;
+    const char* literal;      // every match contains it, NULL if there's none
+    size_t literal_size;
+} regex;
+
+// On failure *error describes the problem found at pattern + *error_offset
+bool regex_compile(regex* re, arena_allocator* arena, const char* pattern,
+                   const char** error, size_t* error_offset);
+
+#endif // __REGEX_H__
@@ -0,0 +1,121 @@
+#if !defined(_WIN32) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE // clock_gettime, getrusage
+#endif
+
+#include <assert.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include "run_stats.h"
+
+double stats_wall_time(void) {
+#ifdef _WIN32
+    LARGE_INTEGER counter, frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+#endif
+}
+
+#ifdef _WIN32
+static double filetime_sec(FILETIME ft) {
+    ULARGE_INTEGER value;
+    value.LowPart = ft.dwLowDateTime;
+    value.HighPart = ft.dwHighDateTime;
+    return (double)value.QuadPart / 1e7; // 100 ns units
+}
+#endif
+
+double stats_cpu_time(void) {
+#ifdef _WIN32
+    FILETIME creation, exit, kernel, user;
+    if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user)) return 0;
+    return filetime_sec(kernel) + filetime_sec(user);
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+    return (double)usage.ru_utime.tv_sec + (double)usage.ru_utime.tv_usec / 1e6 +
+           (double)usage.ru_stime.tv_sec + (double)usage.ru_stime.tv_usec / 1e6;
+#endif
+}
+
+static uint64_t stats_page_faults(void) {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!K32GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+    return counters.PageFaultCount;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+    return (uint64_t)usage.ru_majflt + (uint64_t)usage.ru_minflt;
+#endif
+}
+
+void stats_begin(run_stats* stats, const char* mode) {
+    assert(stats != NULL);
+    assert(mode != NULL);
+
+    memset(stats, 0, sizeof(*stats));
+    stats->mode = mode;
+    stats->faults_start = stats_page_faults();
+    stats->cpu_start = stats_cpu_time();
+    stats->wall_start = stats_wall_time();
+}
+
+void stats_end(run_stats* stats) {
+    assert(stats != NULL);
+
+    stats->wall_sec = stats_wall_time() - stats->wall_start;
+    stats->cpu_sec = stats_cpu_time() - stats->cpu_start;
+    stats->faults = stats_page_faults() - stats->faults_start;
+}
+
+void stats_print(FILE* file, const run_stats* stats, bool json) {
+    assert(file != NULL);
+    assert(stats != NULL);
+
+    const double mb = (double)stats->bytes_read / (1024.0 * 1024.0);
+    const double throughput = (stats->wall_sec > 0) ? mb / stats->wall_sec : 0;
+    // Share of candidates that turned out to be matches
+    const double verify_ratio = (stats->candidates != 0) ? (double)stats->matches / (double)stats->candidates : 0;
+
+    if (json) {
+        fprintf(file, "{\"mode\":\"%s\",\"wall_sec\":%.6f,\"cpu_sec\":%.6f,\"bytes_read\":%llu,\"refills\":%llu,"
+                      "\"page_faults\":%llu,\"files\":%llu,\"throughput_mb_per_sec\":%.1f",
+                stats->mode, stats->wall_sec, stats->cpu_sec, (unsigned long long)stats->bytes_read,
+                (unsigned long long)stats->refills, (unsigned long long)stats->faults,
+                (unsigned long long)stats->files, throughput);
+        if (stats->searched) {
+            fprintf(file, ",\"matches\":%llu,\"candidates\":%llu,\"verify_ratio\":%.4f",
+                    (unsigned long long)stats->matches, (unsigned long long)stats->candidates, verify_ratio);
+        }
+        fprintf(file, ",\"output_bytes\":%llu,\"arena_peak_bytes\":%llu}\n",
+                (unsigned long long)stats->output_bytes, (unsigned long long)stats->arena_peak);
+        return;
+    }
+
+    fprintf(file, "Mode: %s\n", stats->mode);
+    fprintf(file, "Wall time: %.3f s\n", stats->wall_sec);
+    fprintf(file, "CPU time: %.3f s\n", stats->cpu_sec);
+    fprintf(file, "Read: %llu bytes in %llu files, %llu refills, %llu page faults\n",
+            (unsigned long long)stats->bytes_read, (unsigned long long)stats->files,
+            (unsigned long long)stats->refills, (unsigned long long)stats->faults);
+    fprintf(file, "Throughput: %.1f MB/s\n", throughput);
+    if (stats->searched) {
+        fprintf(file, "Matches: %llu of %llu candidates (%.2f%%)\n", (unsigned long long)stats->matches,
+                (unsigned long long)stats->candidates, verify_ratio * 100.0);
+    }
+    fprintf(file, "Output: %llu bytes\n", (unsigned long long)stats->output_bytes);
+    fprintf(file, "Arena peak: %llu bytes\n", (unsigned long long)stats->arena_peak);
+}
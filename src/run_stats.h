@@ -0,0 +1,38 @@
+#ifndef __RUN_STATS_H__
+#define __RUN_STATS_H__ 1
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// --stats: where a run spent its time. Counters are filled in by the stream,
+// the search loop and the writer, timing and page faults are taken around the run.
+
+typedef struct run_stats {
+    const char* mode; // "search", "tree" or "view"
+    double wall_start;
+    double cpu_start;
+    uint64_t faults_start;
+
+    double wall_sec;
+    double cpu_sec;      // All threads
+    uint64_t faults;     // Page faults, mapped input shows up here instead of refills
+    uint64_t bytes_read; // Input bytes, mapped or read
+    uint64_t refills;    // Buffered reads that returned data
+    uint64_t files;
+    bool searched;       // Candidates and matches are valid
+    uint64_t candidates; // Positions or lines checked against the whole pattern
+    uint64_t matches;
+    uint64_t output_bytes;
+    uint64_t arena_peak; // Sum of the arena peaks
+} run_stats;
+
+double stats_wall_time(void);
+// Process CPU time, all threads together
+double stats_cpu_time(void);
+
+void stats_begin(run_stats* stats, const char* mode);
+void stats_end(run_stats* stats);
+void stats_print(FILE* file, const run_stats* stats, bool json);
+
+#endif // __RUN_STATS_H__
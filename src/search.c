@@ -0,0 +1,1426 @@
+#include <stdalign.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+
+#include "arena_allocator.h"
+#include "aho_corasick.h"
+#include "general.h"
+#include "lazy_dfa.h"
+#include "thread.h"
+#include "work_pool.h"
+#include "search.h"
+#include "text_count.h"
+
+#define PARALLEL_MIN_CHUNK_SIZE (1024 * 1024)
+#define PARALLEL_MAX_CHUNK_SIZE (16 * 1024 * 1024)
+#define PARALLEL_CHUNKS_PER_THREAD (4)
+#define MATCH_PAGE_SIZE (1024)
+#define HIT_LIST_MIN_CAPACITY (256)
+#define TREE_MMAP_MIN_SIZE (256 * 1024)
+
+typedef struct search_state {
+    size_t line_number;
+    size_t char_in_line;
+    size_t counter;
+    size_t candidates;
+    bool match_this_line;
+    const char* line_start; // Grep mode: the current line goes on from here, its head is in ctx->line_buffer
+    struct context_ring* context; // NULL - no context lines
+    bool restart; // Follow mode: the file was replaced, it is searched again from its start
+} search_state;
+
+typedef struct search_matcher {
+    const search_pattern* patterns;
+    size_t pattern_count;
+    size_t max_size;
+    bool multi;
+    search_engine engine;
+    ac_automaton automaton;
+    const search_pattern* anchors; // What the automaton looks for: the exact run of a masked pattern
+    bool dedupe;        // Gap variants of one pattern may match at one start, it counts once
+    const regex* regex; // Every thread runs its own regex_matcher
+    size_t dfa_states;  // Filled in after a regex search
+    size_t dfa_flushes;
+} search_matcher;
+
+typedef struct search_hit {
+    size_t offset; // Stream offset of match start
+    size_t pattern;
+} search_hit;
+
+typedef struct hit_list {
+    search_hit* items;
+    size_t count;
+    size_t capacity;
+} hit_list;
+
+typedef struct hit_collector {
+    const search_matcher* matcher;
+    const char* begin;
+    const char* min_end;   // Matches ending before it were found with the previous span
+    const char* max_start; // Matches starting at or after it belong to the next chunk
+    const char* end;       // Scan end, a masked pattern around its anchor has to fit before it
+    size_t base_offset;    // Stream offset of begin
+    hit_list* hits;        // NULL - count only
+    size_t counter;
+    size_t candidates;     // Positions verified against a whole pattern
+} hit_collector;
+
+static void hit_list_push(hit_list* list, search_hit hit) {
+    if (list->count == list->capacity) {
+        size_t new_capacity = list->capacity ? list->capacity * 2 : HIT_LIST_MIN_CAPACITY;
+        search_hit* items = realloc(list->items, new_capacity * sizeof(search_hit));
+        assert(items != NULL && "Failed to grow hit list");
+        list->items = items;
+        list->capacity = new_capacity;
+    }
+    list->items[list->count++] = hit;
+}
+
+static void hit_list_free(hit_list* list) {
+    free(list->items);
+    list->items = NULL;
+    list->count = 0;
+    list->capacity = 0;
+}
+
+static int hit_compare(const void* a, const void* b) {
+    const search_hit* x = a;
+    const search_hit* y = b;
+    if (x->offset != y->offset) return (x->offset < y->offset) ? -1 : 1;
+    if (x->pattern != y->pattern) return (x->pattern < y->pattern) ? -1 : 1;
+    return 0;
+}
+
+static void collect_hit(hit_collector* collector, const char* start, size_t pattern) {
+    if (start + collector->matcher->patterns[pattern].size <= collector->min_end) return;
+    if (start >= collector->max_start) return;
+
+    ++collector->counter;
+    if (collector->hits != NULL) {
+        search_hit hit = { collector->base_offset + (size_t)(start - collector->begin), pattern };
+        hit_list_push(collector->hits, hit);
+    }
+}
+
+static void collect_ac_match(void* user, const char* match_end, uint32_t pattern) {
+    hit_collector* collector = user;
+    const search_pattern* p = &collector->matcher->patterns[pattern];
+    const search_pattern* anchor = &collector->matcher->anchors[pattern];
+    const size_t lead = (size_t)(anchor->data - p->data);
+    ++collector->candidates;
+
+    // The anchor of a masked pattern is only a part of it, the rest is checked here
+    if (p->mask != NULL) {
+        if ((size_t)(match_end - collector->begin) < anchor->size + lead) return;
+        const char* start = match_end - anchor->size - lead;
+        if ((size_t)(collector->end - start) < p->size || !masked_equal(start, p->data, p->mask, p->size)) return;
+        collect_hit(collector, start, pattern);
+        return;
+    }
+
+    const char* start = match_end - p->size;
+    // A folding automaton merges byte classes, so every match is checked here
+    if (collector->matcher->automaton.fold) {
+        if (p->fold != NULL ? !folded_equal(start, p->data, p->fold, p->size) : memcmp(start, p->data, p->size) != 0) return;
+    }
+    collect_hit(collector, start, pattern);
+}
+
+// Collects matches lying completely inside [collector->begin, end)
+static void matcher_collect(hit_collector* collector, const char* end) {
+    const search_matcher* matcher = collector->matcher;
+    collector->end = end;
+
+    if (matcher->multi) {
+        // Automaton reports by match end, hits have to be sorted by start afterwards
+        ac_scan(&matcher->automaton, collector->begin, end, collect_ac_match, collector);
+        return;
+    }
+
+    const char* hit = collector->begin;
+    while ((hit = search_engine_find_counted(&matcher->engine, hit, end, &collector->candidates)) != NULL) {
+        collect_hit(collector, hit, 0);
+        ++hit;
+    }
+}
+
+// Gap variants of one pattern that matched at one start are dropped but the first,
+// the counter goes down with them
+static void matcher_sort(hit_collector* collector) {
+    const search_matcher* matcher = collector->matcher;
+    hit_list* hits = collector->hits;
+    if (!matcher->multi || hits == NULL || hits->count < 2) return;
+
+    qsort(hits->items, hits->count, sizeof(search_hit), hit_compare);
+    if (!matcher->dedupe) return;
+
+    // Variants of a pattern are neighbours, so they sort next to each other
+    size_t kept = 1;
+    for (size_t i = 1; i < hits->count; ++i) {
+        const search_hit* last = &hits->items[kept - 1];
+        if (hits->items[i].offset == last->offset &&
+            matcher->patterns[hits->items[i].pattern].source == matcher->patterns[last->pattern].source) {
+            --collector->counter;
+            continue;
+        }
+        hits->items[kept++] = hits->items[i];
+    }
+    hits->count = kept;
+}
+
+static size_t count_chars(const char* from, const char* to) {
+    return count_utf8_chars(from, (size_t)(to - from));
+}
+
+static void search_write(const search_ctx* ctx, const char* data, size_t size) {
+    if (ctx->output != NULL) {
+        dstring_append_n(ctx->output, data, size);
+    } else {
+        output_write(ctx->out, data, size);
+    }
+}
+
+static void search_write_number(const search_ctx* ctx, size_t value) {
+    char digits[OUTPUT_UINT_MAX_SIZE];
+    search_write(ctx, digits, format_uint(digits, value));
+}
+
+// Grep mode line from two pieces, the head spilled from earlier spans and the
+// rest. Both are cut at ctx->max_line together. Separator is ':' for matching
+// lines and '-' for context lines.
+static void search_print_line_parts(const search_ctx* ctx, size_t line_number, char separator,
+                                    const char* head, size_t head_size, const char* line, size_t size) {
+    if (ctx->max_line != 0) {
+        if (head_size > ctx->max_line) head_size = ctx->max_line;
+        if (size > ctx->max_line - head_size) size = ctx->max_line - head_size;
+    }
+    if (ctx->with_filename) {
+        search_write(ctx, ctx->filepath, strlen(ctx->filepath));
+        search_write(ctx, &separator, 1);
+    }
+    search_write_number(ctx, line_number + 1);
+    search_write(ctx, &separator, 1);
+    search_write(ctx, head, head_size);
+    search_write(ctx, line, size);
+    search_write(ctx, "\n", 1);
+}
+
+static void search_print_line(const search_ctx* ctx, size_t line_number, const char* line, size_t size) {
+    search_print_line_parts(ctx, line_number, ':', NULL, 0, line, size);
+}
+
+static void search_print_match(const search_ctx* ctx, size_t line_number, size_t column, size_t pattern) {
+    search_write(ctx, ctx->filepath, strlen(ctx->filepath));
+    search_write(ctx, ":", 1);
+    search_write_number(ctx, line_number + 1);
+    search_write(ctx, ":", 1);
+    search_write_number(ctx, column + 1);
+    if (ctx->labels) {
+        const char* label = ctx->patterns[pattern].label;
+        search_write(ctx, ":", 1);
+        search_write(ctx, label, strlen(label));
+    }
+    search_write(ctx, "\n", 1);
+}
+
+// Context lines (-A/-B/-C). Lines before a match wait in a ring as pointers
+// into the window being searched. Only when the window is about to go away
+// (a buffer refill, the end of a regex region) are the ring lines copied into
+// a spill buffer, so mapped files never copy anything.
+
+#define CONTEXT_MAX_SPILL (64 * 1024 * 1024)
+#define CONTEXT_MIN_COMPACT (64 * 1024)
+
+typedef struct context_line {
+    const char* text; // NULL - the line is in the active spill buffer at offset
+    size_t offset;
+    size_t size;
+} context_line;
+
+typedef struct context_ring {
+    context_line* lines; // ctx->before slots
+    size_t first;        // Oldest line
+    size_t count;        // Lines right before the current one, none of them printed yet
+    dstring spill[2];    // Active one and the one the next compaction goes to
+    size_t active;
+    size_t after_left;   // After-context lines still to print
+    size_t last_printed; // Line number of the last printed line
+    bool printed_any;
+} context_ring;
+
+static bool context_wanted(const search_ctx* ctx) {
+    return ctx->grep_mode && ctx->printing && (ctx->before != 0 || ctx->after != 0);
+}
+
+// Ready for the next stream, the buffers stay allocated
+static void context_reset(context_ring* ring) {
+    ring->first = 0;
+    ring->count = 0;
+    dstring_clear(&ring->spill[0]);
+    dstring_clear(&ring->spill[1]);
+    ring->active = 0;
+    ring->after_left = 0;
+    ring->last_printed = 0;
+    ring->printed_any = false;
+}
+
+static void context_init(context_ring* ring, const search_ctx* ctx) {
+    ring->lines = (ctx->before != 0) ? malloc(ctx->before * sizeof(context_line)) : NULL;
+    assert(ring->lines != NULL || ctx->before == 0);
+    ring->spill[0] = dstring_new(ctx->arena);
+    ring->spill[1] = dstring_new(ctx->arena);
+    context_reset(ring);
+}
+
+static void context_free(context_ring* ring) {
+    free(ring->lines);
+    ring->lines = NULL;
+}
+
+static const char* context_text(const context_ring* ring, const context_line* line) {
+    return line->text ? line->text : dstring_cstr(&ring->spill[ring->active]) + line->offset;
+}
+
+static void context_print(const search_ctx* ctx, context_ring* ring, size_t line_number, char separator,
+                          const char* head, size_t head_size, const char* line, size_t size) {
+    // Groups that don't touch are split like grep does
+    if (ring->printed_any && line_number > ring->last_printed + 1) search_write(ctx, "--\n", 3);
+    search_print_line_parts(ctx, line_number, separator, head, head_size, line, size);
+    ring->last_printed = line_number;
+    ring->printed_any = true;
+}
+
+// Prints the waiting lines before a match on line_number
+static void context_print_before(const search_ctx* ctx, context_ring* ring, size_t line_number) {
+    for (size_t i = 0; i < ring->count; ++i) {
+        const context_line* line = &ring->lines[(ring->first + i) % ctx->before];
+        context_print(ctx, ring, line_number - ring->count + i, '-', NULL, 0, context_text(ring, line), line->size);
+    }
+    ring->count = 0;
+}
+
+static void context_push(const search_ctx* ctx, context_ring* ring, const char* line, size_t size) {
+    if (ctx->before == 0) return;
+
+    context_line entry = { line, 0, size };
+    if (!dstring_empty(&ctx->line_buffer)) {
+        // The head crossed a refill, both pieces go to the spill buffer
+        dstring* spill = &ring->spill[ring->active];
+        const size_t head_size = dstring_length(&ctx->line_buffer);
+        if (ctx->max_line != 0 && size > ctx->max_line - head_size) size = ctx->max_line - head_size;
+        entry.text = NULL;
+        entry.offset = dstring_length(spill);
+        entry.size = head_size + size;
+        dstring_append_n(spill, dstring_cstr(&ctx->line_buffer), head_size);
+        dstring_append_n(spill, line, size);
+    }
+
+    if (ring->count == ctx->before) {
+        ring->first = (ring->first + 1) % ctx->before;
+        --ring->count;
+    }
+    ring->lines[(ring->first + ring->count) % ctx->before] = entry;
+    ++ring->count;
+}
+
+// The window under the ring lines goes away, so they move to the spill buffer.
+// The newest ones are kept first, within CONTEXT_MAX_SPILL bytes. Lines spilled
+// earlier stay where they are until dead bytes outweigh the live ones, then
+// the survivors are compacted into the other buffer.
+static void context_spill(const search_ctx* ctx, context_ring* ring) {
+    dstring* active = &ring->spill[ring->active];
+    if (ring->count == 0) {
+        dstring_clear(active);
+        return;
+    }
+
+    size_t keep = 0;
+    size_t total = 0;
+    while (keep < ring->count) {
+        const context_line* line = &ring->lines[(ring->first + ring->count - 1 - keep) % ctx->before];
+        size_t size = (ctx->max_line != 0 && line->size > ctx->max_line) ? ctx->max_line : line->size;
+        if (total + size > CONTEXT_MAX_SPILL) break;
+        total += size;
+        ++keep;
+    }
+    ring->first = (ring->first + ring->count - keep) % ctx->before;
+    ring->count = keep;
+
+    const bool compact = dstring_length(active) > 2 * total + CONTEXT_MIN_COMPACT;
+    dstring* target = compact ? &ring->spill[1 - ring->active] : active;
+    if (compact) dstring_clear(target);
+    for (size_t i = 0; i < ring->count; ++i) {
+        context_line* line = &ring->lines[(ring->first + i) % ctx->before];
+        if (line->text == NULL && !compact) continue;
+
+        if (ctx->max_line != 0 && line->size > ctx->max_line) line->size = ctx->max_line;
+        const size_t offset = dstring_length(target);
+        dstring_append_n(target, context_text(ring, line), line->size);
+        line->text = NULL;
+        line->offset = offset;
+    }
+    if (compact) {
+        dstring_clear(active);
+        ring->active = 1 - ring->active;
+    }
+}
+
+static void context_end_line(search_ctx* ctx, search_state* state, const char* line_end) {
+    context_ring* ring = state->context;
+    const char* head = dstring_cstr(&ctx->line_buffer);
+    const size_t head_size = dstring_length(&ctx->line_buffer);
+    const size_t size = (size_t)(line_end - state->line_start);
+
+    if (state->match_this_line) {
+        context_print_before(ctx, ring, state->line_number);
+        context_print(ctx, ring, state->line_number, ':', head, head_size, state->line_start, size);
+        ring->after_left = ctx->after;
+    } else if (ring->after_left != 0) {
+        context_print(ctx, ring, state->line_number, '-', head, head_size, state->line_start, size);
+        --ring->after_left;
+    } else {
+        context_push(ctx, ring, state->line_start, size);
+    }
+}
+
+// Lines in [from, to) have no match. Outside after-context only the last
+// ctx->before of them can be printed, everything before those is skipped.
+// Returns where line by line tracking goes on.
+static const char* context_skip(search_ctx* ctx, search_state* state, const char* from, const char* to) {
+    context_ring* ring = state->context;
+    if (ring->after_left != 0) return from;
+
+    const char* last = find_last_newline(from, (size_t)(to - from));
+    if (last == NULL) return from;
+
+    const size_t lines = count_newlines(from, (size_t)(last - from)) + 1;
+    if (lines <= ctx->before) return from;
+
+    const char* start = last;
+    for (size_t i = 0; i < ctx->before; ++i) {
+        start = find_last_newline(from, (size_t)(start - from));
+    }
+    ring->count = 0;
+    state->line_number += lines - ctx->before;
+    state->line_start = start + 1;
+    return start + 1;
+}
+
+// line_end is the newline or the end of the stream
+static void search_end_line(search_ctx* ctx, search_state* state, const char* line_end) {
+    if (ctx->grep_mode && ctx->printing) {
+        if (state->context != NULL) {
+            context_end_line(ctx, state, line_end);
+        } else if (state->match_this_line) {
+            search_print_line_parts(ctx, state->line_number, ':', dstring_cstr(&ctx->line_buffer),
+                                    dstring_length(&ctx->line_buffer), state->line_start,
+                                    (size_t)(line_end - state->line_start));
+        }
+        dstring_clear(&ctx->line_buffer);
+    }
+    state->char_in_line = 0;
+    state->match_this_line = false;
+    ++state->line_number;
+}
+
+// Grep mode: the open line is about to leave the stream buffer, so its bytes up
+// to end are copied to ctx->line_buffer (at most ctx->max_line of them)
+static void search_spill_line(search_ctx* ctx, search_state* state, const char* end) {
+    if (!ctx->grep_mode || !ctx->printing) return;
+
+    size_t size = (size_t)(end - state->line_start);
+    if (ctx->max_line != 0) {
+        const size_t spilled = dstring_length(&ctx->line_buffer);
+        const size_t room = (spilled < ctx->max_line) ? ctx->max_line - spilled : 0;
+        if (size > room) size = room;
+    }
+    if (size != 0) dstring_append_n(&ctx->line_buffer, state->line_start, size);
+    state->line_start = end;
+}
+
+// Move line/column tracking over [from, to). Positions only show up in printed
+// matches, so nothing is counted without printing. Lines in between are skipped
+// in bulk: outside grep mode only the last one is counted for the column, grep
+// mode prints the line that is ending straight from the span.
+static void search_advance(search_ctx* ctx, search_state* state, const char* from, const char* to) {
+    if (!ctx->printing || from >= to) return;
+
+    if (!ctx->grep_mode) {
+        const char* newline = find_last_newline(from, (size_t)(to - from));
+        if (newline == NULL) {
+            state->char_in_line += count_chars(from, to);
+            return;
+        }
+        state->line_number += count_newlines(from, (size_t)(newline - from)) + 1;
+        state->char_in_line = count_chars(newline + 1, to);
+        state->match_this_line = false;
+        return;
+    }
+
+    if (state->context != NULL) {
+        // Every line near a match counts, so lines are walked one by one there
+        while (from < to) {
+            const char* newline = memchr(from, '\n', (size_t)(to - from));
+            if (newline == NULL) return;
+            search_end_line(ctx, state, newline);
+            state->line_start = newline + 1;
+            from = context_skip(ctx, state, newline + 1, to);
+        }
+        return;
+    }
+
+    const char* newline = memchr(from, '\n', (size_t)(to - from));
+    if (newline == NULL) return;
+    search_end_line(ctx, state, newline);
+
+    const char* last = find_last_newline(newline + 1, (size_t)(to - newline - 1));
+    if (last != NULL) {
+        state->line_number += count_newlines(newline + 1, (size_t)(last - newline - 1)) + 1;
+        newline = last;
+    }
+    state->line_start = newline + 1;
+}
+
+// Reports hits starting before release and keeps the rest for the next span.
+// Returns new tracked position.
+static const char* search_report_hits(search_ctx* ctx, search_state* state, hit_list* hits,
+                                      const char* begin, size_t begin_offset, const char* release) {
+    const char* position = begin;
+    size_t i = 0;
+    for (; i < hits->count; ++i) {
+        const char* hit = begin + (hits->items[i].offset - begin_offset);
+        if (hit >= release) break;
+
+        search_advance(ctx, state, position, hit);
+        position = hit;
+
+        state->match_this_line = true;
+        if (ctx->printing && !ctx->grep_mode) {
+            search_print_match(ctx, state->line_number, state->char_in_line, hits->items[i].pattern);
+        }
+    }
+    if (i != 0) {
+        memmove(hits->items, hits->items + i, (hits->count - i) * sizeof(search_hit));
+        hits->count -= i;
+    }
+    return position;
+}
+
+// Follow mode: at the end of the stream waits for appended bytes. Returns true once there are
+// some to peek, false at the real end or when the file was replaced (state->restart).
+static bool search_follow(search_ctx* ctx, search_state* state) {
+    if (ctx->follow == NULL) return false;
+
+    for (;;) {
+        // Whatever was found so far goes out before the wait
+        output_flush(ctx->out);
+        if (follower_wait(ctx->follow, ctx->stream->total_read) == FOLLOW_REPLACED) {
+            state->restart = true;
+            return false;
+        }
+        if (!ifstream_resume(ctx->stream)) return false;
+
+        size_t size = 0;
+        ifstream_peek(ctx->stream, &size);
+        if (size != 0) return true;
+    }
+}
+
+// Follow mode, before the wait: lines completed in the kept tail [begin, end) are reported
+// now rather than with the next append. Hits after the last newline stay for the next span,
+// a match crossing into appended bytes starts there. Returns the offset tracking got to.
+static size_t search_settle_tail(search_ctx* ctx, search_state* state, hit_list* hits,
+                                 const char* begin, size_t begin_offset, const char* end) {
+    const char* newline = find_last_newline(begin, (size_t)(end - begin));
+    if (newline == NULL) return begin_offset;
+
+    // The refill at the end may have slid the tail to the front of the buffer
+    state->line_start = begin;
+    const char* release = newline + 1;
+    const char* position = search_report_hits(ctx, state, hits, begin, begin_offset, release);
+    search_advance(ctx, state, position, release);
+    search_spill_line(ctx, state, release);
+    if (state->context != NULL) context_spill(ctx, state->context);
+    return begin_offset + (size_t)(release - begin);
+}
+
+static void search_serial(search_ctx* ctx, const search_matcher* matcher, search_state* state) {
+    // Stream keeps max_size - 1 bytes of previous span, so matches crossing spans are found
+    const size_t tail_size = matcher->max_size - 1;
+    ifstream_retain(ctx->stream, tail_size);
+
+    hit_list hits = {0};
+    size_t data_offset = 0;
+    size_t tracked = 0; // Follow mode may track lines into the kept tail before it is scanned again
+    size_t size = 0;
+    const char* data = ifstream_peek(ctx->stream, &size);
+    if (size == 0 && search_follow(ctx, state)) data = ifstream_peek(ctx->stream, &size);
+    while (size != 0) {
+        size_t back = ifstream_retained(ctx->stream);
+        if (back > tail_size) back = tail_size;
+
+        // Everything before begin was tracked with the previous span
+        const char* begin = data - back;
+        const char* end = data + size;
+        const size_t begin_offset = data_offset - back;
+        const size_t skip = (tracked > begin_offset) ? tracked - begin_offset : 0;
+        state->line_start = begin + skip;
+
+        hit_collector collector = {
+            .matcher = matcher,
+            .begin = begin,
+            .min_end = data,
+            .max_start = end,
+            .base_offset = begin_offset,
+            .hits = (ctx->printing || matcher->dedupe) ? &hits : NULL,
+        };
+        matcher_collect(&collector, end);
+        matcher_sort(&collector);
+        state->counter += collector.counter;
+        state->candidates += collector.candidates;
+
+        // Later matches end after this span, so none of them starts before release
+        size_t keep = ((size_t)(end - begin) < tail_size) ? (size_t)(end - begin) : tail_size;
+        const char* release = end - keep;
+        if (release < state->line_start) release = state->line_start;
+        const char* position = search_report_hits(ctx, state, &hits, begin + skip, begin_offset + skip, release);
+        search_advance(ctx, state, position, release);
+        search_spill_line(ctx, state, release);
+        if (state->context != NULL && !ctx->stream->mapped) context_spill(ctx, state->context);
+
+        ifstream_consume(ctx->stream, size);
+        data_offset += size;
+        data = ifstream_peek(ctx->stream, &size);
+        if (size == 0 && ctx->follow != NULL) {
+            back = ifstream_retained(ctx->stream);
+            if (back > tail_size) back = tail_size;
+            const size_t from = (tracked > data_offset - back) ? tracked : data_offset - back;
+            tracked = search_settle_tail(ctx, state, &hits, data - (data_offset - from), from, data);
+            if (search_follow(ctx, state)) data = ifstream_peek(ctx->stream, &size);
+        }
+    }
+    size_t back = ifstream_retained(ctx->stream);
+    if (back > tail_size) back = tail_size;
+    const size_t begin_offset = data_offset - back;
+    const size_t skip = (tracked > begin_offset) ? tracked - begin_offset : 0;
+    state->line_start = data - back + skip;
+    const char* position = search_report_hits(ctx, state, &hits, data - back + skip, begin_offset + skip, data);
+    search_advance(ctx, state, position, data);
+
+    // With context an unterminated last line may still be printed as after-context
+    const bool open_line = state->context != NULL &&
+                           (state->line_start < data || !dstring_empty(&ctx->line_buffer));
+    if (state->char_in_line != 0 || state->match_this_line || open_line) {
+        search_end_line(ctx, state, data);
+    }
+    hit_list_free(&hits);
+}
+
+// Regex matches never cross lines, so regions always start and end with a whole line.
+// Only the last region of a stream may lack the final newline.
+static void search_regex_region(search_ctx* ctx, regex_matcher* m, search_state* state,
+                                const char* begin, const char* end) {
+    regex_matcher_reset(m);
+    state->line_start = begin;
+
+    const char* position = begin;
+    const char* from = begin;
+    const char* match_begin = NULL;
+    const char* match_end = NULL;
+    while (regex_find(m, from, end, &match_begin, &match_end)) {
+        ++state->counter;
+        search_advance(ctx, state, position, match_begin);
+        position = match_begin;
+
+        state->match_this_line = true;
+        if (ctx->printing && !ctx->grep_mode) {
+            search_print_match(ctx, state->line_number, state->char_in_line, 0);
+        }
+
+        from = match_end;
+        if (ctx->grep_mode && !ctx->counting) {
+            // The line gets printed once, the rest of it doesn't matter
+            const char* newline = memchr(match_end, '\n', (size_t)(end - match_end));
+            from = newline ? newline + 1 : end;
+        }
+    }
+    search_advance(ctx, state, position, end);
+    if (end[-1] != '\n' && (state->match_this_line || state->context != NULL)) {
+        search_end_line(ctx, state, end);
+    }
+}
+
+// Whole lines are searched straight in the stream buffer, a line split between
+// spans is glued together in carry first
+static void search_regex_serial(search_ctx* ctx, regex_matcher* m, search_state* state, dstring* carry) {
+    dstring_clear(carry);
+
+    size_t size = 0;
+    const char* data = ifstream_peek(ctx->stream, &size);
+    if (size == 0 && search_follow(ctx, state)) data = ifstream_peek(ctx->stream, &size);
+    while (size != 0) {
+        const char* begin = data;
+        const char* end = data + size;
+
+        if (!dstring_empty(carry)) {
+            const char* newline = memchr(begin, '\n', size);
+            const char* split = newline ? newline + 1 : end;
+            dstring_append_n(carry, begin, (size_t)(split - begin));
+            if (newline != NULL) {
+                search_regex_region(ctx, m, state, dstring_cstr(carry), dstring_cstr(carry) + dstring_length(carry));
+                if (state->context != NULL) context_spill(ctx, state->context);
+                dstring_clear(carry);
+            }
+            begin = split;
+        }
+
+        const char* last_newline = find_last_newline(begin, (size_t)(end - begin));
+        last_newline = last_newline ? last_newline + 1 : begin;
+        if (last_newline > begin) {
+            search_regex_region(ctx, m, state, begin, last_newline);
+        }
+        if (last_newline < end) {
+            dstring_append_n(carry, last_newline, (size_t)(end - last_newline));
+        }
+        if (state->context != NULL && !ctx->stream->mapped) context_spill(ctx, state->context);
+
+        ifstream_consume(ctx->stream, size);
+        data = ifstream_peek(ctx->stream, &size);
+        if (size == 0 && search_follow(ctx, state)) data = ifstream_peek(ctx->stream, &size);
+    }
+    if (!dstring_empty(carry)) {
+        search_regex_region(ctx, m, state, dstring_cstr(carry), dstring_cstr(carry) + dstring_length(carry));
+        dstring_clear(carry);
+    }
+}
+
+static void regex_matcher_collect_stats(search_matcher* matcher, const regex_matcher* m) {
+    matcher->dfa_states += m->forward.built + m->reverse.built + m->anchored.built;
+    matcher->dfa_flushes += m->forward.flushes + m->reverse.flushes + m->anchored.flushes;
+}
+
+// Reports matches starting in [start, stop), reading up to max_size - 1 bytes past stop.
+// state has to hold line and column of start.
+static void search_range(search_ctx* ctx, const search_matcher* matcher, search_state* state,
+                         hit_list* hits, uint64_t start, uint64_t stop) {
+    const size_t tail_size = matcher->max_size - 1;
+    const uint64_t scan_stop = stop + tail_size;
+    if (!ifstream_seek(ctx->stream, start)) {
+        PRINT_ERRNO("Failed to seek");
+        exit(EXIT_FAILURE);
+    }
+
+    hits->count = 0;
+    uint64_t data_offset = start;
+    size_t size = 0;
+    const char* data = ifstream_peek(ctx->stream, &size);
+    while (size != 0 && data_offset < scan_stop) {
+        if (size > scan_stop - data_offset) size = (size_t)(scan_stop - data_offset);
+
+        // Bytes before start were never tracked for this range
+        size_t back = ifstream_retained(ctx->stream);
+        if (back > tail_size) back = tail_size;
+        if (back > data_offset - start) back = (size_t)(data_offset - start);
+
+        const char* begin = data - back;
+        const char* end = data + size;
+        const uint64_t begin_offset = data_offset - back;
+        const char* max_start = (stop - begin_offset < (uint64_t)(end - begin)) ? begin + (stop - begin_offset) : end;
+
+        hit_collector collector = {
+            .matcher = matcher,
+            .begin = begin,
+            .min_end = data,
+            .max_start = max_start,
+            .base_offset = (size_t)begin_offset,
+            .hits = (ctx->printing || matcher->dedupe) ? hits : NULL,
+        };
+        matcher_collect(&collector, end);
+        matcher_sort(&collector);
+        state->counter += collector.counter;
+        state->candidates += collector.candidates;
+
+        size_t keep = ((size_t)(end - begin) < tail_size) ? (size_t)(end - begin) : tail_size;
+        const char* release = end - keep;
+        const char* position = search_report_hits(ctx, state, hits, begin, (size_t)begin_offset, release);
+        search_advance(ctx, state, position, release);
+
+        ifstream_consume(ctx->stream, size);
+        data_offset += size;
+        data = ifstream_peek(ctx->stream, &size);
+    }
+
+    size_t back = ifstream_retained(ctx->stream);
+    if (back > tail_size) back = tail_size;
+    if (back > data_offset - start) back = (size_t)(data_offset - start);
+    search_report_hits(ctx, state, hits, data - back, (size_t)(data_offset - back), data);
+}
+
+// Scans only the blocks the index can't rule out, runs of neighbouring blocks at once.
+// Returns false when the index can't narrow the search down.
+static bool search_indexed(search_ctx* ctx, const search_matcher* matcher, search_state* state,
+                           uint64_t* scanned_blocks) {
+    const trigram_index* index = ctx->index;
+    if (ctx->grep_mode) return false;
+
+    const size_t words = (size_t)((index->block_count + 63) / 64);
+    uint64_t* bits = calloc(words ? words : 1, sizeof(uint64_t));
+    assert(bits != NULL);
+    if (!trigram_index_candidates(index, ctx->patterns, ctx->pattern_count, bits)) {
+        free(bits);
+        return false;
+    }
+
+    // Stream keeps max_size - 1 bytes of previous span, so matches crossing spans are found
+    ifstream_retain(ctx->stream, matcher->max_size - 1);
+
+    hit_list hits = {0};
+    uint64_t block = 0;
+    while (block < index->block_count) {
+        if (!(bits[block / 64] & (1ull << (block % 64)))) {
+            ++block;
+            continue;
+        }
+        uint64_t last = block;
+        while (last + 1 < index->block_count && (bits[(last + 1) / 64] & (1ull << ((last + 1) % 64)))) {
+            ++last;
+        }
+
+        state->line_number = (size_t)index->blocks[block].line;
+        state->char_in_line = (size_t)index->blocks[block].column;
+        search_range(ctx, matcher, state, &hits, block * index->block_size, (last + 1) * index->block_size);
+
+        *scanned_blocks += last - block + 1;
+        block = last + 1;
+    }
+    hit_list_free(&hits);
+    free(bits);
+    return true;
+}
+
+// Parallel search: the mapped file is cut into chunks, workers scan them with local
+// line/column counts, and the main thread stitches results together in chunk order.
+
+typedef struct chunk_match {
+    size_t offset;
+    size_t pattern;
+    size_t line;       // newlines between chunk start and match
+    size_t column;     // chars between line start (or chunk start) and match
+    size_t line_start; // valid when line != 0
+} chunk_match;
+
+typedef struct match_page {
+    struct match_page* next;
+    size_t count;
+    chunk_match items[MATCH_PAGE_SIZE];
+} match_page;
+
+typedef struct search_chunk {
+    arena_allocator arena;
+    match_page* first;
+    match_page* last;
+    size_t counter;
+    size_t candidates;
+    size_t newlines;
+    size_t tail_chars;      // chars after the last newline, or in the whole chunk
+    size_t last_line_start; // valid when newlines != 0
+    bool done;
+} search_chunk;
+
+typedef struct chunk_position {
+    size_t line;
+    size_t column;
+    const char* line_start;
+} chunk_position;
+
+typedef struct parallel_search {
+    const search_ctx* ctx;
+    const search_matcher* matcher;
+    const char* data;
+    size_t size;
+    size_t chunk_size;
+    size_t chunk_count;
+    search_chunk* slots;
+    size_t slot_count;
+    size_t next_chunk;
+    size_t emitted;
+    mutex lock;
+    condvar changed;
+    block_pool blocks; // Chunk arenas hand their blocks back here for the next chunks
+} parallel_search;
+
+typedef struct parallel_emit {
+    size_t line_base;
+    size_t carry_chars;
+    size_t line_start;
+    size_t last_printed_line;
+    bool printed_any;
+} parallel_emit;
+
+static void chunk_advance(chunk_position* pos, const char* from, const char* to) {
+    if (from >= to) return;
+
+    const char* newline = find_last_newline(from, (size_t)(to - from));
+    if (newline == NULL) {
+        pos->column += count_chars(from, to);
+        return;
+    }
+    pos->line += count_newlines(from, (size_t)(newline - from)) + 1;
+    pos->column = count_chars(newline + 1, to);
+    pos->line_start = newline + 1;
+}
+
+static void chunk_push(search_chunk* chunk, chunk_match match) {
+    if (chunk->last == NULL || chunk->last->count == MATCH_PAGE_SIZE) {
+        match_page* page = arena_allocate(&chunk->arena, sizeof(match_page), alignof(match_page));
+        page->next = NULL;
+        page->count = 0;
+        if (chunk->last != NULL) {
+            chunk->last->next = page;
+        } else {
+            chunk->first = page;
+        }
+        chunk->last = page;
+    }
+    chunk->last->items[chunk->last->count++] = match;
+}
+
+static void chunk_scan(parallel_search* ps, size_t index, search_chunk* chunk, hit_list* hits) {
+    const search_ctx* ctx = ps->ctx;
+    const size_t tail_size = ps->matcher->max_size - 1;
+    const size_t begin_offset = index * ps->chunk_size;
+    const size_t end_offset = (ps->size - begin_offset < ps->chunk_size) ? ps->size : begin_offset + ps->chunk_size;
+    // Matches may start in this chunk and end in the next one
+    const size_t scan_end_offset = (ps->size - end_offset < tail_size) ? ps->size : end_offset + tail_size;
+
+    const char* begin = ps->data + begin_offset;
+    const char* end = ps->data + end_offset;
+
+    hits->count = 0;
+    hit_collector collector = {
+        .matcher = ps->matcher,
+        .begin = begin,
+        .min_end = begin,
+        .max_start = end,
+        .base_offset = begin_offset,
+        .hits = (ctx->printing || ps->matcher->dedupe) ? hits : NULL,
+    };
+    matcher_collect(&collector, ps->data + scan_end_offset);
+    matcher_sort(&collector);
+    chunk->counter = collector.counter;
+    chunk->candidates = collector.candidates;
+
+    if (!ctx->printing) return;
+
+    chunk_position pos = { 0, 0, NULL };
+    const char* position = begin;
+    for (size_t i = 0; i < hits->count; ++i) {
+        const char* hit = ps->data + hits->items[i].offset;
+        chunk_advance(&pos, position, hit);
+        position = hit;
+
+        // Grep mode needs one record per line
+        bool same_line = chunk->last != NULL && chunk->last->items[chunk->last->count - 1].line == pos.line;
+        if (!ctx->grep_mode || !same_line) {
+            chunk_match match = {
+                .offset = hits->items[i].offset,
+                .pattern = hits->items[i].pattern,
+                .line = pos.line,
+                .column = pos.column,
+                .line_start = pos.line_start ? (size_t)(pos.line_start - ps->data) : 0,
+            };
+            chunk_push(chunk, match);
+        }
+    }
+
+    chunk_advance(&pos, position, end);
+    chunk->newlines = pos.line;
+    chunk->tail_chars = pos.column;
+    chunk->last_line_start = pos.line_start ? (size_t)(pos.line_start - ps->data) : 0;
+}
+
+static void search_worker(void* arg) {
+    parallel_search* ps = arg;
+    hit_list hits = {0};
+
+    for (;;) {
+        mutex_lock(&ps->lock);
+        while (ps->next_chunk < ps->chunk_count && ps->next_chunk >= ps->emitted + ps->slot_count) {
+            condvar_wait(&ps->changed, &ps->lock);
+        }
+        if (ps->next_chunk >= ps->chunk_count) {
+            mutex_unlock(&ps->lock);
+            break;
+        }
+        size_t index = ps->next_chunk++;
+        mutex_unlock(&ps->lock);
+
+        search_chunk* chunk = &ps->slots[index % ps->slot_count];
+        chunk_scan(ps, index, chunk, &hits);
+
+        mutex_lock(&ps->lock);
+        chunk->done = true;
+        condvar_broadcast(&ps->changed);
+        mutex_unlock(&ps->lock);
+    }
+    hit_list_free(&hits);
+}
+
+static void parallel_emit_chunk(const parallel_search* ps, const search_chunk* chunk, parallel_emit* emit) {
+    const search_ctx* ctx = ps->ctx;
+
+    for (const match_page* page = chunk->first; page != NULL; page = page->next) {
+        for (size_t i = 0; i < page->count; ++i) {
+            const chunk_match* match = &page->items[i];
+            const size_t line = emit->line_base + match->line;
+
+            if (!ctx->grep_mode) {
+                size_t column = match->column + ((match->line == 0) ? emit->carry_chars : 0);
+                search_print_match(ctx, line, column, match->pattern);
+            } else if (!emit->printed_any || line != emit->last_printed_line) {
+                size_t start = (match->line == 0) ? emit->line_start : match->line_start;
+                const char* newline = memchr(ps->data + match->offset, '\n', ps->size - match->offset);
+                size_t stop = newline ? (size_t)(newline - ps->data) : ps->size;
+
+                search_print_line(ctx, line, ps->data + start, stop - start);
+                emit->last_printed_line = line;
+                emit->printed_any = true;
+            }
+        }
+    }
+
+    if (chunk->newlines != 0) {
+        emit->carry_chars = chunk->tail_chars;
+        emit->line_start = chunk->last_line_start;
+    } else {
+        emit->carry_chars += chunk->tail_chars;
+    }
+    emit->line_base += chunk->newlines;
+}
+
+// Returns false when the stream can't be split, caller falls back to serial search
+static bool search_parallel(search_ctx* ctx, const search_matcher* matcher, search_state* state) {
+    if (ctx->threads <= 1 || !ctx->stream->mapped || context_wanted(ctx)) return false;
+
+    size_t size = 0;
+    const char* data = ifstream_peek(ctx->stream, &size);
+
+    size_t chunk_size = size / (ctx->threads * PARALLEL_CHUNKS_PER_THREAD);
+    if (chunk_size < PARALLEL_MIN_CHUNK_SIZE) chunk_size = PARALLEL_MIN_CHUNK_SIZE;
+    if (chunk_size > PARALLEL_MAX_CHUNK_SIZE) chunk_size = PARALLEL_MAX_CHUNK_SIZE;
+
+    const size_t chunk_count = (size + chunk_size - 1) / chunk_size;
+    if (chunk_count < 2) return false;
+
+    const size_t thread_count = (ctx->threads < chunk_count) ? ctx->threads : chunk_count;
+    parallel_search ps = {
+        .ctx = ctx,
+        .matcher = matcher,
+        .data = data,
+        .size = size,
+        .chunk_size = chunk_size,
+        .chunk_count = chunk_count,
+        .slot_count = thread_count * PARALLEL_CHUNKS_PER_THREAD,
+        .next_chunk = 0,
+        .emitted = 0,
+    };
+    ps.slots = calloc(ps.slot_count, sizeof(search_chunk));
+    thread* workers = calloc(thread_count, sizeof(thread));
+    assert(ps.slots != NULL && workers != NULL);
+    block_pool_init(&ps.blocks, ctx->huge_pages);
+    for (size_t i = 0; i < ps.slot_count; ++i) {
+        ps.slots[i].arena.pool = &ps.blocks;
+    }
+
+    mutex_init(&ps.lock);
+    condvar_init(&ps.changed);
+
+    size_t started = 0;
+    while (started < thread_count && thread_start(&workers[started], search_worker, &ps)) {
+        ++started;
+    }
+    if (started == 0) {
+        block_pool_destroy(&ps.blocks);
+        condvar_destroy(&ps.changed);
+        mutex_destroy(&ps.lock);
+        free(workers);
+        free(ps.slots);
+        return false;
+    }
+
+    parallel_emit emit = { .line_base = state->line_number, .carry_chars = state->char_in_line };
+    for (size_t index = 0; index < chunk_count; ++index) {
+        search_chunk* chunk = &ps.slots[index % ps.slot_count];
+
+        mutex_lock(&ps.lock);
+        while (!chunk->done) {
+            condvar_wait(&ps.changed, &ps.lock);
+        }
+        mutex_unlock(&ps.lock);
+
+        parallel_emit_chunk(&ps, chunk, &emit);
+        state->counter += chunk->counter;
+        state->candidates += chunk->candidates;
+
+        arena_drop(&chunk->arena);
+        memset(chunk, 0, sizeof(*chunk));
+        chunk->arena.pool = &ps.blocks;
+
+        mutex_lock(&ps.lock);
+        ++ps.emitted;
+        condvar_broadcast(&ps.changed);
+        mutex_unlock(&ps.lock);
+    }
+
+    for (size_t i = 0; i < started; ++i) {
+        thread_join(&workers[i]);
+    }
+    block_pool_destroy(&ps.blocks);
+    condvar_destroy(&ps.changed);
+    mutex_destroy(&ps.lock);
+    free(workers);
+    free(ps.slots);
+
+    ifstream_consume(ctx->stream, size);
+    return true;
+}
+
+static void search_matcher_init(search_matcher* matcher, const search_ctx* ctx) {
+    if (ctx->regex != NULL) {
+        *matcher = (search_matcher) { .regex = ctx->regex };
+        return;
+    }
+    if (ctx->pattern_count == 0) {
+        fprintf(stderr, "Empty search pattern\n");
+        exit(EXIT_FAILURE);
+    }
+
+    *matcher = (search_matcher) {
+        .patterns = ctx->patterns,
+        .pattern_count = ctx->pattern_count,
+        .max_size = 0,
+        .multi = ctx->pattern_count > 1,
+    };
+    bool masked = false;
+    for (size_t i = 0; i < ctx->pattern_count; ++i) {
+        const search_pattern* p = &ctx->patterns[i];
+        if (p->size > matcher->max_size) matcher->max_size = p->size;
+        masked = masked || p->mask != NULL;
+        if (i != 0 && p->source == p[-1].source && p->size != p[-1].size) matcher->dedupe = true;
+    }
+    if (matcher->multi) {
+        matcher->anchors = ctx->patterns;
+        if (masked) {
+            // Wildcards don't fit a trie, it gets the longest exact run of each pattern
+            search_pattern* anchors = arena_allocate(ctx->arena, ctx->pattern_count * sizeof(search_pattern),
+                                                     alignof(search_pattern));
+            for (size_t i = 0; i < ctx->pattern_count; ++i) {
+                anchors[i] = ctx->patterns[i];
+                anchors[i].data += pattern_exact_run(&ctx->patterns[i], &anchors[i].size);
+                anchors[i].mask = NULL;
+            }
+            matcher->anchors = anchors;
+        }
+        if (!ac_build(&matcher->automaton, ctx->arena, matcher->anchors, ctx->pattern_count)) {
+            fprintf(stderr, "Too many search patterns\n");
+            exit(EXIT_FAILURE);
+        }
+    } else if (ctx->patterns[0].mask != NULL) {
+        search_engine_init_masked(&matcher->engine, ctx->engine, ctx->patterns[0].data, ctx->patterns[0].mask,
+                                  ctx->patterns[0].size);
+    } else if (ctx->patterns[0].fold != NULL) {
+        search_engine_init_caseless(&matcher->engine, ctx->engine, ctx->patterns[0].data, ctx->patterns[0].fold,
+                                    ctx->patterns[0].size);
+    } else {
+        search_engine_init(&matcher->engine, ctx->engine, ctx->patterns[0].data, ctx->patterns[0].size);
+    }
+}
+
+static void search_print_summary(const search_ctx* ctx, const search_matcher* matcher, size_t counter, double elapsed_sec) {
+    if (ctx->counting) {
+        output_printf(ctx->out, "Total matches: %zu\n", counter);
+    }
+    if (ctx->timing) {
+        if (matcher->regex != NULL) {
+            if (matcher->regex->literal != NULL) {
+                output_printf(ctx->out, "Search engine: lazy-dfa (%zu byte literal prefilter, %zu states, %zu flushes)\n",
+                              matcher->regex->literal_size, matcher->dfa_states, matcher->dfa_flushes);
+            } else {
+                output_printf(ctx->out, "Search engine: lazy-dfa (%zu states, %zu flushes)\n",
+                              matcher->dfa_states, matcher->dfa_flushes);
+            }
+        } else if (matcher->multi) {
+            output_printf(ctx->out, "Search engine: aho-corasick (%zu patterns, %zu states)\n",
+                          ctx->pattern_count, matcher->automaton.state_count);
+        } else {
+            output_printf(ctx->out, "Search engine: %s%s\n", engine_kind_name(matcher->engine.kind),
+                          matcher->engine.caseless ? " (caseless)" : matcher->engine.mask ? " (wildcards)" : "");
+        }
+        output_printf(ctx->out, "Search time: %.3lf seconds\n", elapsed_sec);
+    }
+}
+
+void search_file(search_ctx* ctx) {
+    search_matcher matcher;
+    search_matcher_init(&matcher, ctx);
+
+    clock_t start_time = clock();
+
+    search_state state = { .line_number = ctx->current_line, .char_in_line = ctx->current_char };
+    context_ring context;
+    if (context_wanted(ctx)) {
+        context_init(&context, ctx);
+        state.context = &context;
+    }
+    uint64_t scanned_blocks = 0;
+    bool indexed = false;
+    dstring carry = dstring_new(ctx->arena);
+    do {
+        if (state.restart) {
+            // A new file under the same path, nothing carries over but the counts
+            ifstream_reopen(ctx->stream, ctx->follow->file, ctx->backend);
+            state.line_number = 0;
+            state.char_in_line = 0;
+            state.match_this_line = false;
+            state.line_start = NULL;
+            state.restart = false;
+            dstring_clear(&ctx->line_buffer);
+            if (state.context != NULL) context_reset(state.context);
+        }
+
+        if (matcher.regex != NULL) {
+            regex_matcher m;
+            regex_matcher_init(&m, matcher.regex);
+            search_regex_serial(ctx, &m, &state, &carry);
+            state.candidates += m.candidates;
+            regex_matcher_collect_stats(&matcher, &m);
+            regex_matcher_free(&m);
+        } else {
+            indexed = ctx->index != NULL && search_indexed(ctx, &matcher, &state, &scanned_blocks);
+            if (!indexed && !search_parallel(ctx, &matcher, &state)) {
+                search_serial(ctx, &matcher, &state);
+            }
+        }
+    } while (state.restart);
+    if (state.context != NULL) context_free(state.context);
+
+    clock_t end_time = clock();
+    double elapsed_sec = (double)(end_time - start_time) / CLOCKS_PER_SEC;
+
+    if (ctx->stats != NULL) {
+        ctx->stats->searched = true;
+        ctx->stats->matches += state.counter;
+        ctx->stats->candidates += state.candidates;
+        ctx->stats->bytes_read += ctx->stream->total_read;
+        ctx->stats->refills += ctx->stream->refills;
+        ++ctx->stats->files;
+    }
+
+    search_print_summary(ctx, &matcher, state.counter, elapsed_sec);
+    if (ctx->timing && indexed) {
+        output_printf(ctx->out, "Index: scanned %llu of %llu blocks\n",
+                      (unsigned long long)scanned_blocks, (unsigned long long)ctx->index->block_count);
+    }
+}
+
+// Tree search: the main thread walks the paths and feeds files to a work-stealing
+// pool. Every worker searches whole files with its own stream buffer and arena, and
+// prints the output of a file in one piece.
+
+typedef struct tree_file {
+    const char* path;
+    uint64_t size;
+} tree_file;
+
+typedef struct tree_worker {
+    arena_allocator arena;
+    ifstream stream;
+    bool stream_open;
+    dstring line_buffer;
+    dstring output;
+    regex_matcher regex; // Regex search only
+    dstring carry;
+    context_ring context; // Context lines only
+    size_t counter;
+    size_t candidates;
+    uint64_t bytes_read;
+    uint64_t refills;
+    size_t files;
+} tree_worker;
+
+typedef struct tree_search {
+    const search_ctx* ctx;
+    const search_matcher* matcher;
+    tree_worker* workers;
+    work_pool pool;
+    arena_allocator files; // main thread only
+    block_pool blocks;     // Shared by the worker arenas
+    mutex output_lock;
+    bool printed_any; // Context groups of different files are split by "--" too
+} tree_search;
+
+static void tree_search_file(void* user, size_t worker_index, void* item) {
+    tree_search* ts = user;
+    tree_worker* worker = &ts->workers[worker_index];
+    const tree_file* file = item;
+
+    FILE* handle = NULL;
+    if (fopen_s(&handle, file->path, "rb") != 0) {
+        mutex_lock(&ts->output_lock);
+        fprintf(stderr, "Failed to open %s: %s\n", file->path, strerror(errno));
+        mutex_unlock(&ts->output_lock);
+        return;
+    }
+
+    // Mapping costs more than one read for small files
+    ifstream_backend_t backend = (file->size >= TREE_MMAP_MIN_SIZE) ? ts->ctx->backend : IFSTREAM_BUFFERED;
+    if (worker->stream_open) {
+        ifstream_reopen(&worker->stream, handle, backend);
+    } else {
+        ifstream_init_backend(&worker->stream, handle, backend);
+        ifstream_set_read_ahead(&worker->stream, ts->ctx->read_size, ts->ctx->read_depth);
+        worker->stream_open = true;
+    }
+
+    search_ctx ctx = *ts->ctx;
+    ctx.filepath = file->path;
+    ctx.stream = &worker->stream;
+    ctx.arena = &worker->arena;
+    ctx.line_buffer = worker->line_buffer;
+    ctx.output = &worker->output;
+
+    search_state state = {0};
+    if (context_wanted(&ctx)) {
+        context_reset(&worker->context);
+        state.context = &worker->context;
+    }
+    if (ts->matcher->regex != NULL) {
+        const size_t candidates = worker->regex.candidates;
+        search_regex_serial(&ctx, &worker->regex, &state, &worker->carry);
+        state.candidates = worker->regex.candidates - candidates;
+    } else {
+        search_serial(&ctx, ts->matcher, &state);
+    }
+    fclose(handle);
+
+    worker->line_buffer = ctx.line_buffer;
+    worker->counter += state.counter;
+    worker->candidates += state.candidates;
+    worker->bytes_read += worker->stream.total_read;
+    worker->refills += worker->stream.refills;
+    ++worker->files;
+
+    if (!dstring_empty(&worker->output)) {
+        mutex_lock(&ts->output_lock);
+        if (state.context != NULL && ts->printed_any) output_write(ts->ctx->out, "--\n", 3);
+        output_write(ts->ctx->out, dstring_cstr(&worker->output), dstring_length(&worker->output));
+        ts->printed_any = true;
+        mutex_unlock(&ts->output_lock);
+        dstring_clear(&worker->output);
+    }
+}
+
+static void tree_submit(void* user, const char* path, uint64_t size) {
+    tree_search* ts = user;
+
+    size_t length = strlen(path);
+    char* copy = arena_allocate(&ts->files, length + 1, 1);
+    memcpy(copy, path, length + 1);
+
+    tree_file* file = arena_allocate(&ts->files, sizeof(tree_file), alignof(tree_file));
+    file->path = copy;
+    file->size = size;
+    work_pool_submit(&ts->pool, file);
+}
+
+void search_tree(search_ctx* ctx, const char* const* paths, size_t path_count, const walk_options* options) {
+    assert(paths != NULL);
+    assert(options != NULL);
+
+    search_matcher matcher;
+    search_matcher_init(&matcher, ctx);
+
+    clock_t start_time = clock();
+
+    const size_t worker_count = (ctx->threads != 0) ? ctx->threads : 1;
+    tree_search ts = {
+        .ctx = ctx,
+        .matcher = &matcher,
+    };
+    ts.workers = calloc(worker_count, sizeof(tree_worker));
+    assert(ts.workers != NULL);
+    block_pool_init(&ts.blocks, ctx->huge_pages);
+    for (size_t i = 0; i < worker_count; ++i) {
+        ts.workers[i].arena.pool = &ts.blocks;
+        ts.workers[i].line_buffer = dstring_new(&ts.workers[i].arena);
+        ts.workers[i].output = dstring_new(&ts.workers[i].arena);
+        if (matcher.regex != NULL) {
+            regex_matcher_init(&ts.workers[i].regex, matcher.regex);
+            ts.workers[i].carry = dstring_new(&ts.workers[i].arena);
+        }
+        if (context_wanted(ctx)) {
+            search_ctx worker_ctx = *ctx;
+            worker_ctx.arena = &ts.workers[i].arena;
+            context_init(&ts.workers[i].context, &worker_ctx);
+        }
+    }
+    mutex_init(&ts.output_lock);
+
+    if (!work_pool_start(&ts.pool, worker_count, tree_search_file, &ts)) {
+        fprintf(stderr, "Failed to start search threads\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t i = 0; i < path_count; ++i) {
+        if (path_is_directory(paths[i])) {
+            dir_walk(paths[i], options, tree_submit, &ts);
+        } else {
+            // Explicit file arguments skip the filters, like the single file mode
+            tree_submit(&ts, paths[i], 0);
+        }
+    }
+    work_pool_finish(&ts.pool);
+
+    size_t counter = 0;
+    size_t files = 0;
+    for (size_t i = 0; i < worker_count; ++i) {
+        counter += ts.workers[i].counter;
+        files += ts.workers[i].files;
+        if (ctx->stats != NULL) {
+            ctx->stats->candidates += ts.workers[i].candidates;
+            ctx->stats->bytes_read += ts.workers[i].bytes_read;
+            ctx->stats->refills += ts.workers[i].refills;
+            ctx->stats->arena_peak += ts.workers[i].arena.peak;
+        }
+        if (matcher.regex != NULL) {
+            regex_matcher_collect_stats(&matcher, &ts.workers[i].regex);
+            regex_matcher_free(&ts.workers[i].regex);
+        }
+        if (context_wanted(ctx)) context_free(&ts.workers[i].context);
+        if (ts.workers[i].stream_open) ifstream_close(&ts.workers[i].stream);
+        arena_drop(&ts.workers[i].arena);
+    }
+    if (ctx->stats != NULL) {
+        ctx->stats->searched = true;
+        ctx->stats->matches += counter;
+        ctx->stats->files += files;
+        ctx->stats->arena_peak += ts.files.peak;
+    }
+    block_pool_destroy(&ts.blocks);
+    mutex_destroy(&ts.output_lock);
+    arena_drop(&ts.files);
+    free(ts.workers);
+
+    clock_t end_time = clock();
+    double elapsed_sec = (double)(end_time - start_time) / CLOCKS_PER_SEC;
+
+    search_print_summary(ctx, &matcher, counter, elapsed_sec);
+    if (ctx->timing) {
+        output_printf(ctx->out, "Files searched: %zu\n", files);
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef __SEARCH_H__
+#define __SEARCH_H__ 1
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "arena_allocator.h"
+#include "dir_walk.h"
+#include "dynamic_string.h"
+#include "ifstream.h"
+#include "output.h"
+#include "pattern_set.h"
+#include "regex.h"
+#include "run_stats.h"
+#include "follow.h"
+#include "search_engine.h"
+#include "trigram_index.h"
+
+#define SEARCH_MAX_LINE_DEFAULT (64 * 1024 * 1024)
+#define CONTEXT_MAX_LINES (1024 * 1024) // Per side, the ring holds one slot per line before
+
+typedef struct search_ctx {
+    const search_pattern* patterns;
+    size_t pattern_count;
+    engine_kind_t engine; // Single pattern only, several patterns share one automaton
+    const regex* regex;   // Replaces the patterns when set
+    bool labels;          // Print the pattern label with every match
+    const char* filepath;
+    ifstream* stream;
+    ifstream_backend_t backend; // Tree search opens streams itself
+    size_t read_size;           // IFSTREAM_ASYNC buffer size and count for those streams
+    size_t read_depth;
+    const trigram_index* index; // NULL - scan the whole stream
+    arena_allocator* arena;
+    dstring line_buffer; // Grep mode: head of a line that crossed a buffer refill
+    size_t max_line;     // Grep mode lines are cut after this many bytes, 0 - no limit
+    size_t before;       // Grep mode context lines before and after every matching line
+    size_t after;
+    dstring* output; // NULL - print straight to out
+    output_writer* out;
+    size_t current_line; // Line and column the stream starts at, non-zero for --offset
+    size_t current_char;
+    size_t threads;
+    bool timing;
+    bool counting;
+    bool printing;
+    bool grep_mode;
+    bool with_filename; // Prefix grep mode lines with the file path
+    bool huge_pages;    // Back worker arena blocks with huge pages where possible
+    run_stats* stats;   // NULL - no --stats, counters are added to it otherwise
+    file_follower* follow; // -F: wait for appends at the end of the stream instead of stopping
+} search_ctx;
+
+void search_file(search_ctx* ctx);
+
+// Searches files and directory trees with ctx->threads workers, ctx->stream is unused
+void search_tree(search_ctx* ctx, const char* const* paths, size_t path_count, const walk_options* options);
+
+#endif // __SEARCH_H__
@@ -0,0 +1,372 @@
+#include <assert.h>
+#include <string.h>
+
+#include "search_engine.h"
+
+#define HORSPOOL_MAX_SIZE (64)
+
+#define BYTESET_ADD(set, b) ((set)[(unsigned char)(b) >> 5] |= 1u << ((unsigned char)(b) & 31))
+#define BYTESET_HAS(set, b) ((set)[(unsigned char)(b) >> 5] & (1u << ((unsigned char)(b) & 31)))
+
+engine_kind_t parse_engine_kind(const char* name, bool* ok) {
+    assert(name != NULL);
+    assert(ok != NULL);
+
+    *ok = true;
+    if (strcmp(name, "auto") == 0) return ENGINE_AUTO;
+    if (strcmp(name, "packed") == 0) return ENGINE_PACKED;
+    if (strcmp(name, "horspool") == 0) return ENGINE_HORSPOOL;
+    if (strcmp(name, "twoway") == 0) return ENGINE_TWOWAY;
+    if (strcmp(name, "rare") == 0) return ENGINE_RARE;
+    *ok = false;
+    return ENGINE_AUTO;
+}
+
+const char* engine_kind_name(engine_kind_t kind) {
+    switch (kind) {
+        case ENGINE_PACKED: return "packed";
+        case ENGINE_HORSPOOL: return "horspool";
+        case ENGINE_TWOWAY: return "twoway";
+        case ENGINE_RARE: return "rare";
+        default:
+        case ENGINE_AUTO: return "auto";
+    }
+}
+
+// Maximal suffix of pattern for (reversed) byte order, see Crochemore-Perrin
+static size_t maximal_suffix(const unsigned char* n, size_t size, bool reversed, size_t* period) {
+    size_t ip = (size_t)-1;
+    size_t jp = 0;
+    size_t k = 1;
+    size_t p = 1;
+
+    while (jp + k < size) {
+        unsigned char a = n[ip + k];
+        unsigned char b = n[jp + k];
+        if (a == b) {
+            if (k == p) {
+                jp += p;
+                k = 1;
+            } else {
+                ++k;
+            }
+        } else if (reversed ? (a < b) : (a > b)) {
+            jp += k;
+            k = 1;
+            p = jp - ip;
+        } else {
+            ip = jp++;
+            k = p = 1;
+        }
+    }
+    *period = p;
+    return ip;
+}
+
+// Critical factorization; returns true if the pattern is periodic with *period
+static bool critical_factorization(const unsigned char* n, size_t size, size_t* critical_pos, size_t* period) {
+    size_t p0 = 0;
+    size_t p1 = 0;
+    size_t ms0 = maximal_suffix(n, size, false, &p0);
+    size_t ms1 = maximal_suffix(n, size, true, &p1);
+
+    if (ms1 + 1 > ms0 + 1) {
+        *critical_pos = ms1;
+        *period = p1;
+    } else {
+        *critical_pos = ms0;
+        *period = p0;
+    }
+    return memcmp(n, n + *period, *critical_pos + 1) == 0;
+}
+
+engine_kind_t search_engine_select(const char* pattern, size_t pattern_size) {
+    assert(pattern != NULL);
+    assert(pattern_size != 0);
+
+    if (pattern_size <= PACKED_ENGINE_MAX_SIZE) return ENGINE_PACKED;
+
+    size_t critical_pos = 0;
+    size_t period = 0;
+    bool periodic = critical_factorization((const unsigned char*)pattern, pattern_size, &critical_pos, &period);
+
+    // Repetitive patterns are the Horspool worst case
+    if (pattern_size > HORSPOOL_MAX_SIZE || (periodic && period <= pattern_size / 2)) return ENGINE_TWOWAY;
+    return ENGINE_HORSPOOL;
+}
+
+static void packed_init(search_engine* engine) {
+    unsigned char word[PACKED_ENGINE_MAX_SIZE] = {0};
+    unsigned char mask[PACKED_ENGINE_MAX_SIZE] = {0};
+    unsigned char fold[PACKED_ENGINE_MAX_SIZE] = {0};
+
+    memcpy(word, engine->pattern, engine->pattern_size);
+    if (engine->mask != NULL) {
+        memcpy(mask, engine->mask, engine->pattern_size);
+    } else {
+        memset(mask, 0xFF, engine->pattern_size);
+    }
+    if (engine->caseless) memcpy(fold, engine->fold, engine->pattern_size);
+    memcpy(&engine->packed_word, word, sizeof(word));
+    memcpy(&engine->packed_mask, mask, sizeof(mask));
+    memcpy(&engine->packed_fold, fold, sizeof(fold));
+}
+
+static void horspool_init(search_engine* engine) {
+    const unsigned char* n = (const unsigned char*)engine->pattern;
+    const size_t size = engine->pattern_size;
+
+    for (size_t i = 0; i < 256; ++i) {
+        engine->shift[i] = size;
+    }
+    for (size_t i = 0; i + 1 < size; ++i) {
+        engine->shift[n[i]] = size - 1 - i;
+    }
+}
+
+static void twoway_init(search_engine* engine) {
+    const unsigned char* n = (const unsigned char*)engine->pattern;
+    const size_t size = engine->pattern_size;
+
+    memset(engine->byteset, 0, sizeof(engine->byteset));
+    for (size_t i = 0; i < size; ++i) {
+        BYTESET_ADD(engine->byteset, n[i]);
+        engine->shift[n[i]] = i + 1;
+    }
+
+    if (critical_factorization(n, size, &engine->critical_pos, &engine->period)) {
+        engine->memory0 = size - engine->period;
+    } else {
+        size_t left = engine->critical_pos;
+        size_t right = size - engine->critical_pos - 1;
+        engine->period = ((left > right) ? left : right) + 1;
+        engine->memory0 = 0;
+    }
+}
+
+void search_engine_init(search_engine* engine, engine_kind_t kind, const char* pattern, size_t pattern_size) {
+    assert(engine != NULL);
+    assert(pattern != NULL);
+    assert(pattern_size != 0);
+
+    if (kind == ENGINE_AUTO) {
+        kind = search_engine_select(pattern, pattern_size);
+    }
+    assert(kind != ENGINE_PACKED || pattern_size <= PACKED_ENGINE_MAX_SIZE);
+
+    engine->kind = kind;
+    engine->pattern = pattern;
+    engine->pattern_size = pattern_size;
+    engine->caseless = false;
+    engine->mask = NULL;
+
+    switch (kind) {
+        case ENGINE_PACKED:
+            prefilter_init(&engine->pf, pattern, pattern_size);
+            packed_init(engine);
+            break;
+        case ENGINE_HORSPOOL:
+            horspool_init(engine);
+            break;
+        case ENGINE_TWOWAY:
+            twoway_init(engine);
+            break;
+        default:
+        case ENGINE_RARE:
+            prefilter_init(&engine->pf, pattern, pattern_size);
+            break;
+    }
+}
+
+engine_kind_t search_engine_select_caseless(size_t pattern_size) {
+    return (pattern_size <= PACKED_ENGINE_MAX_SIZE) ? ENGINE_PACKED : ENGINE_RARE;
+}
+
+void search_engine_init_caseless(search_engine* engine, engine_kind_t kind, const char* pattern,
+                                 const unsigned char* fold, size_t pattern_size) {
+    assert(engine != NULL);
+    assert(pattern != NULL);
+    assert(fold != NULL);
+    assert(pattern_size != 0 && pattern_size <= CASELESS_ENGINE_MAX_SIZE);
+
+    if (kind == ENGINE_AUTO) {
+        kind = search_engine_select_caseless(pattern_size);
+    }
+    assert(kind == ENGINE_PACKED || kind == ENGINE_RARE);
+    assert(kind != ENGINE_PACKED || pattern_size <= PACKED_ENGINE_MAX_SIZE);
+
+    engine->kind = kind;
+    engine->pattern = pattern;
+    engine->pattern_size = pattern_size;
+    engine->caseless = true;
+    engine->mask = NULL;
+    memcpy(engine->fold, fold, pattern_size);
+
+    prefilter_init_caseless(&engine->pf, pattern, fold, pattern_size);
+    if (kind == ENGINE_PACKED) packed_init(engine);
+}
+
+void search_engine_init_masked(search_engine* engine, engine_kind_t kind, const char* pattern,
+                               const unsigned char* mask, size_t pattern_size) {
+    assert(engine != NULL);
+    assert(pattern != NULL);
+    assert(mask != NULL);
+    assert(pattern_size != 0);
+
+    if (kind == ENGINE_AUTO) {
+        kind = search_engine_select_caseless(pattern_size);
+    }
+    assert(kind == ENGINE_PACKED || kind == ENGINE_RARE);
+    assert(kind != ENGINE_PACKED || pattern_size <= PACKED_ENGINE_MAX_SIZE);
+
+    engine->kind = kind;
+    engine->pattern = pattern;
+    engine->pattern_size = pattern_size;
+    engine->caseless = false;
+    engine->mask = mask;
+
+    prefilter_init_masked(&engine->pf, pattern, mask, pattern_size);
+    if (kind == ENGINE_PACKED) packed_init(engine);
+}
+
+// Eight bytes at a time: set the fold bits, then compare
+bool folded_equal(const char* text, const char* pattern, const unsigned char* fold, size_t size) {
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t word, bits, expected;
+        memcpy(&word, text + i, sizeof(word));
+        memcpy(&bits, fold + i, sizeof(bits));
+        memcpy(&expected, pattern + i, sizeof(expected));
+        if ((word | bits) != expected) return false;
+    }
+    for (; i < size; ++i) {
+        if (((unsigned char)text[i] | fold[i]) != (unsigned char)pattern[i]) return false;
+    }
+    return true;
+}
+
+// Eight bytes at a time: clear the wildcard bits, then compare
+bool masked_equal(const char* text, const char* pattern, const unsigned char* mask, size_t size) {
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t word, bits, expected;
+        memcpy(&word, text + i, sizeof(word));
+        memcpy(&bits, mask + i, sizeof(bits));
+        memcpy(&expected, pattern + i, sizeof(expected));
+        if ((word & bits) != expected) return false;
+    }
+    for (; i < size; ++i) {
+        if (((unsigned char)text[i] & mask[i]) != (unsigned char)pattern[i]) return false;
+    }
+    return true;
+}
+
+static bool engine_equal(const search_engine* engine, const char* h) {
+    if (engine->mask != NULL) return masked_equal(h, engine->pattern, engine->mask, engine->pattern_size);
+    if (engine->caseless) return folded_equal(h, engine->pattern, engine->fold, engine->pattern_size);
+    return memcmp(h, engine->pattern, engine->pattern_size) == 0;
+}
+
+static const char* packed_find(const search_engine* engine, const char* begin, const char* end, size_t* candidates) {
+    const char* hit = begin;
+    while ((hit = prefilter_find(&engine->pf, hit, end)) != NULL) {
+        ++*candidates;
+        if (end - hit >= (ptrdiff_t)sizeof(uint64_t)) {
+            uint64_t word;
+            memcpy(&word, hit, sizeof(word));
+            if ((((word | engine->packed_fold) ^ engine->packed_word) & engine->packed_mask) == 0) return hit;
+        } else if (engine_equal(engine, hit)) {
+            return hit;
+        }
+        ++hit;
+    }
+    return NULL;
+}
+
+static const char* rare_find(const search_engine* engine, const char* begin, const char* end, size_t* candidates) {
+    const char* hit = begin;
+    while ((hit = prefilter_find(&engine->pf, hit, end)) != NULL) {
+        ++*candidates;
+        if (engine_equal(engine, hit)) return hit;
+        ++hit;
+    }
+    return NULL;
+}
+
+static const char* horspool_find(const search_engine* engine, const char* begin, const char* end, size_t* candidates) {
+    const size_t size = engine->pattern_size;
+    const unsigned char last = (unsigned char)engine->pattern[size - 1];
+
+    const char* h = begin;
+    while ((size_t)(end - h) >= size) {
+        unsigned char c = (unsigned char)h[size - 1];
+        if (c == last) {
+            ++*candidates;
+            if (memcmp(h, engine->pattern, size - 1) == 0) return h;
+        }
+        h += engine->shift[c];
+    }
+    return NULL;
+}
+
+static const char* twoway_find(const search_engine* engine, const char* begin, const char* end, size_t* candidates) {
+    const unsigned char* n = (const unsigned char*)engine->pattern;
+    const size_t size = engine->pattern_size;
+    const size_t ms = engine->critical_pos;
+    const unsigned char* h = (const unsigned char*)begin;
+    const unsigned char* z = (const unsigned char*)end;
+    size_t memory = 0;
+
+    while ((size_t)(z - h) >= size) {
+        // Last byte first, skip by its last position in pattern
+        unsigned char c = h[size - 1];
+        if (!BYTESET_HAS(engine->byteset, c)) {
+            h += size;
+            memory = 0;
+            continue;
+        }
+        size_t k = size - engine->shift[c];
+        if (k != 0) {
+            if (k < memory) k = memory;
+            h += k;
+            memory = 0;
+            continue;
+        }
+
+        // Right half
+        ++*candidates;
+        for (k = (ms + 1 > memory) ? ms + 1 : memory; k < size && n[k] == h[k]; ++k);
+        if (k < size) {
+            h += k - ms;
+            memory = 0;
+            continue;
+        }
+        // Left half
+        for (k = ms + 1; k > memory && n[k - 1] == h[k - 1]; --k);
+        if (k <= memory) return (const char*)h;
+
+        h += engine->period;
+        memory = engine->memory0;
+    }
+    return NULL;
+}
+
+const char* search_engine_find_counted(const search_engine* engine, const char* begin, const char* end,
+                                       size_t* candidates) {
+    assert(engine != NULL);
+    assert(begin <= end);
+    assert(candidates != NULL);
+
+    switch (engine->kind) {
+        case ENGINE_PACKED: return packed_find(engine, begin, end, candidates);
+        case ENGINE_HORSPOOL: return horspool_find(engine, begin, end, candidates);
+        case ENGINE_TWOWAY: return twoway_find(engine, begin, end, candidates);
+        default:
+        case ENGINE_RARE: return rare_find(engine, begin, end, candidates);
+    }
+}
+
+const char* search_engine_find(const search_engine* engine, const char* begin, const char* end) {
+    size_t candidates = 0;
+    return search_engine_find_counted(engine, begin, end, &candidates);
+}
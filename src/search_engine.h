@@ -0,0 +1,74 @@
+#ifndef __SEARCH_ENGINE_H__
+#define __SEARCH_ENGINE_H__ 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "prefilter.h"
+
+#define PACKED_ENGINE_MAX_SIZE (8)
+#define CASELESS_ENGINE_MAX_SIZE (256)
+
+typedef enum {
+    ENGINE_AUTO,
+    ENGINE_PACKED,   // 1-8 bytes: prefilter + masked 64-bit compare
+    ENGINE_HORSPOOL, // medium patterns: Boyer-Moore-Horspool
+    ENGINE_TWOWAY,   // long or periodic patterns: Two-Way, linear worst case
+    ENGINE_RARE,     // prefilter + memcmp
+} engine_kind_t;
+
+typedef struct search_engine {
+    engine_kind_t kind;
+    const char* pattern;
+    size_t pattern_size;
+
+    prefilter pf;
+
+    uint64_t packed_word;
+    uint64_t packed_mask;
+    uint64_t packed_fold;
+
+    // Caseless: text bytes get fold[i] set before they are compared with the pattern
+    bool caseless;
+    unsigned char fold[CASELESS_ENGINE_MAX_SIZE];
+    // Hex wildcards: text bytes are ANDed with mask[i] first, NULL - exact
+    const unsigned char* mask;
+
+    // Horspool: bad character shift; Two-Way: last position + 1 of byte in pattern
+    size_t shift[256];
+    uint32_t byteset[8];
+    size_t critical_pos;
+    size_t period;
+    size_t memory0;
+} search_engine;
+
+engine_kind_t parse_engine_kind(const char* name, bool* ok);
+const char* engine_kind_name(engine_kind_t kind);
+engine_kind_t search_engine_select(const char* pattern, size_t pattern_size);
+
+void search_engine_init(search_engine* engine, engine_kind_t kind, const char* pattern, size_t pattern_size);
+
+// Caseless search, see pattern_set_fold_case for pattern and fold.
+// Packed and rare engines only, ENGINE_AUTO picks between them.
+engine_kind_t search_engine_select_caseless(size_t pattern_size);
+void search_engine_init_caseless(search_engine* engine, engine_kind_t kind, const char* pattern,
+                                 const unsigned char* fold, size_t pattern_size);
+
+// Hex wildcard search, see parse_hex_pattern for pattern and mask. mask has to outlive
+// the engine. Same engines as caseless search, picked by search_engine_select_caseless.
+void search_engine_init_masked(search_engine* engine, engine_kind_t kind, const char* pattern,
+                               const unsigned char* mask, size_t pattern_size);
+
+// Whether text with fold bits set equals pattern
+bool folded_equal(const char* text, const char* pattern, const unsigned char* fold, size_t size);
+// Whether text with the bits outside mask cleared equals pattern
+bool masked_equal(const char* text, const char* pattern, const unsigned char* mask, size_t size);
+
+// Returns start of first full match in [begin, end) or NULL
+const char* search_engine_find(const search_engine* engine, const char* begin, const char* end);
+// Same, adds the positions that were checked against the whole pattern to *candidates
+const char* search_engine_find_counted(const search_engine* engine, const char* begin, const char* end,
+                                       size_t* candidates);
+
+#endif // __SEARCH_ENGINE_H__
@@ -0,0 +1,128 @@
+#include <stdbool.h>
+#include <assert.h>
+#include <stdint.h>
+
+#include "text_count.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#define TEXT_COUNT_X86 1
+#include <immintrin.h>
+#endif
+
+// Short runs are counted in place, the kernels only pay off past this
+#define TEXT_COUNT_MIN_SIMD_SIZE (64)
+
+static inline bool count_match(unsigned char c, bool chars) {
+    return chars ? ((c & 0xC0) != 0x80) : (c == '\n');
+}
+
+static size_t count_scalar(const char* data, size_t size, bool chars) {
+    size_t count = 0;
+    for (size_t i = 0; i < size; ++i) {
+        count += count_match((unsigned char)data[i], chars);
+    }
+    return count;
+}
+
+#ifdef TEXT_COUNT_X86
+// Every matching byte lane is -1, subtracting it counts up to 255 per lane.
+// psadbw then folds the lanes into 64 bit sums before they can overflow.
+
+// Continuation bytes are 0x80-0xBF, as signed bytes exactly the ones below -64
+static inline __m128i count_mask_sse2(__m128i v, bool chars) {
+    return chars ? _mm_cmpgt_epi8(v, _mm_set1_epi8(-65)) : _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'));
+}
+
+static inline size_t count_sse2(const char* data, size_t size, bool chars) {
+    const __m128i zero = _mm_setzero_si128();
+    size_t total = 0;
+    size_t i = 0;
+    while (size - i >= 16) {
+        size_t rounds = (size - i) / 16;
+        if (rounds > 255) rounds = 255;
+
+        __m128i counts = zero;
+        for (size_t r = 0; r < rounds; ++r, i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+            counts = _mm_sub_epi8(counts, count_mask_sse2(v, chars));
+        }
+        __m128i sums = _mm_sad_epu8(counts, zero);
+        total += (size_t)_mm_cvtsi128_si32(sums) + (size_t)_mm_cvtsi128_si32(_mm_unpackhi_epi64(sums, sums));
+    }
+    return total + count_scalar(data + i, size - i, chars);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i count_mask_avx2(__m256i v, bool chars) {
+    return chars ? _mm256_cmpgt_epi8(v, _mm256_set1_epi8(-65)) : _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'));
+}
+
+__attribute__((target("avx2")))
+static inline size_t count_avx2(const char* data, size_t size, bool chars) {
+    const __m256i zero = _mm256_setzero_si256();
+    size_t total = 0;
+    size_t i = 0;
+    while (size - i >= 32) {
+        size_t rounds = (size - i) / 32;
+        if (rounds > 255) rounds = 255;
+
+        __m256i counts = zero;
+        for (size_t r = 0; r < rounds; ++r, i += 32) {
+            __m256i v = _mm256_loadu_si256((const __m256i*)(data + i));
+            counts = _mm256_sub_epi8(counts, count_mask_avx2(v, chars));
+        }
+        __m256i sums = _mm256_sad_epu8(counts, zero);
+        __m128i half = _mm_add_epi64(_mm256_castsi256_si128(sums), _mm256_extracti128_si256(sums, 1));
+        total += (size_t)_mm_cvtsi128_si32(half) + (size_t)_mm_cvtsi128_si32(_mm_unpackhi_epi64(half, half));
+    }
+    return total + count_sse2(data + i, size - i, chars);
+}
+
+__attribute__((target("avx2")))
+static size_t count_newlines_avx2(const char* data, size_t size) {
+    return count_avx2(data, size, false);
+}
+
+__attribute__((target("avx2")))
+static size_t count_chars_avx2(const char* data, size_t size) {
+    return count_avx2(data, size, true);
+}
+#endif
+
+static size_t count_bytes(const char* data, size_t size, bool chars) {
+    if (size < TEXT_COUNT_MIN_SIMD_SIZE) return count_scalar(data, size, chars);
+#ifdef TEXT_COUNT_X86
+    if (__builtin_cpu_supports("avx2")) return chars ? count_chars_avx2(data, size) : count_newlines_avx2(data, size);
+    return count_sse2(data, size, chars);
+#else
+    return count_scalar(data, size, chars);
+#endif
+}
+
+size_t count_newlines(const char* data, size_t size) {
+    assert(data != NULL || size == 0);
+    return count_bytes(data, size, false);
+}
+
+size_t count_utf8_chars(const char* data, size_t size) {
+    assert(data != NULL || size == 0);
+    return count_bytes(data, size, true);
+}
+
+const char* find_last_newline(const char* data, size_t size) {
+    assert(data != NULL || size == 0);
+
+#ifdef TEXT_COUNT_X86
+    const __m128i newline = _mm_set1_epi8('\n');
+    while (size >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(data + size - 16));
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, newline));
+        if (mask) return data + size - 16 + (31 - __builtin_clz(mask));
+        size -= 16;
+    }
+#endif
+    while (size != 0) {
+        if (data[--size] == '\n') return data + size;
+    }
+    return NULL;
+}
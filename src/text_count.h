@@ -0,0 +1,15 @@
+#ifndef __TEXT_COUNT_H__
+#define __TEXT_COUNT_H__ 1
+
+#include <stddef.h>
+
+// Position counting for match reports, vectorized where the CPU allows it.
+// Safe to call from any thread.
+
+size_t count_newlines(const char* data, size_t size);
+// UTF-8 characters: every byte that is not a continuation byte (10xxxxxx)
+size_t count_utf8_chars(const char* data, size_t size);
+// Last '\n' in data or NULL
+const char* find_last_newline(const char* data, size_t size);
+
+#endif // __TEXT_COUNT_H__
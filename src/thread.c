@@ -0,0 +1,150 @@
+#if !defined(_WIN32) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
+
+#include <assert.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include "thread.h"
+
+#ifdef _WIN32
+static DWORD WINAPI thread_trampoline(LPVOID arg) {
+    thread* th = arg;
+    th->func(th->arg);
+    return 0;
+}
+#else
+static void* thread_trampoline(void* arg) {
+    thread* th = arg;
+    th->func(th->arg);
+    return NULL;
+}
+#endif
+
+bool thread_start(thread* th, thread_func func, void* arg) {
+    assert(th != NULL);
+    assert(func != NULL);
+
+    th->func = func;
+    th->arg = arg;
+#ifdef _WIN32
+    th->handle = CreateThread(NULL, 0, thread_trampoline, th, 0, NULL);
+    return th->handle != NULL;
+#else
+    return pthread_create(&th->handle, NULL, thread_trampoline, th) == 0;
+#endif
+}
+
+void thread_join(thread* th) {
+    assert(th != NULL);
+#ifdef _WIN32
+    WaitForSingleObject(th->handle, INFINITE);
+    CloseHandle(th->handle);
+#else
+    pthread_join(th->handle, NULL);
+#endif
+}
+
+void mutex_init(mutex* m) {
+#ifdef _WIN32
+    InitializeSRWLock(&m->lock);
+#else
+    pthread_mutex_init(&m->lock, NULL);
+#endif
+}
+
+void mutex_destroy(mutex* m) {
+#ifdef _WIN32
+    (void)m;
+#else
+    pthread_mutex_destroy(&m->lock);
+#endif
+}
+
+void mutex_lock(mutex* m) {
+#ifdef _WIN32
+    AcquireSRWLockExclusive(&m->lock);
+#else
+    pthread_mutex_lock(&m->lock);
+#endif
+}
+
+void mutex_unlock(mutex* m) {
+#ifdef _WIN32
+    ReleaseSRWLockExclusive(&m->lock);
+#else
+    pthread_mutex_unlock(&m->lock);
+#endif
+}
+
+void condvar_init(condvar* cv) {
+#ifdef _WIN32
+    InitializeConditionVariable(&cv->cond);
+#else
+    pthread_cond_init(&cv->cond, NULL);
+#endif
+}
+
+void condvar_destroy(condvar* cv) {
+#ifdef _WIN32
+    (void)cv;
+#else
+    pthread_cond_destroy(&cv->cond);
+#endif
+}
+
+void condvar_wait(condvar* cv, mutex* m) {
+#ifdef _WIN32
+    SleepConditionVariableSRW(&cv->cond, &m->lock, INFINITE, 0);
+#else
+    pthread_cond_wait(&cv->cond, &m->lock);
+#endif
+}
+
+void condvar_signal(condvar* cv) {
+#ifdef _WIN32
+    WakeConditionVariable(&cv->cond);
+#else
+    pthread_cond_signal(&cv->cond);
+#endif
+}
+
+void condvar_broadcast(condvar* cv) {
+#ifdef _WIN32
+    WakeAllConditionVariable(&cv->cond);
+#else
+    pthread_cond_broadcast(&cv->cond);
+#endif
+}
+
+uintptr_t atomic_load_word(volatile uintptr_t* word) {
+    assert(word != NULL);
+#ifdef _WIN32
+    return (uintptr_t)InterlockedCompareExchangePointer((PVOID volatile*)word, NULL, NULL);
+#else
+    return __atomic_load_n(word, __ATOMIC_SEQ_CST);
+#endif
+}
+
+bool atomic_cas_word(volatile uintptr_t* word, uintptr_t expected, uintptr_t desired) {
+    assert(word != NULL);
+#ifdef _WIN32
+    return (uintptr_t)InterlockedCompareExchangePointer((PVOID volatile*)word, (PVOID)desired, (PVOID)expected) == expected;
+#else
+    return __atomic_compare_exchange_n(word, &expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+#endif
+}
+
+size_t cpu_count(void) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (info.dwNumberOfProcessors > 0) ? (size_t)info.dwNumberOfProcessors : 1;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return (count > 0) ? (size_t)count : 1;
+#endif
+}
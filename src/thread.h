@@ -0,0 +1,63 @@
+#ifndef __THREAD_H__
+#define __THREAD_H__ 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+typedef void (*thread_func)(void* arg);
+
+typedef struct thread {
+#ifdef _WIN32
+    HANDLE handle;
+#else
+    pthread_t handle;
+#endif
+    thread_func func;
+    void* arg;
+} thread;
+
+typedef struct mutex {
+#ifdef _WIN32
+    SRWLOCK lock;
+#else
+    pthread_mutex_t lock;
+#endif
+} mutex;
+
+typedef struct condvar {
+#ifdef _WIN32
+    CONDITION_VARIABLE cond;
+#else
+    pthread_cond_t cond;
+#endif
+} condvar;
+
+// thread must stay alive until thread_join
+bool thread_start(thread* th, thread_func func, void* arg);
+void thread_join(thread* th);
+
+void mutex_init(mutex* m);
+void mutex_destroy(mutex* m);
+void mutex_lock(mutex* m);
+void mutex_unlock(mutex* m);
+
+void condvar_init(condvar* cv);
+void condvar_destroy(condvar* cv);
+void condvar_wait(condvar* cv, mutex* m);
+void condvar_signal(condvar* cv);
+void condvar_broadcast(condvar* cv);
+
+// Pointer sized word shared between threads, both calls are full barriers
+uintptr_t atomic_load_word(volatile uintptr_t* word);
+bool atomic_cas_word(volatile uintptr_t* word, uintptr_t expected, uintptr_t desired);
+
+size_t cpu_count(void);
+
+#endif // __THREAD_H__
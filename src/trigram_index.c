@@ -0,0 +1,436 @@
+#include <stdalign.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+
+#include <sys/stat.h>
+
+#include "general.h"
+#include "text_count.h"
+#include "trigram_index.h"
+
+#define INDEX_MAGIC "STIDX\0\0\0"
+#define INDEX_VERSION (1)
+#define INDEX_ENDIAN (0x01020304u)
+#define INDEX_GRAM_SPACE (1u << 24)
+#define INDEX_SLOT_MIN_CAPACITY (8)
+
+// On-disk layout: header, index_block[block_count], index_gram[gram_count], postings.
+// Every section stays 8-byte aligned inside the mapping.
+typedef struct index_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t endian; // INDEX_ENDIAN as written, the sidecar is not portable across byte orders
+    uint64_t file_size;
+    int64_t file_mtime;
+    uint64_t block_size;
+    uint64_t block_count;
+    uint64_t gram_count;
+    uint64_t postings_size;
+} index_header;
+
+typedef struct gram_slot {
+    uint64_t last_block;
+    uint32_t count;
+    uint8_t* data; // varint deltas
+    size_t size;
+    size_t capacity;
+} gram_slot;
+
+typedef struct index_builder {
+    uint32_t* slot_of; // gram -> slot index + 1; pages of unseen grams are never touched
+    gram_slot* slots;
+    size_t slot_count;
+    size_t slot_capacity;
+    index_block* blocks;
+    size_t block_capacity;
+    uint64_t block_count;
+} index_builder;
+
+static bool file_stamp(const char* path, uint64_t* size, int64_t* mtime) {
+#ifdef _WIN32
+    struct _stat64 st;
+    if (_stat64(path, &st) != 0) return false;
+#else
+    struct stat st;
+    if (stat(path, &st) != 0) return false;
+#endif
+    *size = (uint64_t)st.st_size;
+    *mtime = (int64_t)st.st_mtime;
+    return true;
+}
+
+static char* sidecar_path(const char* path) {
+    size_t length = strlen(path);
+    char* sidecar = malloc(length + sizeof(INDEX_SUFFIX));
+    assert(sidecar != NULL);
+    memcpy(sidecar, path, length);
+    memcpy(sidecar + length, INDEX_SUFFIX, sizeof(INDEX_SUFFIX));
+    return sidecar;
+}
+
+static void slot_append(gram_slot* slot, uint64_t value) {
+    if (slot->capacity - slot->size < 10) {
+        size_t new_capacity = slot->capacity ? slot->capacity * 2 : INDEX_SLOT_MIN_CAPACITY * 2;
+        uint8_t* data = realloc(slot->data, new_capacity);
+        assert(data != NULL && "Failed to grow posting list");
+        slot->data = data;
+        slot->capacity = new_capacity;
+    }
+    while (value >= 0x80) {
+        slot->data[slot->size++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    slot->data[slot->size++] = (uint8_t)value;
+}
+
+static void builder_add(index_builder* builder, uint32_t gram, uint64_t block) {
+    uint32_t index = builder->slot_of[gram];
+    if (index == 0) {
+        if (builder->slot_count == builder->slot_capacity) {
+            size_t new_capacity = builder->slot_capacity ? builder->slot_capacity * 2 : 1024;
+            gram_slot* slots = realloc(builder->slots, new_capacity * sizeof(gram_slot));
+            assert(slots != NULL && "Failed to grow gram table");
+            builder->slots = slots;
+            builder->slot_capacity = new_capacity;
+        }
+        builder->slots[builder->slot_count] = (gram_slot){0};
+        index = (uint32_t)++builder->slot_count;
+        builder->slot_of[gram] = index;
+    }
+
+    gram_slot* slot = &builder->slots[index - 1];
+    if (slot->count != 0 && slot->last_block == block) return;
+
+    slot_append(slot, slot->count ? block - slot->last_block : block);
+    slot->last_block = block;
+    ++slot->count;
+}
+
+static void builder_start_block(index_builder* builder, uint64_t line, uint64_t column) {
+    if (builder->block_count == builder->block_capacity) {
+        size_t new_capacity = builder->block_capacity ? builder->block_capacity * 2 : 1024;
+        index_block* blocks = realloc(builder->blocks, new_capacity * sizeof(index_block));
+        assert(blocks != NULL && "Failed to grow block table");
+        builder->blocks = blocks;
+        builder->block_capacity = new_capacity;
+    }
+    builder->blocks[builder->block_count++] = (index_block){ line, column };
+}
+
+static void builder_free(index_builder* builder) {
+    for (size_t i = 0; i < builder->slot_count; ++i) {
+        free(builder->slots[i].data);
+    }
+    free(builder->slots);
+    free(builder->blocks);
+    free(builder->slot_of);
+}
+
+static bool builder_write(const index_builder* builder, FILE* out, uint64_t file_size, int64_t file_mtime) {
+    index_header header = {
+        .version = INDEX_VERSION,
+        .endian = INDEX_ENDIAN,
+        .file_size = file_size,
+        .file_mtime = file_mtime,
+        .block_size = INDEX_BLOCK_SIZE,
+        .block_count = builder->block_count,
+        .gram_count = builder->slot_count,
+        .postings_size = 0,
+    };
+    memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+    for (size_t i = 0; i < builder->slot_count; ++i) {
+        header.postings_size += builder->slots[i].size;
+    }
+
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+    if (ok && builder->block_count != 0) {
+        ok = fwrite(builder->blocks, sizeof(index_block), builder->block_count, out) == builder->block_count;
+    }
+
+    // Gram table in gram order, postings in the same order
+    uint64_t offset = 0;
+    for (uint32_t gram = 0; ok && gram < INDEX_GRAM_SPACE; ++gram) {
+        if (builder->slot_of[gram] == 0) continue;
+        const gram_slot* slot = &builder->slots[builder->slot_of[gram] - 1];
+        index_gram entry = { gram, slot->count, offset };
+        ok = fwrite(&entry, sizeof(entry), 1, out) == 1;
+        offset += slot->size;
+    }
+    for (uint32_t gram = 0; ok && gram < INDEX_GRAM_SPACE; ++gram) {
+        if (builder->slot_of[gram] == 0) continue;
+        const gram_slot* slot = &builder->slots[builder->slot_of[gram] - 1];
+        ok = fwrite(slot->data, 1, slot->size, out) == slot->size;
+    }
+    return ok;
+}
+
+bool trigram_index_build(const char* path, output_writer* report) {
+    assert(path != NULL);
+    assert(report != NULL);
+
+    uint64_t file_size = 0;
+    int64_t file_mtime = 0;
+    FILE* file = NULL;
+    if (!file_stamp(path, &file_size, &file_mtime) || fopen_s(&file, path, "rb") != 0) {
+        PRINT_ERRNO("Failed to open file");
+        return false;
+    }
+
+    index_builder builder = {0};
+    builder.slot_of = calloc(INDEX_GRAM_SPACE, sizeof(uint32_t));
+    assert(builder.slot_of != NULL);
+
+    ifstream stream = {0};
+    ifstream_init(&stream, file);
+
+    // Trigrams belong to the block of their first byte
+    uint64_t offset = 0;
+    uint64_t line = 0;
+    uint64_t column = 0;
+    uint32_t window = 0;
+    size_t size = 0;
+    const char* data = ifstream_peek(&stream, &size);
+    while (size != 0) {
+        for (size_t i = 0; i < size; ++i, ++offset) {
+            const unsigned char byte = (unsigned char)data[i];
+            if (offset % INDEX_BLOCK_SIZE == 0) {
+                builder_start_block(&builder, line, column);
+            }
+            window = ((window << 8) | byte) & (INDEX_GRAM_SPACE - 1);
+            if (offset >= 2) {
+                builder_add(&builder, window, (offset - 2) / INDEX_BLOCK_SIZE);
+            }
+
+            if (byte == '\n') {
+                ++line;
+                column = 0;
+            } else {
+                column += ((byte & 0xC0) != 0x80);
+            }
+        }
+        ifstream_consume(&stream, size);
+        data = ifstream_peek(&stream, &size);
+    }
+    ifstream_close(&stream);
+    fclose(file);
+
+    if (offset != file_size) {
+        fprintf(stderr, "File changed while indexing: %s\n", path);
+        builder_free(&builder);
+        return false;
+    }
+
+    char* sidecar = sidecar_path(path);
+    FILE* out = NULL;
+    bool ok = fopen_s(&out, sidecar, "wb") == 0;
+    if (!ok) {
+        PRINT_ERRNO("Failed to create index");
+    } else {
+        ok = builder_write(&builder, out, file_size, file_mtime);
+        ok = (fclose(out) == 0) && ok;
+        if (!ok) {
+            PRINT_ERRNO("Failed to write index");
+            remove(sidecar);
+        }
+    }
+    if (ok) {
+        output_printf(report, "Index written: %s (%llu blocks, %zu trigrams)\n",
+                      sidecar, (unsigned long long)builder.block_count, builder.slot_count);
+    }
+
+    free(sidecar);
+    builder_free(&builder);
+    return ok;
+}
+
+static bool index_layout_valid(const index_header* header, size_t size) {
+    // Matches must not span more than two blocks
+    if (header->block_size < SEARCH_PATTERN_MAX_SIZE || header->gram_count > INDEX_GRAM_SPACE) return false;
+    if (header->block_count != (header->file_size + header->block_size - 1) / header->block_size) return false;
+
+    uint64_t rest = size - sizeof(index_header);
+    if (header->block_count > rest / sizeof(index_block)) return false;
+    rest -= header->block_count * sizeof(index_block);
+    if (header->gram_count > rest / sizeof(index_gram)) return false;
+    rest -= header->gram_count * sizeof(index_gram);
+    return header->postings_size == rest;
+}
+
+bool trigram_index_open(trigram_index* index, const char* path) {
+    assert(index != NULL);
+    assert(path != NULL);
+
+    memset(index, 0, sizeof(*index));
+
+    uint64_t file_size = 0;
+    int64_t file_mtime = 0;
+    if (!file_stamp(path, &file_size, &file_mtime)) return false;
+
+    char* sidecar = sidecar_path(path);
+    bool opened = fopen_s(&index->file, sidecar, "rb") == 0;
+    free(sidecar);
+    if (!opened) return false;
+
+    ifstream_init_backend(&index->stream, index->file, IFSTREAM_MMAP_RANDOM);
+    size_t size = 0;
+    const char* data = ifstream_peek(&index->stream, &size);
+
+    const index_header* header = (const index_header*)data;
+    bool valid = index->stream.mapped
+        && size >= sizeof(index_header)
+        && memcmp(header->magic, INDEX_MAGIC, sizeof(header->magic)) == 0
+        && header->version == INDEX_VERSION
+        && header->endian == INDEX_ENDIAN
+        && header->file_size == file_size
+        && header->file_mtime == file_mtime
+        && index_layout_valid(header, size);
+    if (!valid) {
+        trigram_index_close(index);
+        return false;
+    }
+
+    const char* blocks = data + sizeof(index_header);
+    const char* grams = blocks + header->block_count * sizeof(index_block);
+    index->block_size = header->block_size;
+    index->block_count = header->block_count;
+    index->blocks = (const index_block*)blocks;
+    index->grams = (const index_gram*)grams;
+    index->gram_count = header->gram_count;
+    index->postings = (const uint8_t*)(grams + header->gram_count * sizeof(index_gram));
+    index->postings_size = header->postings_size;
+    return true;
+}
+
+void trigram_index_close(trigram_index* index) {
+    if (index == NULL || index->file == NULL) return;
+
+    ifstream_close(&index->stream);
+    fclose(index->file);
+    memset(index, 0, sizeof(*index));
+}
+
+static const index_gram* index_find(const trigram_index* index, uint32_t gram) {
+    size_t low = 0;
+    size_t high = index->gram_count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (index->grams[mid].gram < gram) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return (low < index->gram_count && index->grams[low].gram == gram) ? &index->grams[low] : NULL;
+}
+
+// Blocks where a match may start: the gram itself starts there or in the next block
+static void index_gram_blocks(const trigram_index* index, const index_gram* entry, uint64_t* bits) {
+    const uint8_t* p = index->postings + entry->offset;
+    const uint8_t* end = index->postings + index->postings_size;
+    uint64_t block = 0;
+
+    for (uint32_t i = 0; i < entry->count && p < end; ++i) {
+        uint64_t delta = 0;
+        unsigned shift = 0;
+        while (p < end && (*p & 0x80) && shift < 63) {
+            delta |= (uint64_t)(*p++ & 0x7F) << shift;
+            shift += 7;
+        }
+        if (p < end) delta |= (uint64_t)*p++ << shift;
+
+        block += delta;
+        if (block >= index->block_count) break;
+        bits[block / 64] |= 1ull << (block % 64);
+        if (block != 0) bits[(block - 1) / 64] |= 1ull << ((block - 1) % 64);
+    }
+}
+
+bool trigram_index_candidates(const trigram_index* index, const search_pattern* patterns, size_t count,
+                              uint64_t* bits) {
+    assert(index != NULL);
+    assert(patterns != NULL);
+    assert(bits != NULL);
+
+    const size_t words = (size_t)((index->block_count + 63) / 64);
+    for (size_t i = 0; i < count; ++i) {
+        // Trigrams with a wildcard byte are not looked up, one exact trigram is needed
+        size_t run = 0;
+        pattern_exact_run(&patterns[i], &run);
+        if (run < 3) return false;
+    }
+    if (words == 0) return true;
+
+    uint64_t* pattern_bits = malloc(words * sizeof(uint64_t));
+    uint64_t* gram_bits = malloc(words * sizeof(uint64_t));
+    assert(pattern_bits != NULL && gram_bits != NULL);
+    memset(bits, 0, words * sizeof(uint64_t));
+
+    for (size_t i = 0; i < count; ++i) {
+        const unsigned char* data = (const unsigned char*)patterns[i].data;
+        memset(pattern_bits, 0xFF, words * sizeof(uint64_t));
+
+        const unsigned char* mask = patterns[i].mask;
+        for (size_t k = 0; k + 3 <= patterns[i].size; ++k) {
+            if (mask != NULL && (mask[k] & mask[k + 1] & mask[k + 2]) != 0xFF) continue;
+            uint32_t gram = ((uint32_t)data[k] << 16) | ((uint32_t)data[k + 1] << 8) | data[k + 2];
+            const index_gram* entry = index_find(index, gram);
+            if (entry == NULL) {
+                memset(pattern_bits, 0, words * sizeof(uint64_t));
+                break;
+            }
+
+            memset(gram_bits, 0, words * sizeof(uint64_t));
+            index_gram_blocks(index, entry, gram_bits);
+            for (size_t w = 0; w < words; ++w) pattern_bits[w] &= gram_bits[w];
+        }
+        for (size_t w = 0; w < words; ++w) bits[w] |= pattern_bits[w];
+    }
+
+    // Bits past the last block
+    if (index->block_count % 64 != 0) {
+        bits[words - 1] &= (1ull << (index->block_count % 64)) - 1;
+    }
+
+    free(gram_bits);
+    free(pattern_bits);
+    return true;
+}
+
+bool trigram_index_locate(const trigram_index* index, FILE* file, uint64_t offset, uint64_t* line, uint64_t* column) {
+    assert(index != NULL);
+    assert(file != NULL);
+    assert(line != NULL && column != NULL);
+
+    const uint64_t block = offset / index->block_size;
+    if (block >= index->block_count) return false;
+
+    const uint64_t start = block * index->block_size;
+    *line = index->blocks[block].line;
+    *column = index->blocks[block].column;
+    if (offset == start) return true;
+
+    ifstream stream;
+    ifstream_init_window(&stream, file, IFSTREAM_BUFFERED, start, offset - start);
+    size_t size = 0;
+    const char* data = ifstream_peek(&stream, &size);
+    uint64_t counted = 0;
+    while (size != 0) {
+        const size_t newlines = count_newlines(data, size);
+        if (newlines != 0) {
+            const char* last = find_last_newline(data, size);
+            *line += newlines;
+            *column = count_utf8_chars(last + 1, (size_t)(data + size - last - 1));
+        } else {
+            *column += count_utf8_chars(data, size);
+        }
+        counted += size;
+        ifstream_consume(&stream, size);
+        data = ifstream_peek(&stream, &size);
+    }
+    ifstream_close(&stream);
+    rewind(file);
+    return counted == offset - start;
+}
@@ -0,0 +1,59 @@
+#ifndef __TRIGRAM_INDEX_H__
+#define __TRIGRAM_INDEX_H__ 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "ifstream.h"
+#include "output.h"
+#include "pattern_set.h"
+
+// Sidecar index "<file>.stidx": for every trigram, the ids of the fixed-size blocks
+// where it starts. Postings are delta + varint encoded. Every block also records the
+// line and column of its first byte, so a search can start at any block.
+
+#define INDEX_SUFFIX ".stidx"
+#define INDEX_BLOCK_SIZE (64 * 1024)
+
+typedef struct index_block {
+    uint64_t line;   // newlines before the block
+    uint64_t column; // chars between the last newline and the block
+} index_block;
+
+typedef struct index_gram {
+    uint32_t gram;   // three bytes, first one highest
+    uint32_t count;  // postings
+    uint64_t offset; // from the start of the postings section
+} index_gram;
+
+typedef struct trigram_index {
+    ifstream stream; // mapped sidecar
+    FILE* file;
+    uint64_t block_size;
+    uint64_t block_count;
+    const index_block* blocks;
+    const index_gram* grams; // sorted by gram
+    uint64_t gram_count;
+    const uint8_t* postings;
+    uint64_t postings_size;
+} trigram_index;
+
+// Writes the sidecar next to path and reports it, returns false after printing an error
+bool trigram_index_build(const char* path, output_writer* report);
+
+// Maps the sidecar of path. Missing, damaged or stale (size/mtime) sidecars return false.
+bool trigram_index_open(trigram_index* index, const char* path);
+void trigram_index_close(trigram_index* index);
+
+// Sets one bit per block that may hold the start of a match of any pattern.
+// Returns false when some pattern has no trigram, so every block is a candidate.
+bool trigram_index_candidates(const trigram_index* index, const search_pattern* patterns, size_t count,
+                              uint64_t* bits);
+
+// Line and column of offset in the indexed file, counted from the block it falls in,
+// so at most one block is read. file is left at its start.
+bool trigram_index_locate(const trigram_index* index, FILE* file, uint64_t offset, uint64_t* line, uint64_t* column);
+
+#endif // __TRIGRAM_INDEX_H__
@@ -1,3 +1,7 @@
+#include <stdbool.h>
+#include <wchar.h>
+#include <wctype.h>
+
 #include "utf8_util.h"
 
 size_t utf8_strlen(const char* str, size_t max_bytes) {
@@ -52,4 +56,107 @@ size_t utf8_strlen(const char* str, size_t max_bytes) {
     }
     
     return char_count;
-}
\ No newline at end of file
+}
+
+size_t utf8_decode(const char* str, size_t max_bytes, uint32_t* codepoint) {
+    if (str == NULL || max_bytes == 0) return 0;
+
+    const uint8_t c = (uint8_t)str[0];
+    const size_t char_len = utf8_length[c];
+    if (char_len == 0 || char_len > max_bytes) return 0;
+    if (char_len == 1) {
+        *codepoint = c;
+        return 1;
+    }
+
+    uint32_t value = c & (0x7F >> char_len);
+    for (size_t j = 1; j < char_len; j++) {
+        if ((str[j] & 0xC0) != 0x80) return 0;
+        value = (value << 6) | (str[j] & 0x3F);
+    }
+
+    // Overlong forms, surrogates and values past Unicode
+    static const uint32_t min_value[5] = { 0, 0, 0x80, 0x800, 0x10000 };
+    if (value < min_value[char_len] || value > 0x10FFFF || (value >= 0xD800 && value <= 0xDFFF)) return 0;
+
+    *codepoint = value;
+    return char_len;
+}
+
+size_t utf8_encode(uint32_t codepoint, char* out) {
+    if (codepoint < 0x80) {
+        out[0] = (char)codepoint;
+        return 1;
+    }
+    if (codepoint < 0x800) {
+        out[0] = (char)(0xC0 | (codepoint >> 6));
+        out[1] = (char)(0x80 | (codepoint & 0x3F));
+        return 2;
+    }
+    if (codepoint < 0x10000) {
+        out[0] = (char)(0xE0 | (codepoint >> 12));
+        out[1] = (char)(0x80 | ((codepoint >> 6) & 0x3F));
+        out[2] = (char)(0x80 | (codepoint & 0x3F));
+        return 3;
+    }
+    out[0] = (char)(0xF0 | (codepoint >> 18));
+    out[1] = (char)(0x80 | ((codepoint >> 12) & 0x3F));
+    out[2] = (char)(0x80 | ((codepoint >> 6) & 0x3F));
+    out[3] = (char)(0x80 | (codepoint & 0x3F));
+    return 4;
+}
+
+static uint32_t utf8_case_map(uint32_t codepoint, bool upper) {
+    // 16-bit wchar_t (Windows) can't hold the rest
+    if (codepoint > WCHAR_MAX) return codepoint;
+    wint_t mapped = upper ? towupper((wint_t)codepoint) : towlower((wint_t)codepoint);
+    return (uint32_t)mapped;
+}
+
+static size_t utf8_encoded_size(uint32_t codepoint) {
+    if (codepoint < 0x80) return 1;
+    if (codepoint < 0x800) return 2;
+    if (codepoint < 0x10000) return 3;
+    return 4;
+}
+
+// Code points that share a simple fold with another one, so the round trip
+// through upper and lower case from that other one never reaches them
+static const uint32_t utf8_fold_extras[] = {
+    0x00B5, 0x017F, 0x01C5, 0x01C8, 0x01CB, 0x01F2, 0x0345, 0x03C2,
+    0x03D0, 0x03D1, 0x03D5, 0x03D6, 0x03F0, 0x03F1, 0x03F4, 0x03F5,
+    0x1C80, 0x1C81, 0x1C82, 0x1C83, 0x1C84, 0x1C85, 0x1C86, 0x1C87,
+    0x1C88, 0x1E9B, 0x1E9E, 0x1FBE, 0x2126, 0x212A, 0x212B,
+};
+
+static uint32_t utf8_fold_key(uint32_t codepoint) {
+    return utf8_case_map(utf8_case_map(codepoint, true), false);
+}
+
+static size_t utf8_add_variant(uint32_t c, uint32_t codepoint, uint32_t* variants, size_t count) {
+    if (c > 0x10FFFF || utf8_encoded_size(c) != utf8_encoded_size(codepoint)) return count;
+    for (size_t j = 0; j < count; ++j) {
+        if (variants[j] == c) return count;
+    }
+    if (count == UTF8_MAX_CASE_VARIANTS) return count;
+    variants[count] = c;
+    return count + 1;
+}
+
+size_t utf8_case_variants(uint32_t codepoint, uint32_t* variants) {
+    const uint32_t key = utf8_fold_key(codepoint);
+
+    size_t count = 0;
+    count = utf8_add_variant(codepoint, codepoint, variants, count);
+    count = utf8_add_variant(utf8_case_map(codepoint, false), codepoint, variants, count);
+    count = utf8_add_variant(utf8_case_map(codepoint, true), codepoint, variants, count);
+    count = utf8_add_variant(key, codepoint, variants, count);
+    count = utf8_add_variant(utf8_case_map(key, true), codepoint, variants, count);
+    // The rest of the class, e.g. final sigma for σ and Σ, micro sign for μ
+    for (size_t i = 0; i < sizeof(utf8_fold_extras) / sizeof(utf8_fold_extras[0]); ++i) {
+        if (utf8_fold_key(utf8_fold_extras[i]) == key) {
+            count = utf8_add_variant(utf8_fold_extras[i], codepoint, variants, count);
+        }
+    }
+    return count;
+}
@@ -1,6 +1,7 @@
 #ifndef __UTF8_UTIL_H__
 #define __UTF8_UTIL_H__ 1
 
+#include <stddef.h>
 #include <stdint.h>
 #include <ctype.h>
 
@@ -16,4 +17,16 @@ static const uint8_t utf8_length[256] = {
 };
 
 size_t utf8_strlen(const char* str, size_t max_bytes);
+
+// Returns bytes taken by the character at str, 0 for invalid or truncated UTF-8
+size_t utf8_decode(const char* str, size_t max_bytes, uint32_t* codepoint);
+// Writes 1-4 bytes, returns their count
+size_t utf8_encode(uint32_t codepoint, char* out);
+
+#define UTF8_MAX_CASE_VARIANTS (4)
+
+// Every code point with the same simple case fold as codepoint under the current
+// LC_CTYPE locale, codepoint itself first. Variants with a different UTF-8 length
+// are left out.
+size_t utf8_case_variants(uint32_t codepoint, uint32_t* variants);
 #endif // __UTF8_UTIL_H__
\ No newline at end of file
@@ -0,0 +1,109 @@
+#include <stdbool.h>
+#include <assert.h>
+#include <string.h>
+
+#include "hex_dump.h"
+#include "view.h"
+
+output_mode_t parse_output_mode(const char* mode_str) {
+    assert(mode_str != NULL);
+
+    if (strcmp(mode_str, "hex") == 0) return OUTPUT_HEX;
+    if (strcmp(mode_str, "ascii") == 0) return OUTPUT_ASCII;
+    if (strcmp(mode_str, "textonly") == 0) return OUTPUT_TEXTONLY;
+    return OUTPUT_RAW;
+}
+
+typedef struct dump_writer {
+    output_mode_t mode;
+    size_t bytes_per_line;
+    size_t column;        // Bytes already on the current line
+    bool last_printable;  // Textonly state between blocks
+    output_writer* out;
+} dump_writer;
+
+static size_t dump_width(output_mode_t mode) {
+    switch (mode) {
+        case OUTPUT_HEX: return DUMP_HEX_WIDTH;
+        case OUTPUT_ASCII: return DUMP_ASCII_WIDTH;
+        case OUTPUT_TEXTONLY: return 1;
+        default: return DUMP_RAW_WIDTH;
+    }
+}
+
+static dump_writer dump_writer_new(output_writer* out, output_mode_t mode, size_t bytes_per_line) {
+    assert(out != NULL);
+    assert(bytes_per_line != 0);
+
+    return (dump_writer) {
+        .mode = mode,
+        .bytes_per_line = bytes_per_line,
+        .column = 0,
+        .last_printable = true,
+        .out = out,
+    };
+}
+
+// Formats whole runs of a line straight into the output buffer,
+// a line may span several calls
+static void dump_write(dump_writer* writer, const char* data, size_t size) {
+    const size_t width = dump_width(writer->mode);
+    const bool lines = writer->mode != OUTPUT_TEXTONLY;
+
+    while (size != 0) {
+        // Room for at least one byte and the line break
+        char* buffer = output_reserve(writer->out, width + 1);
+
+        size_t n = (output_available(writer->out) - 1) / width;
+        if (n > size) n = size;
+        if (lines && n > writer->bytes_per_line - writer->column) n = writer->bytes_per_line - writer->column;
+
+        size_t used = 0;
+        switch (writer->mode) {
+            case OUTPUT_HEX: used = dump_hex(buffer, data, n); break;
+            case OUTPUT_ASCII: used = dump_ascii(buffer, data, n); break;
+            case OUTPUT_TEXTONLY: used = dump_textonly(buffer, data, n, &writer->last_printable); break;
+            default:
+            case OUTPUT_RAW: used = dump_raw(buffer, data, n); break;
+        }
+        data += n;
+        size -= n;
+
+        if (lines) {
+            writer->column += n;
+            if (writer->column == writer->bytes_per_line) {
+                buffer[used++] = '\n';
+                writer->column = 0;
+            }
+        }
+        output_commit(writer->out, used);
+    }
+}
+
+static void dump_finish(dump_writer* writer, bool empty) {
+    if (writer->column != 0 || writer->mode == OUTPUT_TEXTONLY || empty) {
+        output_char(writer->out, '\n');
+    }
+    output_flush(writer->out);
+}
+
+void print_data(output_writer* out, const char* data, size_t size, size_t bytes_per_line, output_mode_t mode) {
+    dump_writer writer = dump_writer_new(out, mode, bytes_per_line);
+    dump_write(&writer, data, size);
+    dump_finish(&writer, size == 0);
+}
+
+void print_file(print_ctx* ctx, ifstream* stream) {
+    dump_writer writer = dump_writer_new(ctx->out, ctx->mode, ctx->bytes_per_line);
+    bool empty = true;
+    size_t size = 0;
+    const char* data = ifstream_peek(stream, &size);
+
+    while (size != 0) {
+        dump_write(&writer, data, size);
+        empty = false;
+        ifstream_consume(stream, size);
+        data = ifstream_peek(stream, &size);
+    }
+    dump_finish(&writer, empty);
+}
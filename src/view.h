@@ -0,0 +1,29 @@
+#ifndef __VIEW_H__
+#define __VIEW_H__ 1
+
+#include <stddef.h>
+
+#include "ifstream.h"
+#include "output.h"
+
+// File views (-v): the whole stream formatted in one of the dump modes
+
+typedef enum {
+    OUTPUT_RAW,
+    OUTPUT_HEX,
+    OUTPUT_ASCII,
+    OUTPUT_TEXTONLY,
+} output_mode_t;
+
+typedef struct print_ctx {
+    output_mode_t mode;
+    size_t bytes_per_line;
+    output_writer* out;
+} print_ctx;
+
+output_mode_t parse_output_mode(const char* mode_str);
+
+void print_data(output_writer* out, const char* data, size_t size, size_t bytes_per_line, output_mode_t mode);
+void print_file(print_ctx* ctx, ifstream* stream);
+
+#endif // __VIEW_H__
@@ -0,0 +1,171 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "work_pool.h"
+
+#define WORK_DEQUE_MIN_CAPACITY (64)
+
+typedef struct work_worker_arg {
+    work_pool* pool;
+    size_t index;
+} work_worker_arg;
+
+static void deque_push(work_deque* deque, void* item) {
+    mutex_lock(&deque->lock);
+    if (deque->count == deque->capacity) {
+        size_t new_capacity = deque->capacity ? deque->capacity * 2 : WORK_DEQUE_MIN_CAPACITY;
+        void** items = malloc(new_capacity * sizeof(void*));
+        assert(items != NULL && "Failed to grow work deque");
+        for (size_t i = 0; i < deque->count; ++i) {
+            items[i] = deque->items[(deque->head + i) % deque->capacity];
+        }
+        free(deque->items);
+        deque->items = items;
+        deque->head = 0;
+        deque->capacity = new_capacity;
+    }
+    deque->items[(deque->head + deque->count) % deque->capacity] = item;
+    ++deque->count;
+    mutex_unlock(&deque->lock);
+}
+
+static bool deque_pop_newest(work_deque* deque, void** item) {
+    mutex_lock(&deque->lock);
+    bool found = deque->count != 0;
+    if (found) {
+        --deque->count;
+        *item = deque->items[(deque->head + deque->count) % deque->capacity];
+    }
+    mutex_unlock(&deque->lock);
+    return found;
+}
+
+static bool deque_steal_oldest(work_deque* deque, void** item) {
+    mutex_lock(&deque->lock);
+    bool found = deque->count != 0;
+    if (found) {
+        *item = deque->items[deque->head];
+        deque->head = (deque->head + 1) % deque->capacity;
+        --deque->count;
+    }
+    mutex_unlock(&deque->lock);
+    return found;
+}
+
+static bool pool_take(work_pool* pool, size_t index, void** item) {
+    if (deque_pop_newest(&pool->deques[index], item)) return true;
+    for (size_t i = 1; i < pool->worker_count; ++i) {
+        if (deque_steal_oldest(&pool->deques[(index + i) % pool->worker_count], item)) return true;
+    }
+    return false;
+}
+
+static void pool_worker(void* arg) {
+    work_worker_arg* worker = arg;
+    work_pool* pool = worker->pool;
+
+    // worker_count is final once the starting thread releases the lock
+    mutex_lock(&pool->lock);
+    mutex_unlock(&pool->lock);
+
+    for (;;) {
+        void* item = NULL;
+        if (pool_take(pool, worker->index, &item)) {
+            mutex_lock(&pool->lock);
+            --pool->pending;
+            mutex_unlock(&pool->lock);
+
+            pool->func(pool->user, worker->index, item);
+            continue;
+        }
+
+        // pending may still count an item another worker is about to take, then just rescan
+        mutex_lock(&pool->lock);
+        while (pool->pending == 0 && !pool->closed) {
+            condvar_wait(&pool->changed, &pool->lock);
+        }
+        bool done = (pool->pending == 0 && pool->closed);
+        mutex_unlock(&pool->lock);
+        if (done) break;
+    }
+    free(worker);
+}
+
+bool work_pool_start(work_pool* pool, size_t worker_count, work_func func, void* user) {
+    assert(pool != NULL);
+    assert(func != NULL);
+    assert(worker_count != 0);
+
+    memset(pool, 0, sizeof(*pool));
+    pool->func = func;
+    pool->user = user;
+    pool->deques = calloc(worker_count, sizeof(work_deque));
+    pool->workers = calloc(worker_count, sizeof(thread));
+    assert(pool->deques != NULL && pool->workers != NULL);
+
+    pool->deque_count = worker_count;
+    for (size_t i = 0; i < worker_count; ++i) {
+        mutex_init(&pool->deques[i].lock);
+    }
+    mutex_init(&pool->lock);
+    condvar_init(&pool->changed);
+
+    // Items only go to deques of running workers, so a partial start still drains everything
+    mutex_lock(&pool->lock);
+    for (size_t i = 0; i < worker_count; ++i) {
+        work_worker_arg* arg = malloc(sizeof(work_worker_arg));
+        assert(arg != NULL);
+        arg->pool = pool;
+        arg->index = i;
+        if (!thread_start(&pool->workers[i], pool_worker, arg)) {
+            free(arg);
+            break;
+        }
+        ++pool->worker_count;
+    }
+    mutex_unlock(&pool->lock);
+
+    if (pool->worker_count == 0) {
+        work_pool_finish(pool);
+        return false;
+    }
+    return true;
+}
+
+void work_pool_submit(work_pool* pool, void* item) {
+    assert(pool != NULL);
+    assert(!pool->closed);
+
+    deque_push(&pool->deques[pool->next_deque], item);
+    pool->next_deque = (pool->next_deque + 1) % pool->worker_count;
+
+    mutex_lock(&pool->lock);
+    ++pool->pending;
+    condvar_signal(&pool->changed);
+    mutex_unlock(&pool->lock);
+}
+
+void work_pool_finish(work_pool* pool) {
+    assert(pool != NULL);
+
+    mutex_lock(&pool->lock);
+    pool->closed = true;
+    condvar_broadcast(&pool->changed);
+    mutex_unlock(&pool->lock);
+
+    for (size_t i = 0; i < pool->worker_count; ++i) {
+        thread_join(&pool->workers[i]);
+    }
+
+    for (size_t i = 0; i < pool->deque_count; ++i) {
+        mutex_destroy(&pool->deques[i].lock);
+        free(pool->deques[i].items);
+    }
+    condvar_destroy(&pool->changed);
+    mutex_destroy(&pool->lock);
+    free(pool->workers);
+    free(pool->deques);
+    pool->workers = NULL;
+    pool->deques = NULL;
+}
@@ -0,0 +1,45 @@
+#ifndef __WORK_POOL_H__
+#define __WORK_POOL_H__ 1
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "thread.h"
+
+// Work-stealing pool: every worker owns a deque and pops its newest item,
+// idle workers steal the oldest items of the others.
+
+typedef void (*work_func)(void* user, size_t worker, void* item);
+
+typedef struct work_deque {
+    mutex lock;
+    void** items; // ring buffer
+    size_t head;  // oldest item, thieves take from here
+    size_t count;
+    size_t capacity;
+} work_deque;
+
+typedef struct work_pool {
+    work_func func;
+    void* user;
+    work_deque* deques;
+    size_t deque_count;
+    thread* workers;
+    size_t worker_count; // running workers, each owns the deque with its index
+    size_t next_deque;   // submit target, round-robin
+    size_t pending;      // submitted and not yet taken
+    bool closed;
+    mutex lock;
+    condvar changed;
+} work_pool;
+
+// Returns false when no worker could be started
+bool work_pool_start(work_pool* pool, size_t worker_count, work_func func, void* user);
+
+// Single producer only
+void work_pool_submit(work_pool* pool, void* item);
+
+// Lets workers drain everything submitted so far, then joins them
+void work_pool_finish(work_pool* pool);
+
+#endif // __WORK_POOL_H__